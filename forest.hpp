@@ -3,9 +3,12 @@
 #ifndef _FOREST_HPP_
 #define _FOREST_HPP_
 
+#include <atomic>
+#include <cassert>
 #include <map>
 #include <memory>
 #include <set>
+#include <vector>
 #include "util.hpp"
 
 
@@ -26,22 +29,165 @@ enum class prior_next
 };
 
 
+template<typename T> class forest;
 template<typename T> class forest_iterator;
 template<typename T> class child_iterator;
+template<typename T> class node_block;
 
 extern int g_node_alloc_count;
 
+/*
+  ノードに何も付加しない注釈。forest_traitsのデフォルト。
+  注釈はforestのノードの基底クラスになるので、空の場合はメモリを消費しない。
+
+  注釈は以下の２つのstaticメソッドを持つ。ツリーの構造が変わるたびにforest_iteratorから呼ばれる。
+    attached( leading ): leadingの指すサブツリーがツリーにつながった後に呼ばれる。
+    detached( hole, subtree ): subtreeがツリーから切り離された後に呼ばれる。holeはsubtreeが居た場所の次のエッジ。
+*/
+struct no_annotation
+{
+  template<typename IT>
+  static void attached( const IT& ) {}
+
+  template<typename IT, typename N>
+  static void detached( const IT&, N* ) {}
+};
+
+/*
+  ツリーの構造の変更を受け取るもの。forest_journal.hppのforest_journalやstree_index.hppのkind_indexが使う。
+  listen()してからstop_listening()するまでの間、forest_iteratorの変更操作から呼ばれる。
+    chained( subtree ): subtreeがchain（insert）でつながった後。
+    unchained( subtree, hole ): subtreeがunchainで切り離された後。holeは居た場所の次のエッジ。
+    erased( leaf, hole ): eraseで葉が切り離された後。trueを返すとleafはdeleteされず、受け取った側が寿命を管理する。
+    replaced( oldNode, newNode ): replaceでoldNodeがnewNodeに差し替わった後。
+    retired( subtree ): 切り離したsubtreeが捨てられる前（retireを参照）。trueを返すと受け取った側が寿命を管理する。
+  受け取るものは同時にいくつあっても良く、新しくlisten()したものから順にすべてに通知される。
+  erasedとretiredでtrueを返して良いのは、その中の一つだけ。
+  受け取るものの並びはスレッドごとにある。listen()したスレッドでの変更だけが通知される。
+*/
+template<typename T>
+struct mutation_listener
+{
+  virtual ~mutation_listener() {}
+
+  virtual void chained( forest<T>* subtree ) = 0;
+  virtual void unchained( forest<T>* subtree, const forest_iterator<T>& hole ) = 0;
+  virtual bool erased( forest<T>* leaf, const forest_iterator<T>& hole ) = 0;
+  virtual void replaced( forest<T>* oldNode, forest<T>* newNode ) = 0;
+  virtual bool retired( forest<T>* subtree ) = 0;
+
+  // 最後にlisten()したもの。無ければnullptr。
+  static mutation_listener<T>*& active()
+  {
+    static thread_local mutation_listener<T>* listener = nullptr;
+    return listener;
+  }
+
+  // 受け取るものすべてにfn( listener )を呼ぶ。
+  template<typename F>
+  static void notify( F fn )
+  {
+    for( auto listener = active(); listener != nullptr; listener = listener->_next_listener )
+      fn( *listener );
+  }
+
+protected:
+  void listen()
+  {
+    _next_listener = active();
+    active() = this;
+  }
+
+  // listen()した順と違う順にやめても良い。
+  void stop_listening()
+  {
+    for( auto p = &active(); *p != nullptr; p = &( *p )->_next_listener )
+    {
+      if ( *p == this )
+      {
+        *p = _next_listener;
+        break;
+      }
+    }
+    _next_listener = nullptr;
+  }
+
+private:
+  mutation_listener<T>* _next_listener = nullptr;
+};
+
+/*
+  ツリーから切り離したsubtreeを捨てる前に、変更の記録（mutation_listener）に渡す。
+  記録が預かったらtrueで、subtreeはもう呼び出し側のものでは無い（deleteもプールに戻す事もしない）。
+  rollbackでツリーに戻るかもしれないので、記録が切り離しを覚えている間は消せない。
+*/
+template<typename T>
+bool hand_over_detached( forest<T>* subtree )
+{
+  bool kept = false;
+  mutation_listener<T>::notify( [&]( mutation_listener<T>& listener ) { kept = listener.retired( subtree ) || kept; } );
+  return kept;
+}
+
+/*
+  ツリーから切り離したsubtreeを捨てる。記録が預かった時はdeleteしない。
+  unchainやreplaceで切り離したサブツリーを消す時は、deleteの代わりにこれを使う。
+*/
+template<typename T>
+void retire( forest<T>* subtree )
+{
+  if ( !hand_over_detached( subtree ) )
+    delete subtree;
+}
+
+/*
+  ノードの型Tごとの設定。特殊化するとforest<T>の振る舞いを変えられる。
+  annotation: 各ノードに付加する注釈（no_annotationを参照）。
+*/
+template<typename T>
+struct forest_traits
+{
+  using annotation = no_annotation;
+};
+
+// const_iteratorはforest<const T>にキャストして使うので、レイアウトがTと同じで無いといけない。
+template<typename T>
+struct forest_traits<const T> : forest_traits<T> {};
+
+/*
+  compact()などで一つのメモリブロックにまとめて置いたノードの、ブロックの先頭に置く管理情報。
+  ブロックのノードもdeleteで消せて、最後のノードが消えた時にブロックを解放する（forest::operator deleteを参照）。
+  違うスレッドで同じブロックのノードを消しても良いように、数はatomicにしておく。
+*/
+struct node_block_header
+{
+  std::atomic<size_t> _live;
+
+  void release()
+  {
+    if ( _live.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+      this->~node_block_header();
+      ::operator delete( this );
+    }
+  }
+};
+
 /*
 forestのノード。ノードの集合体がforestで、集合体自身を表すclassは無い。
 */
 template<typename T>
-class forest
+class forest : public forest_traits<T>::annotation
 {
   friend class forest_iterator<T>;
+  friend class node_block<typename std::remove_const<T>::type>;
 
   // _edge[dir][prior_next]の順番。
   forest<T>* _edge[2][2]; 
 
+  // ブロックに置いたノードならそのブロック。newで作ったノードはnullptr。
+  node_block_header* _block = nullptr;
+
   void init_edge()
   {
     /*
@@ -60,6 +206,7 @@ class forest
 public:
   using iterator = forest_iterator<T>;
   using const_iterator= forest_iterator<const T>;
+  using annotation = typename forest_traits<T>::annotation;
 
   using ch_iterator = child_iterator<T>;
   using const_ch_iterator = child_iterator<const T>;
@@ -81,12 +228,28 @@ public:
     g_node_alloc_count--;
     if(is_root())
     {
-      // 自分を除く子どもたちを削除。
-      begin().erase( begin().trailing_of() );
-      assert( !begin().has_children() );
+      // 自分を除く子どもたちを削除。ツリーごと消えるので、リンクのつなぎ直しも注釈の更新もしない。
+      delete_descendants();
     }
   }
 
+  /*
+    ブロックのノードもerase, retire, ルートのdeleteなど普通の道筋で消せるように、ノードのメモリはここで返す。
+    newで作ったノードは普通に解放し、ブロックのノードはブロックの生きているノードを一つ減らす。
+    ~forest()は_blockを変えないので、デストラクトした後でも読める。
+    operator newは対にする為だけのもの。片方だけインライン展開されるとgccが-Wmismatched-new-deleteを出すので、どちらも展開しない。
+  */
+  [[gnu::noinline]] static void* operator new( size_t size ) { return ::operator new( size ); }
+
+  [[gnu::noinline]] static void operator delete( void* p )
+  {
+    auto block = static_cast<forest<T>*>( p )->_block;
+    if ( block == nullptr )
+      ::operator delete( p );
+    else
+      block->release();
+  }
+
   bool is_root() const
   {
     return _edge[size_t(edge_dir::leading)][size_t(prior_next::prior)] == nullptr
@@ -95,6 +258,35 @@ public:
 
   T _data;
 
+private:
+  /*
+    子孫をpostorder（trailingを通る時）で一つずつdeleteする。
+    次のエッジを求めてから消すので、消したノードのリンクを読む事は無い。
+    消すノードはルートでは無いので、それぞれのデストラクタは子孫をたどらない。
+  */
+  void delete_descendants()
+  {
+    auto last = iterator( this, edge_dir::trailing );
+    for( auto iter = begin().next_of(); iter != last; )
+    {
+      auto node = iter.get_node();
+      bool leaving = iter.is_trailing();
+      iter++;
+      if ( leaving )
+        delete node;
+    }
+  }
+
+public:
+  /*
+  リンクを子供も親も無い単独のノードの状態に戻す。
+  リンク先のノードは更新しないので、サブツリーのノードをまとめてばらす時にだけ使う。
+  */
+  void reset_links()
+  {
+    init_edge();
+  }
+
   forest<T>*& get_link(edge_dir dir, prior_next link) { return _edge[size_t(dir)][size_t(link)]; }
   
   forest<T>* get_link(edge_dir dir, prior_next link) const { return _edge[size_t(dir)][size_t(link)]; }
@@ -175,6 +367,16 @@ public:
     return begin().has_children();
   }
 
+  /*
+  親を返す。ルートの場合はnullptr。
+  後ろの兄弟を辿るので、兄弟の数だけ時間がかかる。
+  */
+  forest<T>*
+  parent()
+  {
+    return begin().parent_node();
+  }
+
   /*
   ツリーをクローンする。
   要素のTに対し、以下の関数が存在する場合だけ使えるメソッド。
@@ -190,6 +392,7 @@ public:
 
     std::map<forest<T>*, forest<T>*> alloced;
     auto newRoot = new forest<T>( C::clone( _data ) );
+    static_cast<annotation&>( *newRoot ) = static_cast<const annotation&>( *this );
 
     // 単なるポインタの値をキーとして使いたいだけなのだが、
     // うまくconstつけてコンパイル通せなかったのでキャスト…
@@ -210,6 +413,9 @@ public:
       // newiter.set_node( newNode );
       new_iterator newiter ( newNode, iter._edge._direction );
 
+      // 構造が同じなので注釈もそのままコピーすれば良い。
+      static_cast<annotation&>( *newNode ) = static_cast<const annotation&>( *iter.get_node() );
+
       prev.set_next( newiter );
       prev++;
       assert( newiter == prev );
@@ -219,6 +425,34 @@ public:
   }
 };
 
+/*
+  unchain_siblingsで切り離した兄弟の並び。兄弟同士のリンクはつながったまま。
+  両端（_firstのleadingのpriorと_lastのtrailingのnext）だけがnullptrになっているので、
+  間のノードは単独のルートでは無い。chain_siblingsでつなぐかdelete_siblingsで消す事。
+*/
+template<typename T>
+struct sibling_list
+{
+  forest<T>* _first;
+  forest<T>* _last;
+
+  /*
+    並びのノードを前から順にfn( forest<T>* )に渡す。fnの中でリンクを変えてはいけない。
+  */
+  template<typename F>
+  void for_each( F fn ) const
+  {
+    for( auto node = _first; ; )
+    {
+      auto next = node == _last ? nullptr : node->get_link( edge_dir::trailing, prior_next::next );
+      fn( node );
+      if ( next == nullptr )
+        return;
+      node = next;
+    }
+  }
+};
+
 template<typename T>
 struct edge
 {
@@ -246,6 +480,8 @@ class forest_iterator : public iterator_facade<forest_iterator<T>, edge<T>>
   static const auto leading = edge_dir::leading;
   static const auto trailing = edge_dir::trailing;
 
+  using annotation = typename forest_traits<T>::annotation;
+
   forest<T>*& get_link(edge_dir dir, prior_next link) { return _edge._node->get_link( dir, link ); }  
   forest<T>* get_link(edge_dir dir, prior_next link) const { return _edge._node->get_link( dir, link ); }
 
@@ -262,7 +498,29 @@ class forest_iterator : public iterator_facade<forest_iterator<T>, edge<T>>
     y.set_link( y._edge._direction, prior_next::prior, get_node() );
   }
 
-  bool _rootDeleteing = false;
+  /*
+    葉を削除する。詳細はerase()を参照。
+  */
+  forest_iterator erase_leaf()
+  {
+    forest_iterator leading_prior( leading_of().prior_of() );
+    forest_iterator trailing_next( trailing_of().next_of() );
+
+    assert( !has_children() );
+    leading_prior.set_next( trailing_next );
+
+    annotation::detached( trailing_next, _edge._node );
+
+    auto leaf = _edge._node;
+    bool kept = false;
+    mutation_listener<T>::notify( [&]( mutation_listener<T>& listener ) { kept = listener.erased( leaf, trailing_next ) || kept; } );
+
+    // nullにすると誤ってend()と一致してしまうかもしれないので、deleteするだけにする。
+    if ( !kept )
+      delete _edge._node;
+
+    return  (_edge._direction == leading)  ? leading_prior.next_of() : trailing_next;
+  }
 
 
 public:
@@ -441,21 +699,43 @@ public:
     return get_node() != leading_of().next_of().get_node();
   }
 
+  /*
+    今さしているノードの親を返す。ルートの場合はnullptr。
+    後ろの兄弟を飛ばしていくので、兄弟の数だけ時間がかかる。
+  */
+  forest<T>* parent_node() const
+  {
+    auto iter = trailing_of();
+    iter++;
+    while( iter.get_node() != nullptr && iter.is_leading() )
+    {
+      iter.to_trailing();
+      iter++;
+    }
+    return iter.get_node();
+  }
+
   /*
     自身の指しているノードを削除し、次の有効なイテレータを返す。指しているノードが葉の時しか呼んではいけない。thisの指すイテレータは以後使わない事。
   */
   forest_iterator erase()
   {
-    forest_iterator leading_prior( leading_of().prior_of() );
-    forest_iterator trailing_next( trailing_of().next_of() );
-
-    assert( !has_children() );
-    leading_prior.set_next( trailing_next );
+    return erase_leaf();
+  }
 
-    // nullにすると誤ってend()と一致してしまうかもしれないので、deleteするだけにする。
-    delete _edge._node;
+  /*
+    現在指しているノードをサブツリーごと削除し、次のエッジを返す。thisはleadingで無くてはいけない。
+    unchainで切り離してからまとめてdeleteするので、リンクを直すのは切り離す所だけ。
+    変更の記録（mutation_listener）がある時は、葉ごとに記録できるようerase( last )と同じく一つずつ消す。
+  */
+  forest_iterator erase_subtree()
+  {
+    assert( is_leading() );
+    if ( mutation_listener<T>::active() != nullptr )
+      return erase( trailing_of().next_of() );
 
-    return  (_edge._direction == leading)  ? leading_prior.next_of() : trailing_next;
+    retire( unchain() );
+    return *this;
   }
 
   /*
@@ -486,7 +766,7 @@ public:
         // 二度通っていたら削除
         if (stack_depth > 0)
         {          
-          cur = cur.erase();
+          cur = cur.erase_leaf();
         } 
         else
         {
@@ -514,6 +794,10 @@ public:
     prev.set_next( result );
     newTrail.set_next( *this );
 
+    annotation::attached( result );
+
+    mutation_listener<T>::notify( [subtree]( mutation_listener<T>& listener ) { listener.chained( subtree ); } );
+
     return result;  
   }
 
@@ -538,6 +822,10 @@ public:
 
     auto ret = get_node();
 
+    annotation::detached( trailing_next, ret );
+
+    mutation_listener<T>::notify( [&]( mutation_listener<T>& listener ) { listener.unchained( ret, trailing_next ); } );
+
     // thisのイテレータを次に進める。_nodeを更新するだけでいいはず。
     _edge._node = trailing_next.get_node();
     assert( _edge._direction == leading );
@@ -545,6 +833,66 @@ public:
     return ret;
   }
 
+  /*
+    現在指しているノードからlastまでの兄弟を、兄弟のリンクをつないだまま切り離す。
+    thisはleadingで、lastは現在のノードかその後ろの兄弟で無くてはいけない。
+    リンクを直すのは両端だけなので、兄弟の数によらずO(1)。
+    ただし注釈や変更の記録（mutation_listener）がある時は、それぞれの兄弟について通知するので兄弟の数だけかかる。
+    iteratorはlastの次のエッジに進む。
+  */
+  sibling_list<T> unchain_siblings( forest<T>* last )
+  {
+    assert( is_leading() );
+    assert( !get_node()->is_root() );
+
+    sibling_list<T> res { get_node(), last };
+    forest_iterator leading_prior( prior_of() );
+    forest_iterator trailing_next( forest_iterator( last, trailing ).next_of() );
+
+    leading_prior.set_next( trailing_next );
+    res._first->get_link( leading, prior ) = nullptr;
+    res._last->get_link( trailing, next ) = nullptr;
+
+    if ( !std::is_same<annotation, no_annotation>::value || mutation_listener<T>::active() != nullptr )
+    {
+      // 居場所はどれもツリーに残っているtrailing_nextにして、後ろの兄弟から通知する。
+      // 記録を逆順に戻すと前の兄弟から順にtrailing_nextの前に入るので、元の並びになる。
+      for( auto node = last; ; node = node->get_link( leading, prior ) )
+      {
+        annotation::detached( trailing_next, node );
+        mutation_listener<T>::notify( [&]( mutation_listener<T>& listener ) { listener.unchained( node, trailing_next ); } );
+        if ( node == res._first )
+          break;
+      }
+    }
+
+    _edge = trailing_next._edge;
+    return res;
+  }
+
+  /*
+    unchain_siblingsで切り離した兄弟の並びを現在の位置に挿入する。挿入のルールはinsertと同じ。
+    unchain_siblingsと同じく、リンクを直すのは両端だけ。並びの最初のノードのleadingを返す。
+  */
+  forest_iterator<T> chain_siblings( const sibling_list<T>& list )
+  {
+    forest_iterator<T> result( list._first, leading );
+    forest_iterator<T> lastTrail( list._last, trailing );
+    forest_iterator<T> prev( prior_of() );
+
+    prev.set_next( result );
+    lastTrail.set_next( *this );
+
+    if ( !std::is_same<annotation, no_annotation>::value || mutation_listener<T>::active() != nullptr )
+    {
+      list.for_each( [&]( forest<T>* node ) {
+        annotation::attached( forest_iterator<T>( node, leading ) );
+        mutation_listener<T>::notify( [node]( mutation_listener<T>& listener ) { listener.chained( node ); } );
+      } );
+    }
+    return result;
+  }
+
   /*
     現在指しているノードを、引数のnewNodeに差し替える。
     現在指しているノードはunchainされてuniqu_ptrとして返される。
@@ -579,6 +927,13 @@ public:
     oldNode->get_link(leading, prior) = nullptr;
     oldNode->get_link(trailing, next) = nullptr;
 
+    // 古いサブツリーが抜けた穴には新しいサブツリーが入っている。
+    forest_iterator newLead( newNode, leading );
+    annotation::detached( newLead, oldNode );
+    annotation::attached( newLead );
+
+    mutation_listener<T>::notify( [&]( mutation_listener<T>& listener ) { listener.replaced( oldNode, newNode ); } );
+
     _edge._node = newNode;
     _edge._direction = trailing;
     
@@ -656,6 +1011,80 @@ public:
 
 };
 
+/*
+  firstからlastまでの兄弟をdestの位置に移す。destは移す兄弟の中を指していてはいけない。
+  リンクを直すのは両端の四か所だけなので、兄弟の数によらずO(1)（注釈がある時を除く）。
+  移した最初のノードのleadingを返す。
+*/
+template<typename T>
+forest_iterator<T> move_siblings( forest<T>* first, forest<T>* last, forest_iterator<T> dest )
+{
+  auto list = first->begin().unchain_siblings( last );
+  return dest.chain_siblings( list );
+}
+
+/*
+  unchain_siblingsで切り離した並びをすべて消す。それぞれの兄弟はretireで捨てる。
+*/
+template<typename T>
+void delete_siblings( const sibling_list<T>& list )
+{
+  std::vector<forest<T>*> roots;
+  list.for_each( [&roots]( forest<T>* node ) { roots.push_back( node ); } );
+  for( auto node : roots )
+  {
+    node->get_link( edge_dir::leading, prior_next::prior ) = nullptr;
+    node->get_link( edge_dir::trailing, prior_next::next ) = nullptr;
+    retire( node );
+  }
+}
+
+/*
+  同じツリーのノードaとbについて、preorder（ドキュメント順）でaがbより前ならtrueを返す。
+  祖先は子孫より前。
+  ルートまでの親をたどって分岐点の兄弟を比べるので、O(深さx兄弟の数)。
+*/
+template<typename T>
+bool precedes( forest<T>* a, forest<T>* b )
+{
+  if (a == b)
+    return false;
+
+  std::vector<forest<T>*> pathA { a };
+  std::vector<forest<T>*> pathB { b };
+  for( auto p = a->parent(); p != nullptr; p = p->parent() )
+    pathA.push_back( p );
+  for( auto p = b->parent(); p != nullptr; p = p->parent() )
+    pathB.push_back( p );
+
+  // ルート側から見て、最初に違うノードが分岐点の子供。
+  auto ia = pathA.rbegin();
+  auto ib = pathB.rbegin();
+  assert( *ia == *ib );
+  while( ia != pathA.rend() && ib != pathB.rend() && *ia == *ib )
+  {
+    ia++;
+    ib++;
+  }
+
+  // どちらかが祖先。
+  if (ia == pathA.rend())
+    return true;
+  if (ib == pathB.rend())
+    return false;
+
+  // 兄弟同士なので、aの側から後ろの兄弟をたどってbが居ればaが前。
+  auto iter = (*ia)->begin().trailing_of().next_of();
+  while( iter.is_leading() )
+  {
+    if (iter.get_node() == *ib)
+      return true;
+    iter.to_trailing();
+    iter++;
+  }
+  return false;
+}
+
 }
 
 #endif
@@ -0,0 +1,479 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_ARENA_HPP_
+#define _FOREST_ARENA_HPP_
+
+#include <cstdint>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+template<typename T> class arena_forest;
+template<typename T, typename ARENA = arena_forest<T>> class arena_iterator;
+
+/*
+  arena_forestのノード。リンクはポインタでは無く、arenaの中の添字（32bit）。
+  forestのノードのリンクが32byteなのに対して16byteで済む。
+  arena_forest::nposがnullptrの代わり。
+*/
+template<typename T>
+struct arena_node
+{
+  using index_t = uint32_t;
+
+  // _edge[dir][prior_next]の順番。forestと同じ。
+  index_t _edge[2][2];
+  T _data;
+
+  index_t& get_link( edge_dir dir, prior_next link ) { return _edge[size_t(dir)][size_t(link)]; }
+  index_t get_link( edge_dir dir, prior_next link ) const { return _edge[size_t(dir)][size_t(link)]; }
+};
+
+/*
+  arena_iteratorの指すエッジ。forestのedgeと同じように使える。
+*/
+template<typename T, typename ARENA = arena_forest<T>>
+struct arena_edge
+{
+  using index_t = uint32_t;
+
+  ARENA* _arena;
+  index_t _node;
+  edge_dir _direction;
+
+  arena_edge( ARENA* arena, index_t node, edge_dir dir ) : _arena( arena ), _node( node ), _direction( dir ) {}
+
+  bool equal( const arena_edge& other ) const
+  {
+    return _node == other._node && _direction == other._direction;
+  }
+
+  bool is_leading() const { return _direction == edge_dir::leading; }
+  bool is_trailing() const { return _direction == edge_dir::trailing; }
+
+  T& operator*() const { return _arena->at( _node )._data; }
+};
+
+/*
+  一つの配列（arena）に全ノードを持つforest。複数のツリーを一つのarenaに入れても良い。
+  ツリーはルートの添字で表す。
+
+  リンクが添字なので、
+    - ノードの配列が伸びて再配置されてもリンクもiteratorも壊れない
+    - Tがtrivially copyableなら_nodesをそのままmemcpyしたりファイルに書いたりできる（読み込み側で直す所が無い）
+  ノードが2^32-1個を超えるツリーは扱えない。注釈（forest_traits）は付かない。
+
+  arena_forest<string> arena;
+  auto root = arena.create( "A" );
+  auto i = arena.begin( root ).to_trailing();
+  i.insert( "B" );
+  for( auto& edge : arena.tree( root ) ) { ... }
+
+  走査はforest_iteratorと同じインターフェースのarena_iteratorで行う。
+  削除したノードの添字はフリーリストに入れて、次のノード作成で使い回す。
+*/
+template<typename T>
+class arena_forest
+{
+public:
+  using index_t = uint32_t;
+  using node = arena_node<T>;
+  using iterator = arena_iterator<T>;
+
+  static constexpr index_t npos = 0xffffffff;
+
+  std::vector<node> _nodes;
+  std::vector<index_t> _free;
+
+  arena_forest() = default;
+  arena_forest( const arena_forest& ) = delete;
+  arena_forest& operator=( const arena_forest& ) = delete;
+
+  node& at( index_t idx ) { return _nodes[idx]; }
+  const node& at( index_t idx ) const { return _nodes[idx]; }
+
+  // 生きているノードの数。
+  size_t size() const { return _nodes.size() - _free.size(); }
+
+  void reserve( size_t n ) { _nodes.reserve( n ); }
+
+  /*
+    子供も親も無い単独のノードを作って、その添字を返す。
+  */
+  index_t create( T&& data )
+  {
+    index_t idx;
+    if ( _free.empty() )
+    {
+      assert( _nodes.size() < npos );
+      idx = (index_t)_nodes.size();
+      _nodes.push_back( node { {}, std::move( data ) } );
+    }
+    else
+    {
+      idx = _free.back();
+      _free.pop_back();
+      _nodes[idx]._data = std::move( data );
+    }
+    init_edge( idx );
+    return idx;
+  }
+
+  index_t create( const T& data )
+  {
+    return create( T( data ) );
+  }
+
+  iterator begin( index_t root ) { return iterator( this, root, edge_dir::leading ); }
+  iterator end( index_t root ) { return iterator( this, root, edge_dir::trailing ).next_of(); }
+
+  /*
+    ルートrootのツリー。range-based forで全エッジを回せるので、forestと同じように使える。
+  */
+  struct tree_view
+  {
+    arena_forest* _arena;
+    index_t _root;
+
+    iterator begin() const { return _arena->begin( _root ); }
+    iterator end() const { return _arena->end( _root ); }
+  };
+
+  tree_view tree( index_t root ) { return tree_view { this, root }; }
+
+  /*
+    forestのツリーをこのarenaにコピーし、ルートの添字を返す。ノードはpreorderに並ぶ。
+  */
+  index_t copy_from( const forest<T>& src )
+  {
+    auto root = create( T( src._data ) );
+    auto cur = begin( root ).to_trailing();
+    for( auto iter = src.begin().next_of(); iter != src.end(); iter++ )
+    {
+      if ( iter.is_leading() )
+        cur = cur.insert( T( iter.get_node()->_data ) ).to_trailing();
+      else
+        cur++;
+    }
+    return root;
+  }
+
+  /*
+    rootのツリーをforestとしてコピーする。返されたforestの寿命は呼び出し側が管理する。
+  */
+  forest<T>* to_forest( index_t root )
+  {
+    auto res = new forest<T>( T( at( root )._data ) );
+    auto cur = res->begin().to_trailing();
+    for( auto iter = begin( root ).next_of(); iter != end( root ); iter++ )
+    {
+      if ( iter.is_leading() )
+        cur = cur.insert( T( iter.content() ) ).to_trailing();
+      else
+        cur++;
+    }
+    return res;
+  }
+
+  /*
+    rootのツリーをすべて削除し、添字をフリーリストに戻す。rootは単独のツリーのルートで無くてはいけない。
+    ツリーごと消えるので、リンクはつなぎ直さない。
+    arenaに残っているのがこのツリーだけなら、clear()でarenaごと解放する。
+  */
+  void destroy( index_t root )
+  {
+    assert( is_root( root ) );
+    std::vector<index_t> dead;
+    for( auto iter = begin( root ); iter != end( root ); iter++ )
+    {
+      if ( iter.is_leading() )
+        dead.push_back( iter.get_index() );
+    }
+    if ( dead.size() == size() )
+    {
+      clear();
+      return;
+    }
+    for( auto idx : dead )
+      release( idx );
+  }
+
+  /*
+    arenaのノードをすべて削除し、配列のメモリも解放する。arenaの中のツリーの添字はすべて無効になる。
+  */
+  void clear()
+  {
+    std::vector<node>().swap( _nodes );
+    std::vector<index_t>().swap( _free );
+  }
+
+  bool is_root( index_t idx ) const
+  {
+    return at( idx ).get_link( edge_dir::leading, prior_next::prior ) == npos
+      && at( idx ).get_link( edge_dir::trailing, prior_next::next ) == npos;
+  }
+
+  /*
+    arena_iteratorが構造を変えた後に呼ぶもの。holeは切り離したノードが居た場所の次のエッジ。
+    変更を記録するarena（forest_shared.hppのshared_forest）の為のもので、ここでは何もしない。
+  */
+  void chained( index_t ) {}
+  void unchained( index_t, const iterator& ) {}
+  void erased( index_t, const iterator& ) {}
+
+private:
+  friend class arena_iterator<T>;
+
+  void init_edge( index_t idx )
+  {
+    auto& n = _nodes[idx];
+    n.get_link( edge_dir::leading, prior_next::next ) = idx;
+    n.get_link( edge_dir::trailing, prior_next::prior ) = idx;
+    n.get_link( edge_dir::leading, prior_next::prior ) = npos;
+    n.get_link( edge_dir::trailing, prior_next::next ) = npos;
+  }
+
+  // _dataはデストラクトせずに残し、次のcreateでmove代入して使い回す。
+  void release( index_t idx )
+  {
+    _free.push_back( idx );
+  }
+};
+
+/*
+  arena_forestのiterator。forest_iteratorと同じ規則でエッジを回る。
+  ノードはポインタでは無く添字で持つので、arenaの配列が伸びても無効にならない。
+
+  ARENAはarena_forestと同じat, create, release, is_root, npos, chained, unchained, erasedを持つもの。
+*/
+template<typename T, typename ARENA>
+class arena_iterator : public iterator_facade<arena_iterator<T, ARENA>, arena_edge<T, ARENA>>
+{
+  using index_t = uint32_t;
+  static const auto next = prior_next::next;
+  static const auto prior = prior_next::prior;
+  static const auto leading = edge_dir::leading;
+  static const auto trailing = edge_dir::trailing;
+  static constexpr index_t npos = ARENA::npos;
+
+  index_t& get_link( index_t node, edge_dir dir, prior_next link ) { return _edge._arena->at( node ).get_link( dir, link ); }
+  index_t get_link( index_t node, edge_dir dir, prior_next link ) const { return _edge._arena->at( node ).get_link( dir, link ); }
+
+  void set_link( edge_dir dir, prior_next link, index_t node )
+  {
+    // みなし子のrootはnpos。その場合は更新しない。
+    if (get_index() != npos)
+      get_link( get_index(), dir, link ) = node;
+  }
+
+  void set_next( arena_iterator& y )
+  {
+    set_link( _edge._direction, next, y.get_index() );
+    y.set_link( y._edge._direction, prior, get_index() );
+  }
+
+public:
+  arena_edge<T, ARENA> _edge;
+
+  arena_iterator( ARENA* arena, index_t node, edge_dir dir ) : _edge( arena, node, dir ) {}
+
+  index_t get_index() const { return _edge._node; }
+  T& content() { return _edge._arena->at( _edge._node )._data; }
+
+  ////////////////////////////
+  // iterator_facade関連
+  ////////////////////////////
+
+  bool equal( const arena_iterator& other ) const
+  {
+    return _edge.equal( other._edge );
+  }
+
+  arena_edge<T, ARENA>& dereference() { return _edge; }
+  const arena_edge<T, ARENA>& dereference() const { return _edge; }
+
+  // forest_iterator::incrementと同じ。
+  void increment()
+  {
+    index_t nextNode = get_link( get_index(), _edge._direction, next );
+
+    if ( _edge.is_leading() )
+    {
+      _edge._direction = ( nextNode == get_index() ? trailing : leading );
+    }
+    else
+    {
+      if (nextNode != npos )
+        _edge._direction = ( get_link( nextNode, leading, prior ) == get_index() ? leading : trailing );
+    }
+
+    _edge._node = nextNode;
+  }
+
+  // forest_iterator::decrementと同じ。end()から--は出来ない。
+  void decrement()
+  {
+    index_t prev = get_link( get_index(), _edge._direction, prior );
+
+    if ( _edge.is_leading() )
+    {
+      _edge._direction = ( prev != npos && get_link( prev, trailing, next ) == get_index() ? trailing : leading );
+    }
+    else
+    {
+      _edge._direction = ( prev == get_index() ? leading : trailing );
+    }
+
+    _edge._node = prev;
+  }
+
+  ////////////////////////////
+  // Iteratorのそのほかのメソッド
+  ////////////////////////////
+
+  arena_iterator& to_trailing()
+  {
+    _edge._direction = trailing;
+    return *this;
+  }
+
+  arena_iterator& to_leading()
+  {
+    _edge._direction = leading;
+    return *this;
+  }
+
+  arena_iterator leading_of() const
+  {
+    auto res = *this;
+    res.to_leading();
+    return res;
+  }
+
+  arena_iterator trailing_of() const
+  {
+    auto res = *this;
+    res.to_trailing();
+    return res;
+  }
+
+  arena_iterator next_of() const
+  {
+    auto res = *this;
+    res++;
+    return res;
+  }
+
+  arena_iterator prior_of() const
+  {
+    auto res = *this;
+    res--;
+    return res;
+  }
+
+  bool is_leading() const { return _edge.is_leading(); }
+  bool is_trailing() const { return _edge.is_trailing(); }
+
+  bool has_children() const
+  {
+    return get_index() != leading_of().next_of().get_index();
+  }
+
+  void skip_n_children( int num )
+  {
+    for( auto i : irange( num ))
+    {
+      UNUSED( i );
+      (*this)++;
+      to_trailing();
+    }
+  }
+
+  /*
+    今さしているノードの親の添字を返す。ルートの場合はnpos。
+  */
+  index_t parent_index() const
+  {
+    auto iter = trailing_of();
+    iter++;
+    while( iter.get_index() != npos && iter.is_leading() )
+    {
+      iter.to_trailing();
+      iter++;
+    }
+    return iter.get_index();
+  }
+
+  /*
+    現在のエッジにノードを挿入する。挿入のルールはforest_iterator::insertと同じ。
+  */
+  arena_iterator insert( T&& x )
+  {
+    return chain( _edge._arena->create( std::move( x ) ) );
+  }
+
+  arena_iterator insert( const T& x )
+  {
+    return chain( _edge._arena->create( x ) );
+  }
+
+  /*
+    同じarenaにある単独のツリーsubtreeを現在の位置に挿入する。
+  */
+  arena_iterator chain( index_t subtree )
+  {
+    arena_iterator result( _edge._arena, subtree, leading );
+    arena_iterator prev( prior_of() );
+    arena_iterator newTrail( result.trailing_of() );
+
+    prev.set_next( result );
+    newTrail.set_next( *this );
+    _edge._arena->chained( subtree );
+    return result;
+  }
+
+  /*
+    現在指しているノードのサブツリーを切り離し、そのルートの添字を返す。ノードは同じarenaに残る。
+    iteratorは次に進む。thisはleadingで無くてはいけない。
+  */
+  index_t unchain()
+  {
+    assert( is_leading() );
+    assert( !_edge._arena->is_root( get_index() ) );
+
+    arena_iterator leading_prior( prior_of() );
+    arena_iterator trailing_next( trailing_of().next_of() );
+
+    leading_prior.set_next( trailing_next );
+
+    auto ret = get_index();
+    get_link( ret, leading, prior ) = npos;
+    get_link( ret, trailing, next ) = npos;
+
+    _edge._node = trailing_next.get_index();
+    _edge._arena->unchained( ret, trailing_next );
+    return ret;
+  }
+
+  /*
+    葉を削除し、次の有効なiteratorを返す。詳細はforest_iterator::eraseを参照。
+  */
+  arena_iterator erase()
+  {
+    arena_iterator leading_prior( leading_of().prior_of() );
+    arena_iterator trailing_next( trailing_of().next_of() );
+
+    assert( !has_children() );
+    leading_prior.set_next( trailing_next );
+    _edge._arena->erased( get_index(), trailing_next );
+    _edge._arena->release( get_index() );
+
+    return ( _edge.is_leading() ) ? leading_prior.next_of() : trailing_next;
+  }
+};
+
+}
+
+#endif
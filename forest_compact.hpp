@@ -0,0 +1,233 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_COMPACT_HPP_
+#define _FOREST_COMPACT_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  compact()やmap_tree_in_blockで、ノードを一つのメモリブロックに並べて作るもの。
+  ブロックの先頭にnode_block_headerを置き、作ったノードはそれを指す。
+  作った後のノードは普通のノードと同じで、erase, replace, ルートのdeleteなどどの道筋で消しても良い。
+  ブロックは最後のノードが消えた時に解放される（forest::operator deleteを参照）ので、これはブロックを持ち続けない。
+*/
+template<typename T>
+class node_block
+{
+  static_assert( alignof( forest<T> ) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "node_block needs a default-aligned node" );
+
+  node_block_header* _header = nullptr;
+  forest<T>* _nodes = nullptr;
+  size_t _count = 0;
+
+  static size_t nodes_offset() { return ( sizeof( node_block_header ) + alignof( forest<T> ) - 1 ) / alignof( forest<T> ) * alignof( forest<T> ); }
+
+public:
+  /*
+    count個のノードの領域を確保する。
+  */
+  explicit node_block( size_t count ) : _count( count )
+  {
+    auto memory = static_cast<char*>( ::operator new( nodes_offset() + count * sizeof( forest<T> ) ) );
+    _header = ::new( memory ) node_block_header;
+    _header->_live.store( 0, std::memory_order_relaxed );
+    _nodes = reinterpret_cast<forest<T>*>( memory + nodes_offset() );
+  }
+
+  node_block( const node_block& ) = delete;
+  node_block& operator=( const node_block& ) = delete;
+
+  // ノードを一つも作らなかった時だけ、ここで解放する。
+  ~node_block()
+  {
+    if ( _header->_live.load( std::memory_order_relaxed ) == 0 )
+    {
+      _header->~node_block_header();
+      ::operator delete( _header );
+    }
+  }
+
+  // idx番目のノードをdataで作る。
+  forest<T>* construct( size_t idx, T&& data )
+  {
+    assert( idx < _count );
+    auto node = ::new( _nodes + idx ) forest<T>( std::move( data ) );
+    node->_block = _header;
+    _header->_live.fetch_add( 1, std::memory_order_relaxed );
+    return node;
+  }
+
+  forest<T>* data() const { return _nodes; }
+  size_t size() const { return _count; }
+};
+
+/*
+  ブロックに並べたツリー。消える時に_rootのツリーを消す。
+  ルートを差し替えたら_rootも更新する事。持たせたくなければ_rootをnullptrにして受け取る。
+*/
+template<typename T>
+struct block_tree
+{
+  forest<T>* _root = nullptr;
+
+  block_tree() = default;
+  explicit block_tree( forest<T>* root ) : _root( root ) {}
+
+  block_tree( block_tree&& other ) noexcept : _root( std::exchange( other._root, nullptr ) ) {}
+
+  block_tree& operator=( block_tree&& other ) noexcept
+  {
+    if ( this != &other )
+    {
+      delete _root;
+      _root = std::exchange( other._root, nullptr );
+    }
+    return *this;
+  }
+
+  ~block_tree() { delete _root; }
+};
+
+/*
+  compact()の結果。新しいツリーとそのブロックを持ち、古いノードのポインタから新しいノードを引ける。
+  古いノードはもう解放されているので、ポインタはキーとしてだけ使う（中身は見ない）。
+*/
+template<typename T>
+struct compaction : block_tree<T>
+{
+  // 古いノードのアドレスとpreorderの番号。アドレス順にソートしてある。
+  std::vector<std::pair<uintptr_t, size_t>> _old;
+
+  // 新しいブロックの先頭のノード。preorderの番号で引く。
+  forest<T>* _first;
+
+  explicit compaction( forest<T>* root ) : block_tree<T>( root ), _first( root ) {}
+
+  /*
+    古いノードに対応する新しいノードを返す。古いツリーのノードで無ければnullptr。
+    並べ直した後に消したノードに対応するポインタも返すので、まだツリーにあるノードにだけ使う事。
+  */
+  forest<T>* remap( forest<T>* old ) const
+  {
+    auto key = reinterpret_cast<uintptr_t>( old );
+    auto it = std::lower_bound( _old.begin(), _old.end(), std::make_pair( key, (size_t)0 ) );
+    if ( it == _old.end() || it->first != key )
+      return nullptr;
+    return _first + it->second;
+  }
+
+  /*
+    古いツリーを指していたiteratorを、新しいツリーの同じエッジを指すiteratorにする。
+    end()（ノードがnullptr）はそのまま。
+  */
+  forest_iterator<T> remap( const forest_iterator<T>& iter ) const
+  {
+    auto res = iter;
+    if ( iter.get_node() != nullptr )
+      res.set_node( remap( iter.get_node() ) );
+    return res;
+  }
+};
+
+/*
+  rootのツリーのノードを、一つの連続したメモリブロックにpreorder（leadingの順）で並べ直す。
+  replaceやunchain, chainを繰り返してノードがヒープに散らばったツリーの走査を速くする為のもの。
+
+  auto res = compact( root );
+  root = res._root;   // ツリーはresが持つ
+  iter = res.remap( iter );
+
+  ルートも移動するので、新しいルートはcompactionの_rootで受け取る。新しいツリーはcompactionが消える時に消える。
+  自分で持つ時は_rootをnullptrにして受け取り、普通のツリーと同じくルートをdeleteする。
+  並べ直した後も普通のforestで、変更も、ノードを消す事もできる。ブロックは最後のノードが消えた時に解放される。
+  ただしブロックのノードを一つでも残していると、ブロック全体のメモリが残る。
+
+  rootは単独のツリーのルートで無くてはいけない。古いノードは解放される（前にcompactしたブロックのノードも）。
+*/
+template<typename T>
+compaction<T> compact( forest<T>* root )
+{
+  assert( root->is_root() );
+  using annotation = typename forest_traits<T>::annotation;
+
+  std::vector<forest<T>*> olds;
+  for( auto iter = root->begin(); iter != root->end(); iter++ )
+  {
+    if ( iter.is_leading() )
+      olds.push_back( iter.get_node() );
+  }
+
+  node_block<T> nodes( olds.size() );
+  auto block = nodes.data();
+  for( auto i : irange( olds.size() ) )
+  {
+    auto node = nodes.construct( i, std::move( olds[i]->_data ) );
+    static_cast<annotation&>( *node ) = static_cast<annotation&>( *olds[i] );
+  }
+
+  // cloneと同じように、古いツリーのエッジの順に新しいツリーのエッジをつないでいく。
+  // 新しいノードはpreorderの番号で決まるので、対応表はいらない。
+  std::vector<forest<T>*> parents;
+  size_t next = 0;
+  forest<T>* prevNode = nullptr;
+  edge_dir prevDir = edge_dir::leading;
+  for( auto iter = root->begin(); iter != root->end(); iter++ )
+  {
+    forest<T>* cur;
+    if ( iter.is_leading() )
+    {
+      cur = block + next++;
+      parents.push_back( cur );
+    }
+    else
+    {
+      cur = parents.back();
+      parents.pop_back();
+    }
+
+    if ( prevNode != nullptr )
+    {
+      prevNode->get_link( prevDir, prior_next::next ) = cur;
+      cur->get_link( iter._edge._direction, prior_next::prior ) = prevNode;
+    }
+    prevNode = cur;
+    prevDir = iter._edge._direction;
+  }
+
+  compaction<T> res( block );
+  res._old.reserve( olds.size() );
+  for( auto i : irange( olds.size() ) )
+    res._old.push_back( std::make_pair( reinterpret_cast<uintptr_t>( olds[i] ), i ) );
+  std::sort( res._old.begin(), res._old.end() );
+
+  // 古いノードは単独のノードに戻してから消すので、子供を消しに行ったりはしない。
+  for( auto node : olds )
+  {
+    node->reset_links();
+    delete node;
+  }
+  return res;
+}
+
+/*
+  前にcompactしたツリーを並べ直す。treeはもうツリーを持たない。
+*/
+template<typename T>
+compaction<T> compact( block_tree<T>& tree )
+{
+  auto res = compact( tree._root );
+  tree._root = nullptr;
+  return res;
+}
+
+}
+
+#endif
@@ -0,0 +1,269 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_CORO_HPP_
+#define _FOREST_CORO_HPP_
+
+#include "forest.hpp"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#define SYMTREE_HAS_COROUTINE 1
+#endif
+#endif
+
+#ifdef SYMTREE_HAS_COROUTINE
+
+namespace symtree
+{
+
+/*
+  co_yieldした値を順に返すコルーチン。range-based forで回す。
+  値はコピーせずに、co_yieldした式への参照を次に進むまで返す。
+*/
+template<typename V>
+class generator
+{
+public:
+  struct promise_type
+  {
+    const V* _current = nullptr;
+    std::exception_ptr _error;
+
+    generator get_return_object() { return generator( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    std::suspend_always yield_value( const V& value ) noexcept
+    {
+      _current = std::addressof( value );
+      return {};
+    }
+
+    void return_void() {}
+    void unhandled_exception() { _error = std::current_exception(); }
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+
+  class iterator
+  {
+    handle _handle;
+
+  public:
+    explicit iterator( handle h ) : _handle( h ) {}
+
+    const V& operator*() const { return *_handle.promise()._current; }
+    const V* operator->() const { return _handle.promise()._current; }
+
+    iterator& operator++()
+    {
+      _handle.resume();
+      rethrow_if_failed( _handle );
+      return *this;
+    }
+
+    bool operator==( std::default_sentinel_t ) const { return _handle.done(); }
+    bool operator!=( std::default_sentinel_t ) const { return !_handle.done(); }
+  };
+
+  explicit generator( handle h ) : _handle( h ) {}
+  generator( generator&& other ) noexcept : _handle( std::exchange( other._handle, nullptr ) ) {}
+  generator( const generator& ) = delete;
+  generator& operator=( const generator& ) = delete;
+
+  ~generator()
+  {
+    if ( _handle )
+      _handle.destroy();
+  }
+
+  iterator begin()
+  {
+    _handle.resume();
+    rethrow_if_failed( _handle );
+    return iterator( _handle );
+  }
+
+  std::default_sentinel_t end() { return {}; }
+
+private:
+  handle _handle;
+
+  static void rethrow_if_failed( handle h )
+  {
+    if ( h.done() && h.promise()._error )
+      std::rethrow_exception( h.promise()._error );
+  }
+};
+
+/*
+  rootのすべてのエッジを、forest_iteratorと同じ順に返す。
+  for( auto& e : edges( root ) ) { if ( e.is_leading() ) ... }
+  回っている間にツリーを変更してはいけない。
+*/
+template<typename T>
+generator<edge<T>> edges( forest<T>& root )
+{
+  for( auto iter = root.begin(); iter != root.end(); iter++ )
+    co_yield *iter;
+}
+
+/*
+  値Rを返す非同期の処理。作った時点で最初のco_awaitまで走る（遅延しない）。
+  なので子供の処理を先に全部作ってからco_awaitすると、それぞれが待っているもの（lookup_batchのlookupなど）が一度に揃う。
+
+  auto a = self( left );
+  auto b = self( right );
+  co_return co_await a + co_await b;
+
+  終わった時に待っている処理があれば、そこから続ける。
+*/
+template<typename R>
+class async_task
+{
+public:
+  struct promise_type
+  {
+    std::optional<R> _value;
+    std::exception_ptr _error;
+    std::coroutine_handle<> _continuation;
+
+    async_task get_return_object() { return async_task( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend( std::coroutine_handle<promise_type> h ) noexcept
+      {
+        auto next = h.promise()._continuation;
+        return next ? next : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void return_value( R value ) { _value = std::move( value ); }
+    void unhandled_exception() { _error = std::current_exception(); }
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+
+  explicit async_task( handle h ) : _handle( h ) {}
+  async_task( async_task&& other ) noexcept : _handle( std::exchange( other._handle, nullptr ) ) {}
+  async_task( const async_task& ) = delete;
+  async_task& operator=( const async_task& ) = delete;
+
+  ~async_task()
+  {
+    if ( _handle )
+      _handle.destroy();
+  }
+
+  bool done() const { return _handle.done(); }
+
+  // 終わった処理の値。例外で終わった場合は投げ直す。
+  R result()
+  {
+    assert( done() );
+    if ( _handle.promise()._error )
+      std::rethrow_exception( _handle.promise()._error );
+    return std::move( *_handle.promise()._value );
+  }
+
+  bool await_ready() const { return done(); }
+  void await_suspend( std::coroutine_handle<> waiting ) { _handle.promise()._continuation = waiting; }
+  R await_resume() { return result(); }
+
+private:
+  handle _handle;
+};
+
+/*
+  外から引く値（KからVへ）を、待っている処理の分だけまとめて一度に引く。
+  処理の中では co_await batch.lookup( key ) で待ち、flush( fetch )で
+    std::vector<V> fetch( const std::vector<K>& keys )
+  を呼んで値を渡して再開する。再開した処理がまた待ったら、それも次の一回にまとめる。
+  fetchはキーと同じ順で値を返す事。同じキーが何度か入っていても、まとめずにそのまま渡す。
+*/
+template<typename K, typename V>
+class lookup_batch
+{
+  struct pending
+  {
+    K _key;
+    std::coroutine_handle<> _waiting;
+    std::optional<V>* _slot;
+  };
+
+  std::vector<pending> _pending;
+  size_t _fetch_count = 0;
+
+public:
+  struct awaiter
+  {
+    lookup_batch* _batch;
+    K _key;
+    std::optional<V> _value;
+
+    bool await_ready() const { return false; }
+    void await_suspend( std::coroutine_handle<> waiting ) { _batch->_pending.push_back( pending { std::move( _key ), waiting, &_value } ); }
+    V await_resume() { return std::move( *_value ); }
+  };
+
+  awaiter lookup( K key ) { return awaiter { this, std::move( key ), std::nullopt }; }
+
+  size_t pending_count() const { return _pending.size(); }
+
+  // これまでにfetchを呼んだ回数。
+  size_t fetch_count() const { return _fetch_count; }
+
+  /*
+    待っている処理が無くなるまで、まとめて引いては再開する。
+  */
+  template<typename FETCH>
+  void flush( FETCH fetch )
+  {
+    while ( !_pending.empty() )
+    {
+      std::vector<pending> batch;
+      batch.swap( _pending );
+
+      std::vector<K> keys;
+      keys.reserve( batch.size() );
+      for( auto& p : batch )
+        keys.push_back( p._key );
+
+      std::vector<V> values = fetch( keys );
+      _fetch_count++;
+      assert( values.size() == batch.size() );
+      for( size_t i = 0; i < batch.size(); i++ )
+      {
+        *batch[i]._slot = std::move( values[i] );
+        batch[i]._waiting.resume();
+      }
+    }
+  }
+};
+
+/*
+  taskをbatchで待たせながら最後まで進めて、値を返す。
+*/
+template<typename R, typename K, typename V, typename FETCH>
+R run_batched( async_task<R>& task, lookup_batch<K, V>& batch, FETCH fetch )
+{
+  batch.flush( fetch );
+  return task.result();
+}
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_CURSOR_HPP_
+#define _FOREST_CURSOR_HPP_
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  ツリーの中を上下左右に動くカーソル（zipper）。ルートから今のノードまでの祖先と、それぞれの子供の番号をスタックに持つ。
+
+  forest_cursor<string> c( root );
+  c.down( 1 );        // 二番目の子供へ
+  c.right();          // 次の兄弟へ
+  c.up();             // 親へ
+
+  up, left, right, depth, indexはO(1)で、親をたどったり兄弟を数えたりはしない。
+  downはノードの子供の配列を最初に一回作り（O(子供の数)）、そのノードに居る間と、そこから降りて戻ってくるまではO(1)。
+  カーソルを通した変更（insert_before, insert_after, append_child, erase, replace）では、スタックと子供の配列も合わせて直す。
+  カーソルの外でツリーを変更した場合は、reset()でルートからやり直す事。
+*/
+template<typename T>
+class forest_cursor
+{
+public:
+  explicit forest_cursor( forest<T>* root ) : _here { root, 0, {}, false } {}
+
+  forest<T>* node() const { return _here._node; }
+  T& operator*() const { return _here._node->_data; }
+
+  // ルートが0。
+  size_t depth() const { return _path.size(); }
+
+  // 兄弟の中での番号。ルートは0。
+  size_t index() const { return _here._index; }
+
+  bool is_root() const { return _path.empty(); }
+
+  // 親に移る。ルートならfalse。
+  bool up()
+  {
+    if ( _path.empty() )
+      return false;
+    _here = std::move( _path.back() );
+    _path.pop_back();
+    return true;
+  }
+
+  // i番目の子供に移る。無ければfalse。
+  bool down( size_t i )
+  {
+    auto& children = children_of( _here );
+    if ( i >= children.size() )
+      return false;
+    auto child = children[i];
+    _path.push_back( std::move( _here ) );
+    _here = frame { child, i, {}, false };
+    return true;
+  }
+
+  size_t child_count() { return children_of( _here ).size(); }
+
+  // 後ろの兄弟に移る。無ければfalse。
+  bool right()
+  {
+    if ( _path.empty() )
+      return false;
+    auto next = _here._node->get_link( edge_dir::trailing, prior_next::next );
+    if ( next->get_link( edge_dir::leading, prior_next::prior ) != _here._node )
+      return false;
+    _here = frame { next, _here._index + 1, {}, false };
+    return true;
+  }
+
+  // 前の兄弟に移る。無ければfalse。
+  bool left()
+  {
+    if ( _path.empty() )
+      return false;
+    auto prev = _here._node->get_link( edge_dir::leading, prior_next::prior );
+    if ( prev->get_link( edge_dir::trailing, prior_next::next ) != _here._node )
+      return false;
+    _here = frame { prev, _here._index - 1, {}, false };
+    return true;
+  }
+
+  // ルートに戻る。
+  void reset()
+  {
+    while( up() )
+      ;
+    _here._children.clear();
+    _here._indexed = false;
+  }
+
+  /*
+    今のノードの前に兄弟を入れる。カーソルは今のノードのまま。
+  */
+  forest<T>* insert_before( T&& data )
+  {
+    assert( !is_root() );
+    auto node = _here._node->begin().insert( std::move( data ) ).get_node();
+    sibling_inserted( _here._index, node );
+    _here._index++;
+    return node;
+  }
+
+  /*
+    今のノードの後に兄弟を入れる。カーソルは今のノードのまま。
+  */
+  forest<T>* insert_after( T&& data )
+  {
+    assert( !is_root() );
+    auto node = _here._node->begin().to_trailing().next_of().insert( std::move( data ) ).get_node();
+    sibling_inserted( _here._index + 1, node );
+    return node;
+  }
+
+  /*
+    今のノードの末っ子を入れる。
+  */
+  forest<T>* append_child( T&& data )
+  {
+    auto node = _here._node->begin().to_trailing().insert( std::move( data ) ).get_node();
+    if ( _here._indexed )
+      _here._children.push_back( node );
+    return node;
+  }
+
+  /*
+    今のノードのサブツリーを消して親に移る。ルートは消せない。
+  */
+  void erase()
+  {
+    assert( !is_root() );
+    auto index = _here._index;
+    retire( _here._node->begin().unchain() );
+    up();
+    if ( _here._indexed )
+      _here._children.erase( _here._children.begin() + index );
+  }
+
+  /*
+    今のノードをnewNodeに差し替えて、古いノードを返す。カーソルはnewNodeに移る。
+  */
+  std::unique_ptr<forest<T>> replace( forest<T>* newNode )
+  {
+    auto old = _here._node->begin().replace( newNode );
+    _here = frame { newNode, _here._index, {}, false };
+    if ( !_path.empty() && _path.back()._indexed )
+      _path.back()._children[_here._index] = newNode;
+    return old;
+  }
+
+private:
+  struct frame
+  {
+    forest<T>* _node;
+    size_t _index;
+
+    // _nodeの子供。_indexedがfalseならまだ作っていない。
+    std::vector<forest<T>*> _children;
+    bool _indexed;
+  };
+
+  std::vector<frame> _path;
+  frame _here;
+
+  static std::vector<forest<T>*>& children_of( frame& f )
+  {
+    if ( !f._indexed )
+    {
+      for( auto it = f._node->begin_child(); it != f._node->end_child(); it++ )
+        f._children.push_back( it.get_node() );
+      f._indexed = true;
+    }
+    return f._children;
+  }
+
+  void sibling_inserted( size_t index, forest<T>* node )
+  {
+    auto& parent = _path.back();
+    if ( parent._indexed )
+      parent._children.insert( parent._children.begin() + index, node );
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,324 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_JOURNAL_HPP_
+#define _FOREST_JOURNAL_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  forest_journalの一つの記録。固定長で、ノードはポインタで持つ。
+    chain:   _nodeがつながった。
+    unchain: _nodeが切り離された。_otherと_hole_dirが居た場所の次のエッジ。
+    erase:   _node（葉）が消された。場所はunchainと同じ。ノードはコミットまでjournalが預かる。
+    replace: _nodeが_otherに差し替わった。
+*/
+template<typename T>
+struct journal_record
+{
+  enum kind : uint8_t
+  {
+    chain,
+    unchain,
+    erase,
+    replace
+  };
+
+  kind _kind;
+  edge_dir _hole_dir;
+  forest<T>* _node;
+  forest<T>* _other;
+
+  forest_iterator<T> hole() const { return forest_iterator<T>( _other, _hole_dir ); }
+};
+
+/*
+  一つのツリーの構造の変更を記録するjournal。作ると有効になり、消すと元に戻る。
+
+  forest_journal<string> journal( *root );
+  journal.subscribe( []( const std::vector<journal_record<string>>& batch ) { ... } );
+
+  journal.begin();
+  iter.insert( "x" );
+  ...
+  journal.rollback();   // insertする前に戻る。commit()なら確定。
+
+  forest_iteratorのinsert, chain, unchain, erase, replace（child_iteratorのreplaceも）を記録する。
+  トランザクションは入れ子に出来る。一番外側のcommitで、その間の記録をまとめて購読者に渡す。
+  トランザクションの外の変更は、一つずつすぐに渡す。
+  rollbackは記録を逆順に戻すだけなので、ツリーをクローンしない。
+
+  記録するのはrootのツリーの変更だけ。自分のツリーかはツリーの全てのノードの集合で見るので、
+  変更ごとにO(1)だが、chainやunchainではそのサブツリーのノード数だけ集合を更新する。
+  ルートが差し替わったらroot()も変わる（rollbackで戻った時も）。
+  作ったスレッドでの変更だけが通知されるので、ツリーはそのスレッドで変更する事。
+
+  切り離したノードは、トランザクションの間はすべてjournalが預かる。
+    - eraseで消えた葉はjournalが預かる。
+    - unchainやreplaceで切り離したサブツリーを捨てる時は、deleteでは無くretire()（symtree::retireでも良い）に渡す。
+      ライブラリの中の変更（stree_diffのapply、kind_index、rewriter、delete_siblingsなど）もそうしている。
+  rollbackするとそれらはツリーに戻り、呼び出し側のポインタはもうツリーの一部になる。
+  rollbackで取り消したchainのサブツリーはjournalがdeleteする。
+  トランザクションの間にrootのツリーから切り離したノードを直接deleteしてはいけない。
+  トランザクションを閉じずにjournalを消すと、rollbackしてから預かっていたノードを消す。
+*/
+template<typename T>
+class forest_journal : public mutation_listener<T>
+{
+public:
+  using record = journal_record<T>;
+  using subscriber = std::function<void( const std::vector<record>& )>;
+
+  explicit forest_journal( forest<T>& root ) : _root( &root )
+  {
+    join( root );
+    this->listen();
+  }
+
+  ~forest_journal()
+  {
+    while( in_transaction() )
+      rollback();
+    for( auto node : _retired )
+      delete node;
+    this->stop_listening();
+  }
+
+  forest_journal( const forest_journal& ) = delete;
+  forest_journal& operator=( const forest_journal& ) = delete;
+
+  void begin()
+  {
+    _savepoints.push_back( savepoint { _records.size(), _retired.size() } );
+  }
+
+  void commit()
+  {
+    assert( in_transaction() );
+    _savepoints.pop_back();
+    if ( !in_transaction() )
+      publish();
+  }
+
+  /*
+    一番内側のbeginの後の変更を逆順に取り消す。
+  */
+  void rollback()
+  {
+    assert( in_transaction() );
+    auto point = _savepoints.back();
+    _savepoints.pop_back();
+
+    // 取り消しの操作は記録しない。他の受け取るもの（kind_indexなど）には通知される。
+    _muted = true;
+
+    std::vector<forest<T>*> orphans;
+    for( auto i = _records.size(); i > point._records; i-- )
+    {
+      auto& r = _records[i - 1];
+      switch( r._kind )
+      {
+        case record::chain:
+          r._node->begin().unchain();
+          orphans.push_back( r._node );
+          break;
+        case record::unchain:
+        case record::erase:
+        {
+          // 切り離した後で他のツリー（まだつないでいない新しいノードなど）につないでいたら、そこから外す。
+          if ( !r._node->is_root() )
+            r._node->begin().unchain();
+          auto hole = r.hole();
+          hole.chain( r._node );
+          remove( orphans, r._node );
+          remove_retired( r._node, point._retired );
+          break;
+        }
+        case record::replace:
+          r._other->begin().replace( r._node ).release();
+          if ( _root == r._other )
+            _root = r._node;
+          orphans.push_back( r._other );
+          remove_retired( r._node, point._retired );
+          break;
+      }
+    }
+    _records.resize( point._records );
+
+    _muted = false;
+
+    for( auto node : orphans )
+      delete node;
+  }
+
+  bool in_transaction() const { return !_savepoints.empty(); }
+
+  // 記録しているツリーのルート。
+  forest<T>* root() const { return _root; }
+
+  // まだ購読者に渡していない記録。
+  const std::vector<record>& records() const { return _records; }
+
+  /*
+    変更のまとまりを受け取る関数を登録し、unsubscribe用の番号を返す。
+    渡される記録のノードはすべて呼ばれている間は生きている。
+  */
+  size_t subscribe( subscriber fn )
+  {
+    _subscribers.push_back( std::move( fn ) );
+    return _subscribers.size() - 1;
+  }
+
+  void unsubscribe( size_t id ) { _subscribers[id] = nullptr; }
+
+  /*
+    切り離したサブツリーを、コミットしたら消すものとして預ける。トランザクションの外ならすぐに消す。
+  */
+  void retire( forest<T>* subtree )
+  {
+    if ( in_transaction() )
+      _retired.push_back( subtree );
+    else
+      delete subtree;
+  }
+
+  // ノードの集合はrollbackの間も更新する。
+  void chained( forest<T>* subtree ) override
+  {
+    // 前のエッジは親のleadingか兄のtrailingなので、そのノードがツリーにあればつながった先もこのツリー。
+    if ( !is_member( subtree->begin().prior_of().get_node() ) )
+      return;
+    join( *subtree );
+    if ( !_muted )
+      add( record { record::chain, edge_dir::leading, subtree, nullptr } );
+  }
+
+  void unchained( forest<T>* subtree, const forest_iterator<T>& hole ) override
+  {
+    if ( !is_member( subtree ) )
+      return;
+    leave( *subtree );
+    if ( _muted )
+      return;
+    _detached.insert( subtree );
+    add( record { record::unchain, hole._edge._direction, subtree, hole.get_node() } );
+  }
+
+  bool erased( forest<T>* leaf, const forest_iterator<T>& hole ) override
+  {
+    if ( !is_member( leaf ) )
+      return false;
+    _members.erase( leaf );
+    // 居場所が分からないルートは戻せないので、普通に消してもらう。
+    if ( _muted || hole.get_node() == nullptr )
+      return false;
+    leaf->reset_links();
+    add( record { record::erase, hole._edge._direction, leaf, hole.get_node() } );
+    return true;
+  }
+
+  void replaced( forest<T>* oldNode, forest<T>* newNode ) override
+  {
+    if ( !is_member( oldNode ) )
+      return;
+    leave( *oldNode );
+    join( *newNode );
+    if ( _muted )
+      return;
+    if ( oldNode == _root )
+      _root = newNode;
+    _detached.insert( oldNode );
+    add( record { record::replace, edge_dir::leading, oldNode, newNode } );
+  }
+
+  // このツリーから切り離したサブツリーなら、トランザクションの間は預かる。
+  bool retired( forest<T>* subtree ) override
+  {
+    if ( _muted || !in_transaction() || _detached.count( subtree ) == 0 )
+      return false;
+    _retired.push_back( subtree );
+    return true;
+  }
+
+private:
+  struct savepoint
+  {
+    size_t _records;
+    size_t _retired;
+  };
+
+  forest<T>* _root;
+  // rollbackの間はtrue。
+  bool _muted = false;
+  std::vector<record> _records;
+  // 記録した変更で切り離したサブツリー。
+  std::unordered_set<forest<T>*> _detached;
+  std::vector<savepoint> _savepoints;
+  std::vector<forest<T>*> _retired;
+  std::vector<subscriber> _subscribers;
+  // rootのツリーの全てのノード。通知がこのツリーのものかをO(1)で見る為。
+  std::unordered_set<const forest<T>*> _members;
+
+  void add( const record& r )
+  {
+    _records.push_back( r );
+    if ( !in_transaction() )
+      publish();
+  }
+
+  // 購読者に渡してから、預かっていたノードを消す。
+  void publish()
+  {
+    for( auto& fn : _subscribers )
+    {
+      if ( fn )
+        fn( _records );
+    }
+    for( auto& r : _records )
+    {
+      if ( r._kind == record::erase )
+        delete r._node;
+    }
+    for( auto node : _retired )
+      delete node;
+    _records.clear();
+    _retired.clear();
+    _detached.clear();
+  }
+
+  bool is_member( const forest<T>* node ) const { return _members.count( node ) != 0; }
+
+  void join( forest<T>& subtree )
+  {
+    subtree.for_each_leading( [this]( forest_iterator<T>& iter ) { _members.insert( iter.get_node() ); } );
+  }
+
+  void leave( forest<T>& subtree )
+  {
+    subtree.for_each_leading( [this]( forest_iterator<T>& iter ) { _members.erase( iter.get_node() ); } );
+  }
+
+  static void remove( std::vector<forest<T>*>& nodes, forest<T>* node )
+  {
+    nodes.erase( std::remove( nodes.begin(), nodes.end(), node ), nodes.end() );
+  }
+
+  // ツリーに戻したノードは、このトランザクションで預かっていても消さない。
+  void remove_retired( forest<T>* node, size_t from )
+  {
+    auto it = std::find( _retired.begin() + from, _retired.end(), node );
+    if ( it != _retired.end() )
+      _retired.erase( it );
+  }
+};
+
+}
+
+#endif
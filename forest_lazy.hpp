@@ -0,0 +1,398 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_LAZY_HPP_
+#define _FOREST_LAZY_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  遅延読み込み用のファイル形式。ノードごとにpreorderで以下のレコードを並べる。
+
+    uint64_t end            // サブツリーの終わり（次の兄弟のレコードの位置）
+    uint8_t  has_children
+    uint32_t payload_size
+    char     payload[payload_size]
+    子供のレコード...
+
+  endがあるので、サブツリーを読まずに次の兄弟に飛べる。
+  payloadはCODECで読み書きする。CODECは以下のstaticメソッドを持つstruct。
+    void write( std::string& out, const T& value );
+    T read( const char* data, size_t size );
+*/
+template<typename CODEC, typename T>
+void write_lazy_forest( const forest<T>& root, std::ostream& out )
+{
+  std::string buf;
+  std::vector<size_t> starts;
+
+  auto put = [&buf]( const void* p, size_t size ) { buf.append( (const char*)p, size ); };
+
+  for( auto iter = root.begin(); iter != root.end(); iter++ )
+  {
+    if ( iter.is_leading() )
+    {
+      starts.push_back( buf.size() );
+      uint64_t end = 0;
+      put( &end, sizeof( end ) );
+      uint8_t hasChildren = iter.has_children() ? 1 : 0;
+      put( &hasChildren, sizeof( hasChildren ) );
+
+      std::string payload;
+      CODEC::write( payload, iter.get_node()->_data );
+      uint32_t size = (uint32_t)payload.size();
+      put( &size, sizeof( size ) );
+      buf += payload;
+    }
+    else
+    {
+      uint64_t end = buf.size();
+      memcpy( &buf[starts.back()], &end, sizeof( end ) );
+      starts.pop_back();
+    }
+  }
+  out.write( buf.data(), buf.size() );
+}
+
+/*
+  lazy_forestのノードの中身。
+  _loadedがfalseで_has_childrenがtrueのノードは、子供がまだファイルの中にある。
+*/
+template<typename T>
+struct lazy_node
+{
+  T _data;
+  uint64_t _offset;
+  bool _has_children;
+  bool _loaded = false;
+
+  // 子供を読み込んだノードのLRUの中の位置。
+  typename std::list<forest<lazy_node<T>>*>::iterator _lru;
+
+  lazy_node( T&& data, uint64_t offset, bool hasChildren ) : _data( std::move( data ) ), _offset( offset ), _has_children( hasChildren ) {}
+};
+
+template<typename T, typename CODEC> class lazy_iterator;
+
+/*
+  write_lazy_forestで書いたファイルから、iteratorが降りていった所だけを読み込むforest。
+
+  lazy_forest<string, my_codec> tree( "tree.bin", 10000 );
+  for( auto iter = tree.begin(); iter != tree.end(); iter++ ) { ... }
+
+  最初はルートだけを読み、iteratorがleadingから子供に進む時にその子供たちを読む。
+  to_trailingでサブツリーを飛ばせば、その中は読まない。
+  メモリにあるノードの数がbudgetを超えそうになったら、子供を読んでから一番長く降りていないノードの子孫を捨てる
+  （降りようとしているノードの祖先は捨てない）。捨てたサブツリーは次に降りた時にまた読む。
+  捨てたサブツリーの中を指しているiteratorは使えなくなるので、遠くに置いておくiteratorはサブツリーのルートのleadingにしておく事。
+  読み取り専用で、ツリーを変更してはいけない。
+*/
+template<typename T, typename CODEC>
+class lazy_forest
+{
+public:
+  using node_t = forest<lazy_node<T>>;
+  using iterator = lazy_iterator<T, CODEC>;
+
+  lazy_forest( const std::string& path, size_t budget = std::numeric_limits<size_t>::max() )
+    : _file( path, std::ios::binary ), _budget( budget )
+  {
+    if ( !_file )
+      throw std::runtime_error( "lazy_forest: cannot open " + path );
+    _root = read_node( 0 );
+    _resident = 1;
+  }
+
+  ~lazy_forest()
+  {
+    delete _root;
+  }
+
+  lazy_forest( const lazy_forest& ) = delete;
+  lazy_forest& operator=( const lazy_forest& ) = delete;
+
+  iterator begin() { return iterator( this, _root->begin() ); }
+  iterator end() { return iterator( this, _root->end() ); }
+
+  // 今メモリにあるノードの数。
+  size_t resident() const { return _resident; }
+
+  /*
+    nodeの子供がまだ読まれていなければ読む。読まれていればLRUの最後に移すだけ。
+  */
+  void load_children( node_t* node )
+  {
+    auto& data = node->_data;
+    if ( !data._has_children )
+      return;
+    if ( data._loaded )
+    {
+      _lru.splice( _lru.end(), _lru, data._lru );
+      return;
+    }
+
+    std::vector<node_t*> children;
+    auto offset = children_offset( data._offset );
+    auto end = read_end( data._offset );
+    while( offset < end )
+    {
+      children.push_back( read_node( offset ) );
+      offset = read_end( offset );
+    }
+
+    make_room( node, children.size() );
+
+    for( auto child : children )
+      node->append_child( child );
+    data._loaded = true;
+    data._lru = _lru.insert( _lru.end(), node );
+    _resident += children.size();
+  }
+
+  /*
+    nodeの子孫をすべて捨て、子供が読まれていない状態に戻す。
+  */
+  void evict( node_t* node )
+  {
+    if ( !node->_data._loaded )
+      return;
+
+    auto last = node->begin().to_trailing();
+    size_t count = 0;
+    for( auto iter = node->begin().next_of(); iter != last; iter++ )
+    {
+      if ( !iter.is_leading() )
+        continue;
+      count++;
+      if ( iter.get_node()->_data._loaded )
+        _lru.erase( iter.get_node()->_data._lru );
+    }
+
+    auto first = node->begin();
+    first.erase( last );
+    _lru.erase( node->_data._lru );
+    node->_data._loaded = false;
+    _resident -= count;
+  }
+
+private:
+  std::ifstream _file;
+  node_t* _root;
+  size_t _budget;
+  size_t _resident;
+
+  // 子供を読んだノード。前ほど長く降りていない。
+  std::list<node_t*> _lru;
+
+  static constexpr size_t header_size = sizeof( uint64_t ) + sizeof( uint8_t ) + sizeof( uint32_t );
+
+  template<typename V>
+  V read_at( uint64_t offset )
+  {
+    V res;
+    _file.seekg( offset );
+    _file.read( (char*)&res, sizeof( res ) );
+    return res;
+  }
+
+  uint64_t read_end( uint64_t offset ) { return read_at<uint64_t>( offset ); }
+
+  uint64_t children_offset( uint64_t offset )
+  {
+    return offset + header_size + read_at<uint32_t>( offset + sizeof( uint64_t ) + sizeof( uint8_t ) );
+  }
+
+  node_t* read_node( uint64_t offset )
+  {
+    auto hasChildren = read_at<uint8_t>( offset + sizeof( uint64_t ) ) != 0;
+    auto size = read_at<uint32_t>( offset + sizeof( uint64_t ) + sizeof( uint8_t ) );
+    std::string payload( size, '\0' );
+    _file.read( &payload[0], size );
+    return new node_t( lazy_node<T>( CODEC::read( payload.data(), size ), offset, hasChildren ) );
+  }
+
+  /*
+    countノード増えてもbudgetに収まるように、古いものから捨てる。loadingとその祖先は捨てない。
+  */
+  void make_room( node_t* loading, size_t count )
+  {
+    if ( _resident + count <= _budget )
+      return;
+
+    std::vector<node_t*> ancestors { loading };
+    for( auto p = loading->parent(); p != nullptr; p = p->parent() )
+      ancestors.push_back( p );
+
+    auto iter = _lru.begin();
+    while( iter != _lru.end() && _resident + count > _budget )
+    {
+      auto victim = *iter;
+      if ( std::find( ancestors.begin(), ancestors.end(), victim ) != ancestors.end() )
+      {
+        iter++;
+        continue;
+      }
+      // victimの子孫もLRUから消えるので、先頭からやり直す。
+      evict( victim );
+      iter = _lru.begin();
+    }
+  }
+};
+
+/*
+  lazy_forestのエッジ。forestのedgeと同じように使える。
+*/
+template<typename T>
+struct lazy_edge
+{
+  forest<lazy_node<T>>* _node;
+  edge_dir _direction;
+
+  bool is_leading() const { return _direction == edge_dir::leading; }
+  bool is_trailing() const { return _direction == edge_dir::trailing; }
+
+  T& operator*() const { return _node->_data._data; }
+};
+
+/*
+  lazy_forestのiterator。forest_iteratorと同じように使えるが、子供に進む時に必要なら子供を読む。
+*/
+template<typename T, typename CODEC>
+class lazy_iterator : public iterator_facade<lazy_iterator<T, CODEC>, lazy_edge<T>>
+{
+  using base_iterator = forest_iterator<lazy_node<T>>;
+
+  lazy_forest<T, CODEC>* _forest;
+  base_iterator _iter;
+  lazy_edge<T> _edge;
+
+  void sync()
+  {
+    _edge._node = _iter.get_node();
+    _edge._direction = _iter._edge._direction;
+  }
+
+public:
+  lazy_iterator( lazy_forest<T, CODEC>* forest, const base_iterator& iter ) : _forest( forest ), _iter( iter ), _edge { nullptr, edge_dir::leading }
+  {
+    sync();
+  }
+
+  lazy_iterator( const lazy_iterator& other ) : _forest( other._forest ), _iter( other._iter ), _edge( other._edge ) {}
+
+  lazy_iterator& operator=( const lazy_iterator& other )
+  {
+    _forest = other._forest;
+    _iter = other._iter;
+    _edge = other._edge;
+    return *this;
+  }
+
+  forest<lazy_node<T>>* get_node() const { return _iter.get_node(); }
+  T& content() { return _iter.get_node()->_data._data; }
+
+  bool equal( const lazy_iterator& other ) const { return _iter == other._iter; }
+
+  lazy_edge<T>& dereference() { return _edge; }
+  const lazy_edge<T>& dereference() const { return _edge; }
+
+  void increment()
+  {
+    if ( _iter.is_leading() )
+      _forest->load_children( _iter.get_node() );
+    _iter++;
+    sync();
+  }
+
+  void decrement()
+  {
+    if ( _iter.is_trailing() )
+      _forest->load_children( _iter.get_node() );
+    _iter--;
+    sync();
+  }
+
+  lazy_iterator& to_trailing()
+  {
+    _iter.to_trailing();
+    sync();
+    return *this;
+  }
+
+  lazy_iterator& to_leading()
+  {
+    _iter.to_leading();
+    sync();
+    return *this;
+  }
+
+  lazy_iterator leading_of() const { auto res = *this; res.to_leading(); return res; }
+  lazy_iterator trailing_of() const { auto res = *this; res.to_trailing(); return res; }
+  lazy_iterator next_of() const { auto res = *this; res++; return res; }
+  lazy_iterator prior_of() const { auto res = *this; res--; return res; }
+
+  bool is_leading() const { return _iter.is_leading(); }
+  bool is_trailing() const { return _iter.is_trailing(); }
+
+  // 子供を読まずに分かる。
+  bool has_children() const { return _iter.get_node()->_data._has_children; }
+
+  void skip_n_children( int num )
+  {
+    for( auto i : irange( num ))
+    {
+      UNUSED( i );
+      (*this)++;
+      to_trailing();
+    }
+  }
+};
+
+/*
+  lazy_iteratorの子供をたどるiterator。child_iteratorと同じように使える。
+*/
+template<typename T, typename CODEC>
+class lazy_child_iterator : public iterator_facade<lazy_child_iterator<T, CODEC>, T>
+{
+  lazy_iterator<T, CODEC> _curIterator;
+  lazy_iterator<T, CODEC> _endIterator;
+
+  lazy_child_iterator( const lazy_iterator<T, CODEC>& cur, const lazy_iterator<T, CODEC>& end ) : _curIterator( cur ), _endIterator( end ) {}
+
+public:
+  explicit lazy_child_iterator( const lazy_iterator<T, CODEC>& parentIter ) : _curIterator( parentIter.leading_of() ), _endIterator( parentIter.trailing_of() )
+  {
+    _curIterator++;
+  }
+
+  void increment()
+  {
+    if ( _curIterator == _endIterator )
+      return;
+    _curIterator.to_trailing();
+    _curIterator++;
+  }
+
+  T& dereference() const { return _curIterator.get_node()->_data._data; }
+
+  bool equal( const lazy_child_iterator& other ) const { return other._curIterator == _curIterator; }
+
+  lazy_child_iterator end() const { return lazy_child_iterator( _endIterator, _endIterator ); }
+
+  lazy_iterator<T, CODEC> get_iterator() const { return _curIterator; }
+};
+
+}
+
+#endif
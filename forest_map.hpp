@@ -0,0 +1,109 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_MAP_HPP_
+#define _FOREST_MAP_HPP_
+
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "forest.hpp"
+#include "forest_compact.hpp"
+
+namespace symtree
+{
+
+/*
+  map_treeとmap_tree_in_blockの本体。makeでノードを作り、srcのエッジの順に新しいツリーのエッジをつないでいく。
+  compact()と同じく、親は走査中のスタックで分かるので対応表はいらない。
+*/
+template<typename U, typename T, typename F, typename MAKE>
+forest<U>* map_tree_with( const forest<T>& src, F& fn, MAKE make )
+{
+  using src_annotation = typename forest_traits<T>::annotation;
+  using dest_annotation = typename forest_traits<U>::annotation;
+
+  std::vector<forest<U>*> parents;
+  forest<U>* root = nullptr;
+  forest<U>* prevNode = nullptr;
+  edge_dir prevDir = edge_dir::leading;
+  for( auto iter = src.begin(); iter != src.end(); iter++ )
+  {
+    forest<U>* cur;
+    if ( iter.is_leading() )
+    {
+      cur = make( U( fn( iter.get_node()->_data ) ) );
+      // 構造が同じなので、注釈の型が同じならそのままコピーすれば良い。
+      if constexpr ( std::is_same<src_annotation, dest_annotation>::value )
+        static_cast<dest_annotation&>( *cur ) = static_cast<const src_annotation&>( *iter.get_node() );
+      parents.push_back( cur );
+    }
+    else
+    {
+      cur = parents.back();
+      parents.pop_back();
+    }
+
+    if ( prevNode != nullptr )
+    {
+      prevNode->get_link( prevDir, prior_next::next ) = cur;
+      cur->get_link( iter._edge._direction, prior_next::prior ) = prevNode;
+    }
+    else
+    {
+      root = cur;
+    }
+    prevNode = cur;
+    prevDir = iter._edge._direction;
+  }
+
+  // 注釈の型が違う時は、insertで一つずつつないだのと同じ順（preorder）でattachedを呼んで作り直す。
+  if constexpr ( !std::is_same<src_annotation, dest_annotation>::value && !std::is_same<dest_annotation, no_annotation>::value )
+  {
+    for( auto iter = root->begin().next_of(); iter != root->end(); iter++ )
+    {
+      if ( iter.is_leading() )
+        dest_annotation::attached( iter );
+    }
+  }
+  return root;
+}
+
+/*
+  srcと同じ形で、各ノードの値をfnで変換したforest<U>を作る。返されたツリーの寿命は呼び出し側が管理する。
+  fnは U fn( const T& ) （Uに変換できる値を返せば良い）。
+
+  auto lowered = map_tree<attr>( *expr, []( const atom<sym>& a ) { return attr( a ); } );
+
+  一回の走査で作り、clone()のようなstd::mapは使わない。
+  注釈はTとUで型が同じならコピーする。違う場合はpreorderでattachedを呼び直すので、insertで作るのと同じだけかかる。
+*/
+template<typename U, typename T, typename F>
+forest<U>* map_tree( const forest<T>& src, F fn )
+{
+  return map_tree_with<U>( src, fn, []( U&& data ) { return new forest<U>( std::move( data ) ); } );
+}
+
+/*
+  map_treeと同じだが、新しいノードをcompact()と同じく一つのメモリブロックにpreorderで並べる。
+  ブロックの大きさを決める為に、最初にsrcのノードを数える（確保はしない）。
+  返されたblock_treeがツリーを持ち、消える時に消す。ブロックは最後のノードが消えた時に解放される（node_blockを参照）。
+*/
+template<typename U, typename T, typename F>
+block_tree<U> map_tree_in_block( const forest<T>& src, F fn )
+{
+  size_t count = 0;
+  for( auto iter = src.begin(); iter != src.end(); iter++ )
+  {
+    if ( iter.is_leading() )
+      count++;
+  }
+
+  node_block<U> nodes( count );
+  size_t next = 0;
+  auto root = map_tree_with<U>( src, fn, [&nodes, &next]( U&& data ) { return nodes.construct( next++, std::move( data ) ); } );
+  return block_tree<U>( root );
+}
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_POOL_HPP_
+#define _FOREST_POOL_HPP_
+
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  使い終わったノードを貯めておいて、次のノード作成に使い回すプール。
+  ツリーの差し替えを繰り返す処理で、newとdeleteを繰り返さないようにする為のもの。
+
+  貯めているノードは単独のノード（子供も親も無い）で、_dataは前の値が入ったまま。
+  使い回す時にTのmove代入で上書きするので、Tはmove代入できないといけない。
+*/
+template<typename T>
+class node_pool
+{
+  using annotation = typename forest_traits<T>::annotation;
+
+  std::vector<forest<T>*> _free;
+
+public:
+  node_pool() = default;
+  node_pool( const node_pool& ) = delete;
+  node_pool& operator=( const node_pool& ) = delete;
+
+  ~node_pool()
+  {
+    for( auto node : _free )
+      delete node;
+  }
+
+  /*
+    dataを持つ単独のノードを返す。貯めているノードがあればそれを使う。
+  */
+  forest<T>* make( T&& data )
+  {
+    if ( _free.empty() )
+      return new forest<T>( std::move( data ) );
+
+    auto node = _free.back();
+    _free.pop_back();
+    node->_data = std::move( data );
+    return node;
+  }
+
+  /*
+    ツリーから切り離されたサブツリーのノードをすべてプールに戻す。
+    サブツリーを一回たどってノードを集め、リンクはつなぎ直さずにそのまま単独のノードに戻す。
+    fnが指定されている場合は、各ノードを戻す前に fn(forest<T>*) を呼ぶ。
+  */
+  template<typename F>
+  void recycle( forest<T>* subtree, F fn )
+  {
+    assert( subtree->is_root() );
+
+    auto first = _free.size();
+    for( auto iter = subtree->begin(); iter != subtree->end(); iter++ )
+    {
+      if ( iter.is_leading() )
+        _free.push_back( iter.get_node() );
+    }
+
+    for( auto i : irange( first, _free.size() ) )
+    {
+      auto node = _free[i];
+      fn( node );
+      node->reset_links();
+      static_cast<annotation&>( *node ) = annotation();
+    }
+  }
+
+  void recycle( forest<T>* subtree )
+  {
+    recycle( subtree, []( forest<T>* ) {} );
+  }
+
+  size_t size() const { return _free.size(); }
+};
+
+}
+
+#endif
@@ -0,0 +1,216 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_RESUME_HPP_
+#define _FOREST_RESUME_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  一回のresumeでして良い仕事の量。エッジ一つを1とした数と、締め切りの時刻で決める。
+  締め切りの時刻は最初と、その後はclock_intervalごとに見る。
+
+  auto budget = work_budget::for_duration( std::chrono::microseconds( 200 ) );
+  while( !walk.resume( budget, fn ) )
+  {
+    yield();
+    budget = work_budget::for_duration( std::chrono::microseconds( 200 ) );
+  }
+*/
+struct work_budget
+{
+  using clock = std::chrono::steady_clock;
+  static constexpr size_t clock_interval = 64;
+
+  size_t _steps = std::numeric_limits<size_t>::max();
+  bool _has_deadline = false;
+  clock::time_point _deadline;
+  size_t _until_check = clock_interval;
+
+  static work_budget steps( size_t n )
+  {
+    work_budget res;
+    res._steps = n;
+    return res;
+  }
+
+  static work_budget until( clock::time_point deadline )
+  {
+    work_budget res;
+    res._has_deadline = true;
+    res._deadline = deadline;
+    res._until_check = 1;
+    return res;
+  }
+
+  template<typename DURATION>
+  static work_budget for_duration( DURATION d )
+  {
+    return until( clock::now() + d );
+  }
+
+  static work_budget unlimited() { return work_budget(); }
+
+  /*
+    仕事を一つ使う。もう仕事ができない時はfalse。
+  */
+  bool take()
+  {
+    if ( _steps == 0 )
+      return false;
+    if ( _has_deadline && --_until_check == 0 )
+    {
+      _until_check = clock_interval;
+      if ( clock::now() >= _deadline )
+      {
+        _steps = 0;
+        return false;
+      }
+    }
+    _steps--;
+    return true;
+  }
+};
+
+/*
+  途中で止めて後から続けられるfor_each。次に訪れるエッジと終わりのエッジだけを持つので、コピーして他のスレッドで続けても良い。
+  パスの状態（出力や深さなど）はfnの側に持つ。
+
+  forest_walk<string> walk( root );
+  while( !walk.resume( budget, [&]( const forest_iterator<string>& iter ) { ... } ) )
+    ...
+
+  止めている間にツリーを変更してはいけない。
+*/
+template<typename T>
+struct forest_walk
+{
+  forest_iterator<T> _cur;
+  forest_iterator<T> _end;
+
+  explicit forest_walk( forest<T>& root ) : _cur( root.begin() ), _end( root.end() ) {}
+  forest_walk( const forest_iterator<T>& first, const forest_iterator<T>& last ) : _cur( first ), _end( last ) {}
+
+  bool done() const { return _cur == _end; }
+
+  /*
+    budgetが尽きるか最後まで、エッジごとにfn( iter )を呼ぶ。最後まで行ったらtrue。
+  */
+  template<typename F>
+  bool resume( work_budget& budget, F fn )
+  {
+    while ( !done() && budget.take() )
+    {
+      const forest_iterator<T>& iter = _cur;
+      fn( iter );
+      _cur++;
+    }
+    return done();
+  }
+};
+
+/*
+  途中で止められるclone。C::cloneはforest::clone()と同じ。
+  作りかけのツリーもinsertで作っているので、いつでも普通のツリーとして正しい（注釈もinsertで更新される）。
+  終わったらrelease()で受け取る。受け取らずに消えた時は、作りかけのツリーも消す。
+*/
+template<typename T, typename C>
+class clone_walk
+{
+  forest_walk<T> _walk;
+  forest<T>* _result;
+  forest_iterator<T> _cur;
+
+public:
+  explicit clone_walk( forest<T>& src )
+    : _walk( src.begin().next_of(), src.end() ), _result( new forest<T>( C::clone( src._data ) ) ), _cur( _result->begin().to_trailing() ) {}
+
+  clone_walk( const clone_walk& ) = delete;
+  clone_walk& operator=( const clone_walk& ) = delete;
+
+  ~clone_walk() { delete _result; }
+
+  bool done() const { return _walk.done(); }
+
+  bool resume( work_budget& budget )
+  {
+    return _walk.resume( budget, [this]( const forest_iterator<T>& iter ) {
+      if ( iter.is_leading() )
+        _cur = _cur.insert( C::clone( iter.get_node()->_data ) ).to_trailing();
+      else
+        _cur++;
+    } );
+  }
+
+  forest<T>* release()
+  {
+    assert( done() );
+    auto res = _result;
+    _result = nullptr;
+    return res;
+  }
+};
+
+/*
+  ツリーから切り離したサブツリーを、途中で止めながら消していく。ツリーの中のサブツリーはunchainしてから渡す。
+  ~forest()と同じく子孫をpostorderで消し、リンクはつなぎ直さない。
+  消したノードのリンクは読まないので、次に訪れるエッジだけ持っていれば続けられる。最後にルートを消す。
+  終わる前に消えた時は、残りを全部消す。
+*/
+template<typename T>
+class erase_walk
+{
+  forest<T>* _root;
+  forest_iterator<T> _cur;
+
+public:
+  explicit erase_walk( forest<T>* root ) : _root( root ), _cur( root->begin().next_of() )
+  {
+    assert( root->is_root() );
+  }
+
+  erase_walk( const erase_walk& ) = delete;
+  erase_walk& operator=( const erase_walk& ) = delete;
+
+  ~erase_walk()
+  {
+    auto budget = work_budget::unlimited();
+    resume( budget );
+  }
+
+  bool done() const { return _root == nullptr; }
+
+  bool resume( work_budget& budget )
+  {
+    if ( done() )
+      return true;
+
+    forest_iterator<T> last( _root, edge_dir::trailing );
+    while ( _cur != last )
+    {
+      // 深いツリーでもbudgetを守れるよう、leadingを降りるのも一つと数える。
+      if ( !budget.take() )
+        return false;
+      auto node = _cur.get_node();
+      bool leaving = _cur.is_trailing();
+      _cur++;
+      if ( leaving )
+        delete node;
+    }
+
+    // 子孫はもう無いので、単独のノードにしてから消す。
+    _root->reset_links();
+    delete _root;
+    _root = nullptr;
+    return true;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,637 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_SHARED_HPP_
+#define _FOREST_SHARED_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "forest.hpp"
+#include "forest_arena.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SYMTREE_HAS_SHARED_MEMORY 1
+#endif
+
+#ifdef SYMTREE_HAS_SHARED_MEMORY
+
+namespace symtree
+{
+
+// 同時にread()できる数。
+constexpr size_t shared_reader_slots = 64;
+
+/*
+  shared_forestのメモリの先頭に置く管理情報。プロセスごとにアドレスが違っても読めるように、ポインタは持たない。
+  _epochと排他の為のもの以外は、書く側は_writerを取っている間、読む側は_readersに自分の印を置いている間だけ読み書きする。
+*/
+struct shared_forest_header
+{
+  uint64_t _magic;
+  uint32_t _node_size;
+  uint32_t _capacity;
+
+  // 一度でも使った添字の数と、フリーリストの先頭、生きているノードの数。
+  uint32_t _count;
+  uint32_t _free;
+  uint32_t _live;
+  uint32_t _root;
+
+  uint32_t _log_capacity;
+  uint32_t _padding;
+  uint64_t _bytes_capacity;
+  uint64_t _bytes_used;
+
+  // これまでに書いた記録の数と、上書きで失った記録の一番新しいepoch。
+  uint64_t _log_end;
+  uint64_t _log_floor;
+
+  // 書き込みが終わるたびに一つ増える。
+  std::atomic<uint64_t> _epoch;
+
+  // 書く側の排他。プロセス間で共有するrobust mutexなので、持ったまま落ちたプロセスがあれば次に取ったプロセスが気付く。
+  pthread_mutex_t _writer;
+
+  // 書き込み中なら1。
+  std::atomic<uint32_t> _writing;
+
+  // 前の書き込みが途中で終わっていたら1。次のbegin_updateで0に戻す。
+  uint32_t _interrupted;
+
+  // 読んでいるプロセスの印。下位32bitがpid、上位32bitがそのプロセスの起動時刻で、空きは0。
+  // pidは使い回されるので、起動時刻も合わせて見る。落ちたプロセスの分は、書く側や次に読む側が片付ける。
+  std::atomic<uint64_t> _readers[shared_reader_slots];
+};
+
+/*
+  shared_forestの変更の記録。
+    chain:   _nodeがつながった。
+    unchain: _nodeが切り離された。_otherと_hole_dirが居た場所の次のエッジ。
+    erase:   _node（葉）が消された。場所はunchainと同じ。
+    root:    ルートが_nodeになった。
+  _epochはその変更が見えるようになったepoch。
+*/
+struct shared_record
+{
+  enum kind : uint8_t
+  {
+    chain,
+    unchain,
+    erase,
+    root
+  };
+
+  uint64_t _epoch;
+  uint32_t _node;
+  uint32_t _other;
+  kind _kind;
+  edge_dir _hole_dir;
+};
+
+/*
+  一つのメモリ領域（普通はプロセス間の共有メモリ）の中にノードを置くforest。
+  ノードはarena_forestと同じarena_nodeで、リンクは添字なので、領域がどのアドレスにマップされていても読める。
+
+  書く側：
+  auto tree = shared_forest<int>::create_in( mem, bytes, 100000, 4096 );
+  tree.begin_update();
+  tree.set_root( tree.copy_from( *root ) );
+  tree.end_update();
+
+  読む側（別のプロセス）：
+  auto tree = shared_forest<int>::attach( mem, bytes );
+  tree.read( [&] { for( auto& edge : tree.tree( tree.root() ) ) { ... } } );
+  tree.changes_since( lastEpoch, []( const shared_record& r ) { ... } );
+
+  書くのは一つのプロセスだけで、begin_updateとend_updateの間にarena_iteratorで普通に変更する。
+  変更はその間領域の中の記録の輪に書かれ、end_updateでepochが一つ増えて読む側に見えるようになる。
+  読む側はread()の中でだけツリーをたどる。readはbegin_updateからend_updateの間は待たされ、書く側はreadが終わるのを待つ。
+  記録の輪が一周して古い記録が消えていたら、changes_sinceはfalseを返すので、読む側は全体を読み直す。
+
+  書く側が書き込みの途中で落ちたら、次にbegin_updateを呼んだプロセスか、待っている読む側がそれに気付いてロックを戻す。
+  その時はepochを一つ進めてそれまでの記録を捨てる（changes_sinceはfalseになる）。落ちた書き込みの変更は途中まで残っているので、
+  begin_updateはfalseを返し、書く側はツリーを作り直す。
+  読む側がread()の途中で落ちた時は、書く側が残ったpidのプロセスが居ない事を見て片付ける。
+
+  Tはtrivially copyableで無くてはいけない。文字列などはadd_bytesで領域の中に置き、そのoffsetを持たせる。
+  ノードの数と記録の数とバイト領域の大きさは作る時に決め、足りなくなるとstd::length_errorを投げる。
+*/
+template<typename T>
+class shared_forest
+{
+  static_assert( std::is_trivially_copyable<T>::value, "shared_forest needs a trivially copyable payload" );
+
+public:
+  using index_t = uint32_t;
+  using node = arena_node<T>;
+  using iterator = arena_iterator<T, shared_forest<T>>;
+
+  static constexpr index_t npos = 0xffffffff;
+  static constexpr uint64_t magic = 0x31656572746d7973ULL;
+
+  /*
+    capacity個のノード、logCapacity個の記録、byteCapacityバイトのバイト領域に必要な大きさ。
+  */
+  static size_t required_bytes( index_t capacity, uint32_t logCapacity, uint64_t byteCapacity = 0 )
+  {
+    return bytes_offset( capacity, logCapacity ) + byteCapacity;
+  }
+
+  /*
+    baseからbytesの大きさの領域に空のforestを作る。書く側が一度だけ呼ぶ。
+  */
+  static shared_forest create_in( void* base, size_t bytes, index_t capacity, uint32_t logCapacity, uint64_t byteCapacity = 0 )
+  {
+    if ( bytes < required_bytes( capacity, logCapacity, byteCapacity ) )
+      throw std::length_error( "shared_forest: region too small" );
+    assert( logCapacity > 0 );
+
+    auto header = ::new( base ) shared_forest_header;
+    header->_magic = magic;
+    header->_node_size = sizeof( node );
+    header->_capacity = capacity;
+    header->_count = 0;
+    header->_free = npos;
+    header->_live = 0;
+    header->_root = npos;
+    header->_log_capacity = logCapacity;
+    header->_padding = 0;
+    header->_bytes_capacity = byteCapacity;
+    header->_bytes_used = 0;
+    header->_log_end = 0;
+    header->_log_floor = 0;
+    header->_epoch.store( 0 );
+    header->_writing.store( 0 );
+    header->_interrupted = 0;
+    for( auto& slot : header->_readers )
+      slot.store( 0 );
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    auto err = pthread_mutex_init( &header->_writer, &attr );
+    pthread_mutexattr_destroy( &attr );
+    if ( err != 0 )
+      throw std::runtime_error( "shared_forest: cannot create the lock" );
+    return shared_forest( base );
+  }
+
+  /*
+    create_inで作った、baseからbytesの大きさの領域につなぐ。ヘッダの言う大きさより領域が小さければ例外を投げる。
+  */
+  static shared_forest attach( void* base, size_t bytes )
+  {
+    auto header = static_cast<shared_forest_header*>( base );
+    if ( bytes < sizeof( shared_forest_header ) || header->_magic != magic || header->_node_size != sizeof( node ) || header->_log_capacity == 0 )
+      throw std::runtime_error( "shared_forest: not a shared_forest region" );
+    if ( bytes < required_bytes( header->_capacity, header->_log_capacity, header->_bytes_capacity ) )
+      throw std::length_error( "shared_forest: region smaller than its header says" );
+    return shared_forest( base );
+  }
+
+  node& at( index_t idx ) { return nodes()[idx]; }
+  const node& at( index_t idx ) const { return nodes()[idx]; }
+
+  // 生きているノードの数。
+  size_t size() const { return _header->_live; }
+  size_t capacity() const { return _header->_capacity; }
+
+  index_t root() const { return _header->_root; }
+
+  void set_root( index_t root )
+  {
+    _header->_root = root;
+    add_record( shared_record::root, root, npos, edge_dir::leading );
+  }
+
+  uint64_t epoch() const { return _header->_epoch.load( std::memory_order_acquire ); }
+
+  iterator begin( index_t root ) { return iterator( this, root, edge_dir::leading ); }
+  iterator end( index_t root ) { return iterator( this, root, edge_dir::trailing ).next_of(); }
+
+  struct tree_view
+  {
+    shared_forest* _forest;
+    index_t _root;
+
+    iterator begin() const { return _forest->begin( _root ); }
+    iterator end() const { return _forest->end( _root ); }
+  };
+
+  tree_view tree( index_t root ) { return tree_view { this, root }; }
+
+  /*
+    子供も親も無い単独のノードを作って、その添字を返す。
+  */
+  index_t create( const T& data )
+  {
+    assert( updating() );
+    index_t idx;
+    if ( _header->_free != npos )
+    {
+      idx = _header->_free;
+      _header->_free = at( idx ).get_link( edge_dir::leading, prior_next::next );
+    }
+    else
+    {
+      if ( _header->_count == _header->_capacity )
+        throw std::length_error( "shared_forest: out of nodes" );
+      idx = _header->_count++;
+    }
+    ::new( &at( idx )._data ) T( data );
+    init_edge( idx );
+    _header->_live++;
+    return idx;
+  }
+
+  /*
+    forestのツリーをコピーし、ルートの添字を返す。ノードはpreorderに並ぶ。
+  */
+  index_t copy_from( const forest<T>& src )
+  {
+    auto root = create( src._data );
+    auto cur = begin( root ).to_trailing();
+    for( auto iter = src.begin().next_of(); iter != src.end(); iter++ )
+    {
+      if ( iter.is_leading() )
+        cur = cur.insert( iter.get_node()->_data ).to_trailing();
+      else
+        cur++;
+    }
+    return root;
+  }
+
+  /*
+    rootのツリーをすべて削除する。rootは単独のツリーのルートで無くてはいけない。
+  */
+  void destroy( index_t root )
+  {
+    assert( is_root( root ) );
+    std::vector<index_t> dead;
+    for( auto iter = begin( root ); iter != end( root ); iter++ )
+    {
+      if ( iter.is_leading() )
+        dead.push_back( iter.get_index() );
+    }
+    for( auto idx : dead )
+      release( idx );
+  }
+
+  bool is_root( index_t idx ) const
+  {
+    return at( idx ).get_link( edge_dir::leading, prior_next::prior ) == npos
+      && at( idx ).get_link( edge_dir::trailing, prior_next::next ) == npos;
+  }
+
+  /*
+    バイト領域にsizeバイトをコピーし、そのoffsetを返す。領域は追記するだけで解放はしない。
+  */
+  uint64_t add_bytes( const void* data, size_t size )
+  {
+    assert( updating() );
+    if ( _header->_bytes_used + size > _header->_bytes_capacity )
+      throw std::length_error( "shared_forest: out of bytes" );
+    auto offset = _header->_bytes_used;
+    memcpy( bytes_base() + offset, data, size );
+    _header->_bytes_used += size;
+    return offset;
+  }
+
+  const char* bytes( uint64_t offset ) const { return bytes_base() + offset; }
+
+  /*
+    書き込みを始める。読んでいるプロセスが居なくなるまで待つ。
+    前の書き込みが途中で落ちていた時はfalseを返す。その変更は途中まで残っているので、ツリーを作り直す事。
+  */
+  bool begin_update()
+  {
+    auto err = pthread_mutex_lock( &_header->_writer );
+    if ( err == EOWNERDEAD )
+      recover_writer();
+    else if ( err != 0 )
+      throw std::runtime_error( "shared_forest: cannot lock" );
+
+    // 新しく読み始めるのを止めてから、今読んでいるのが終わるのを待つ。
+    // 読む側はpidを置いてから_writingを見るので、どちらもseq_cstにしておけば、どちらかが相手に気付く。
+    _header->_writing.store( 1 );
+    for( auto& slot : _header->_readers )
+    {
+      for( ;; )
+      {
+        uint64_t reader = slot.load();
+        if ( reader == 0 )
+          break;
+        if ( !process_alive( reader ) )
+          slot.compare_exchange_strong( reader, 0 );
+        else
+          std::this_thread::yield();
+      }
+    }
+
+    bool clean = _header->_interrupted == 0;
+    _header->_interrupted = 0;
+    return clean;
+  }
+
+  /*
+    書き込みを終えてepochを一つ進める。
+  */
+  void end_update()
+  {
+    assert( updating() );
+    _header->_epoch.fetch_add( 1, std::memory_order_release );
+    _header->_writing.store( 0, std::memory_order_release );
+    pthread_mutex_unlock( &_header->_writer );
+  }
+
+  bool updating() const { return _header->_writing.load( std::memory_order_relaxed ) != 0; }
+
+  /*
+    書き込み中で無い時にfnを呼ぶ。fnの中でだけツリーを読む事。
+  */
+  template<typename F>
+  void read( F fn )
+  {
+    auto& slot = enter_read();
+    try
+    {
+      fn();
+    }
+    catch( ... )
+    {
+      slot.store( 0, std::memory_order_release );
+      throw;
+    }
+    slot.store( 0, std::memory_order_release );
+  }
+
+  /*
+    epochより後の変更の記録を古い順にfn( const shared_record& )に渡す。
+    必要な記録がもう上書きされていたら何もせずにfalseを返す。read()の中で呼んではいけない。
+  */
+  template<typename F>
+  bool changes_since( uint64_t epoch, F fn )
+  {
+    bool complete = true;
+    read( [&] {
+      if ( epoch < _header->_log_floor )
+      {
+        complete = false;
+        return;
+      }
+      auto cap = _header->_log_capacity;
+      auto end = _header->_log_end;
+      auto start = end > cap ? end - cap : 0;
+      for( auto i = start; i < end; i++ )
+      {
+        auto& r = records()[i % cap];
+        if ( r._epoch > epoch )
+          fn( r );
+      }
+    } );
+    return complete;
+  }
+
+  // arena_iteratorから呼ばれる。
+  void chained( index_t idx ) { add_record( shared_record::chain, idx, npos, edge_dir::leading ); }
+  void unchained( index_t idx, const iterator& hole ) { add_record( shared_record::unchain, idx, hole.get_index(), hole._edge._direction ); }
+  void erased( index_t idx, const iterator& hole ) { add_record( shared_record::erase, idx, hole.get_index(), hole._edge._direction ); }
+
+private:
+  friend class arena_iterator<T, shared_forest<T>>;
+
+  shared_forest_header* _header;
+  char* _base;
+
+  explicit shared_forest( void* base ) : _header( static_cast<shared_forest_header*>( base ) ), _base( static_cast<char*>( base ) ) {}
+
+  static size_t align_up( size_t n, size_t a ) { return ( n + a - 1 ) / a * a; }
+
+  static size_t nodes_offset() { return align_up( sizeof( shared_forest_header ), alignof( node ) ); }
+
+  static size_t records_offset( index_t capacity )
+  {
+    return align_up( nodes_offset() + (size_t)capacity * sizeof( node ), alignof( shared_record ) );
+  }
+
+  static size_t bytes_offset( index_t capacity, uint32_t logCapacity )
+  {
+    return records_offset( capacity ) + (size_t)logCapacity * sizeof( shared_record );
+  }
+
+  /*
+    pidのプロセスが起動した時刻。/procの無い環境や読めない時は0を返し、その時はpidだけで生きているか見る。
+  */
+  static uint32_t process_start_time( pid_t pid )
+  {
+    std::ifstream stat( "/proc/" + std::to_string( pid ) + "/stat" );
+    std::string line;
+    if ( !std::getline( stat, line ) )
+      return 0;
+
+    // 2番目のコマンド名は空白や括弧を含み得るので、最後の')'から数える。起動時刻は22番目。
+    auto pos = line.rfind( ')' );
+    if ( pos == std::string::npos )
+      return 0;
+    std::istringstream fields( line.substr( pos + 1 ) );
+    std::string field;
+    for( int i = 3; i <= 22; i++ )
+      if ( !( fields >> field ) )
+        return 0;
+    return (uint32_t)std::strtoull( field.c_str(), nullptr, 10 );
+  }
+
+  static uint64_t reader_mark( pid_t pid ) { return (uint64_t)process_start_time( pid ) << 32 | (uint32_t)pid; }
+
+  /*
+    印のプロセスがまだ居るか。同じpidでも起動時刻が違えば、別のプロセスが使い回しているので居ないとみなす。
+  */
+  static bool process_alive( uint64_t reader )
+  {
+    auto pid = (pid_t)(uint32_t)reader;
+    if ( kill( pid, 0 ) != 0 && errno != EPERM )
+      return false;
+    auto start = (uint32_t)( reader >> 32 );
+    return start == 0 || start == process_start_time( pid );
+  }
+
+  /*
+    空いているか、居なくなったプロセスの読む枠に自分の印を置き、書き込み中で無ければその枠を返す。
+  */
+  std::atomic<uint64_t>& enter_read()
+  {
+    uint64_t self = reader_mark( getpid() );
+    for( ;; )
+    {
+      for( auto& slot : _header->_readers )
+      {
+        uint64_t reader = slot.load( std::memory_order_relaxed );
+        if ( reader != 0 && process_alive( reader ) )
+          continue;
+        if ( !slot.compare_exchange_strong( reader, self ) )
+          continue;
+        if ( _header->_writing.load() == 0 )
+          return slot;
+        slot.store( 0, std::memory_order_release );
+        break;
+      }
+      wait_writer();
+    }
+  }
+
+  /*
+    書き込み中なら少し待つ。書く側がロックを持ったまま落ちていたら、ここでロックを取って戻す。
+  */
+  void wait_writer()
+  {
+    if ( _header->_writing.load() != 0 )
+    {
+      auto err = pthread_mutex_trylock( &_header->_writer );
+      if ( err == EOWNERDEAD )
+        recover_writer();
+      if ( err == EOWNERDEAD || err == 0 )
+        pthread_mutex_unlock( &_header->_writer );
+    }
+    std::this_thread::yield();
+  }
+
+  /*
+    _writerを持ったまま落ちたプロセスが居た。途中の変更の記録は当てにならないので捨てて、epochを進めて読む側に知らせる。
+  */
+  void recover_writer()
+  {
+    _header->_interrupted = 1;
+    _header->_log_floor = epoch() + 1;
+    _header->_writing.store( 0 );
+    _header->_epoch.fetch_add( 1, std::memory_order_release );
+    pthread_mutex_consistent( &_header->_writer );
+  }
+
+  node* nodes() const { return reinterpret_cast<node*>( _base + nodes_offset() ); }
+  shared_record* records() const { return reinterpret_cast<shared_record*>( _base + records_offset( _header->_capacity ) ); }
+  char* bytes_base() const { return _base + bytes_offset( _header->_capacity, _header->_log_capacity ); }
+
+  void init_edge( index_t idx )
+  {
+    auto& n = at( idx );
+    n.get_link( edge_dir::leading, prior_next::next ) = idx;
+    n.get_link( edge_dir::trailing, prior_next::prior ) = idx;
+    n.get_link( edge_dir::leading, prior_next::prior ) = npos;
+    n.get_link( edge_dir::trailing, prior_next::next ) = npos;
+  }
+
+  // フリーリストはleadingのnextでつなぐ。
+  void release( index_t idx )
+  {
+    at( idx ).get_link( edge_dir::leading, prior_next::next ) = _header->_free;
+    _header->_free = idx;
+    _header->_live--;
+  }
+
+  void add_record( shared_record::kind kind, index_t node, index_t other, edge_dir dir )
+  {
+    assert( updating() );
+    auto cap = _header->_log_capacity;
+    auto& slot = records()[_header->_log_end % cap];
+    if ( _header->_log_end >= cap )
+      _header->_log_floor = std::max( _header->_log_floor, slot._epoch );
+    slot = shared_record { epoch() + 1, node, other, kind, dir };
+    _header->_log_end++;
+  }
+};
+
+/*
+  POSIXの名前付き共有メモリ。shared_forestの領域に使う。
+
+  shared_memory mem( "/my_tree", bytes );   // 作る
+  shared_memory mem( "/my_tree" );          // 他のプロセスが作ったものを開く
+  shared_memory::unlink( "/my_tree" );      // 名前を消す（マップ済みの領域はそのまま使える）
+*/
+class shared_memory
+{
+public:
+  shared_memory( const std::string& name, size_t bytes )
+  {
+    auto fd = shm_open( name.c_str(), O_CREAT | O_RDWR, 0600 );
+    if ( fd < 0 )
+      throw std::runtime_error( "cannot create shared memory " + name );
+    if ( ftruncate( fd, (off_t)bytes ) != 0 )
+    {
+      close( fd );
+      throw std::runtime_error( "cannot resize shared memory " + name );
+    }
+    map( fd, bytes, name );
+  }
+
+  explicit shared_memory( const std::string& name )
+  {
+    auto fd = shm_open( name.c_str(), O_RDWR, 0600 );
+    if ( fd < 0 )
+      throw std::runtime_error( "cannot open shared memory " + name );
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 )
+    {
+      close( fd );
+      throw std::runtime_error( "cannot stat shared memory " + name );
+    }
+    map( fd, (size_t)st.st_size, name );
+  }
+
+  ~shared_memory()
+  {
+    if ( _data != nullptr )
+      munmap( _data, _size );
+  }
+
+  shared_memory( shared_memory&& src ) : _data( src._data ), _size( src._size )
+  {
+    src._data = nullptr;
+  }
+
+  shared_memory( const shared_memory& ) = delete;
+  shared_memory& operator=( const shared_memory& ) = delete;
+
+  void* data() const { return _data; }
+  size_t size() const { return _size; }
+
+  static void unlink( const std::string& name ) { shm_unlink( name.c_str() ); }
+
+private:
+  void* _data = nullptr;
+  size_t _size = 0;
+
+  void map( int fd, size_t bytes, const std::string& name )
+  {
+    auto p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( p == MAP_FAILED )
+      throw std::runtime_error( "cannot map shared memory " + name );
+    _data = p;
+    _size = bytes;
+  }
+};
+
+}
+
+#endif
+
+#endif
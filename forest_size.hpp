@@ -0,0 +1,221 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_SIZE_HPP_
+#define _FOREST_SIZE_HPP_
+
+#include <algorithm>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  各ノードにサブツリーのサイズ（自身を含むノード数）と高さ（葉が0）を持たせる注釈。
+  使う時はforest_traitsを特殊化してannotationに指定する。
+
+  template<>
+  struct symtree::forest_traits<my_type>
+  {
+    using annotation = subtree_size_annotation;
+  };
+
+  chain, unchain, erase, replaceの度に祖先をたどって更新する。
+  親はノードに覚えておくので、サイズの更新は深さに比例する（高さが変わった時だけ、その親の子供を見直す）。
+*/
+struct subtree_size_annotation
+{
+  size_t _subtree_size = 1;
+  size_t _height = 0;
+
+  /*
+    親のノード。nullptrで無ければ必ず今の親を指す。
+    nullptrは、ルートか、まだ分かっていない（注釈をコピーして作ったノードなど）。分かっていない時はparent_ofで一度たどって覚える。
+  */
+  subtree_size_annotation* _parent = nullptr;
+
+  subtree_size_annotation() = default;
+
+  // 親は場所の情報なので、注釈をコピーしても引き継がない。
+  subtree_size_annotation( const subtree_size_annotation& other ) : _subtree_size( other._subtree_size ), _height( other._height ) {}
+
+  subtree_size_annotation& operator=( const subtree_size_annotation& other )
+  {
+    _subtree_size = other._subtree_size;
+    _height = other._height;
+    return *this;
+  }
+
+  /*
+    nodeの親。ルートならnullptr。覚えていればO(1)。
+  */
+  template<typename T>
+  static forest<T>* parent_of( forest<T>* node )
+  {
+    if ( node->_parent == nullptr )
+      node->_parent = node->parent();
+    return static_cast<forest<T>*>( node->_parent );
+  }
+
+  template<typename T>
+  static void attached( const forest_iterator<T>& leading )
+  {
+    auto subtree = leading.get_node();
+    auto size = subtree->_subtree_size;
+    auto height = subtree->_height;
+
+    // 前のエッジが親のleadingならそれが親、兄のtrailingなら兄の親が親。
+    auto prior = leading.prior_of();
+    subtree->_parent = prior.is_leading() ? prior.get_node() : parent_of( prior.get_node() );
+
+    for( auto node = parent_of( subtree ); node != nullptr; node = parent_of( node ) )
+    {
+      node->_subtree_size += size;
+      height++;
+      node->_height = std::max( node->_height, height );
+    }
+  }
+
+  template<typename T>
+  static void detached( const forest_iterator<T>& hole, forest<T>* subtree )
+  {
+    auto size = subtree->_subtree_size;
+    subtree->_parent = nullptr;
+
+    // holeがtrailingならそのノード自身が、leadingなら弟なので、その親が切り離されたサブツリーの親。
+    auto node = hole.is_trailing() ? hole.get_node() : parent_of( hole.get_node() );
+    bool heightChanged = true;
+    for( ; node != nullptr; node = parent_of( node ) )
+    {
+      node->_subtree_size -= size;
+      if ( heightChanged )
+      {
+        auto oldHeight = node->_height;
+        node->_height = child_max_height( node );
+        heightChanged = ( oldHeight != node->_height );
+      }
+    }
+  }
+
+private:
+  template<typename T>
+  static size_t child_max_height( forest<T>* node )
+  {
+    size_t height = 0;
+    for( auto iter = node->begin_child(); iter != node->end_child(); iter++ )
+    {
+      height = std::max( height, iter.get_node()->_height + 1 );
+    }
+    return height;
+  }
+};
+
+/*
+  サブツリーのノード数をO(1)で返す。
+*/
+template<typename T>
+size_t subtree_size( const forest<T>& node )
+{
+  static_assert( std::is_base_of<subtree_size_annotation, forest<T>>::value, "forest_traits<T>::annotation must be subtree_size_annotation" );
+  return node._subtree_size;
+}
+
+/*
+  サブツリーの高さをO(1)で返す。葉は0。
+*/
+template<typename T>
+size_t subtree_height( const forest<T>& node )
+{
+  static_assert( std::is_base_of<subtree_size_annotation, forest<T>>::value, "forest_traits<T>::annotation must be subtree_size_annotation" );
+  return node._height;
+}
+
+/*
+  ルートからの深さを返す。ルートは0。
+  覚えている親をたどるので O(深さ)（まだ分かっていない親は一度だけ兄弟を飛ばしてたどる）。
+*/
+template<typename T>
+size_t depth_of( forest<T>& node )
+{
+  static_assert( std::is_base_of<subtree_size_annotation, forest<T>>::value, "forest_traits<T>::annotation must be subtree_size_annotation" );
+  size_t depth = 0;
+  for( auto p = subtree_size_annotation::parent_of( &node ); p != nullptr; p = subtree_size_annotation::parent_of( p ) )
+    depth++;
+  return depth;
+}
+
+/*
+  rootをpreorderで並べた時のk番目（rootが0番目）のノードのleadingを返す。
+  kがサイズ以上の場合はroot.end()を返す。
+  各段でサブツリーのサイズを見て、kに近い側の端から子供を飛ばしていく。
+  子供はリストなので、O(深さ + 飛ばした兄弟の数)で、各段で飛ばすのは子供の数の半分まで。
+*/
+template<typename T>
+forest_iterator<T> nth_preorder( forest<T>& root, size_t k )
+{
+  if ( k >= subtree_size( root ) )
+    return root.end();
+
+  auto node = &root;
+  while( k > 0 )
+  {
+    // 子供たちのサブツリーはpreorderで[0, rest)に並ぶ。
+    k--;
+    auto rest = node->_subtree_size - 1;
+    if ( k < rest / 2 )
+    {
+      for( auto iter = node->begin_child(); iter != node->end_child(); iter++ )
+      {
+        auto child = iter.get_node();
+        if ( k < child->_subtree_size )
+        {
+          node = child;
+          break;
+        }
+        k -= child->_subtree_size;
+      }
+      continue;
+    }
+
+    // 後ろ半分なら末っ子のtrailingから兄へ戻る。
+    for( auto iter = node->begin().to_trailing().prior_of(); ; iter = iter.leading_of().prior_of() )
+    {
+      auto child = iter.get_node();
+      auto start = rest - child->_subtree_size;
+      if ( k >= start )
+      {
+        node = child;
+        k -= start;
+        break;
+      }
+      rest = start;
+    }
+  }
+  return node->begin();
+}
+
+/*
+  ツリーをpreorderでparts個のほぼ同じ大きさの区間に分ける為の区切りを返す。
+  結果はparts+1個のleadingのイテレータで、最後はroot.end()。
+  i番目の区間は、res[i]からres[i+1]までの間でleadingのエッジを持つノード。
+  ノード数がpartsより少ない場合は空の区間ができる。
+*/
+template<typename T>
+std::vector<forest_iterator<T>> split_points( forest<T>& root, size_t parts )
+{
+  assert( parts > 0 );
+  auto size = subtree_size( root );
+
+  std::vector<forest_iterator<T>> res;
+  res.reserve( parts+1 );
+  for( auto i : irange( parts ) )
+  {
+    res.push_back( nth_preorder( root, i*size/parts ) );
+  }
+  res.push_back( root.end() );
+  return res;
+}
+
+}
+
+#endif
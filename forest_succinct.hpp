@@ -0,0 +1,275 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_SUCCINCT_HPP_
+#define _FOREST_SUCCINCT_HPP_
+
+#include <cstdint>
+#include <vector>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  簡潔な括弧列でツリーの形だけを持つ、読み取り専用のforest。
+  forestのエッジの順にleadingを1、trailingを0として並べたビット列が、そのまま釣り合った括弧列になる。
+  中身のTはpreorderの順の配列に別に持つ。
+
+  succinct_forest<string> s( *root );
+  for( auto c = s.first_child( s.root() ); c != s.npos; c = s.next_sibling( c ) )
+    cout << s.data( c ) << endl;
+
+  ノードはleadingのビットの位置（size_t）で表す。
+  ビット列はノード一つあたり2bitで、その他に512bitごとのrank（32bit）と超過の最小値（32bit）と、最小値の二分木を持つ。
+  parent, next_sibling, subtree_sizeは、512bitのブロックの中を調べた後に二分木をたどるのでO(log n)。
+  first_child, depth, preorderはO(1)。
+  ノード数は2^31未満で無くてはいけない。
+*/
+template<typename T>
+class succinct_forest
+{
+public:
+  static constexpr size_t npos = (size_t)-1;
+  static constexpr size_t block_bits = 512;
+  static constexpr size_t block_words = block_bits / 64;
+
+  // preorderの順の中身。
+  std::vector<T> _data;
+
+  explicit succinct_forest( const forest<T>& root )
+  {
+    for( auto iter = root.begin(); iter != root.end(); iter++ )
+    {
+      if ( iter.is_leading() )
+        _data.push_back( iter.get_node()->_data );
+      push_bit( iter.is_leading() );
+    }
+    build_index();
+  }
+
+  size_t size() const { return _data.size(); }
+  size_t bit_size() const { return _bit_size; }
+
+  size_t root() const { return 0; }
+
+  bool is_open( size_t pos ) const { return ( _bits[pos / 64] >> ( pos % 64 ) ) & 1; }
+
+  // pos以下の1の数。
+  size_t rank1( size_t pos ) const
+  {
+    auto word = pos / 64;
+    auto block = word / block_words;
+    size_t res = _rank[block];
+    for( auto w = block * block_words; w < word; w++ )
+      res += __builtin_popcountll( _bits[w] );
+    auto mask = ( pos % 64 == 63 ) ? ~0ULL : ( ( 1ULL << ( pos % 64 + 1 ) ) - 1 );
+    return res + __builtin_popcountll( _bits[word] & mask );
+  }
+
+  // k番目（0始まり）の1の位置。ブロックのrankを二分探索するのでO(log n)。
+  size_t select1( size_t k ) const
+  {
+    size_t lo = 0, hi = _rank.size();
+    while( hi - lo > 1 )
+    {
+      auto mid = ( lo + hi ) / 2;
+      if ( _rank[mid] <= k )
+        lo = mid;
+      else
+        hi = mid;
+    }
+    auto remain = k - _rank[lo];
+    for( auto w = lo * block_words; w < _bits.size(); w++ )
+    {
+      auto cnt = (size_t)__builtin_popcountll( _bits[w] );
+      if ( remain < cnt )
+      {
+        auto word = _bits[w];
+        for( size_t i = 0; i < remain; i++ )
+          word &= word - 1;
+        return w * 64 + __builtin_ctzll( word );
+      }
+      remain -= cnt;
+    }
+    return npos;
+  }
+
+  // posまでの超過（1の数-0の数）。
+  int64_t excess( size_t pos ) const { return 2 * (int64_t)rank1( pos ) - (int64_t)pos - 1; }
+
+  // ノードのpreorderの番号。
+  size_t preorder( size_t v ) const { return rank1( v ) - 1; }
+  size_t node_at( size_t preorderIndex ) const { return select1( preorderIndex ); }
+
+  const T& data( size_t v ) const { return _data[preorder( v )]; }
+
+  // ルートが0。
+  size_t depth( size_t v ) const { return (size_t)( excess( v ) - 1 ); }
+
+  size_t find_close( size_t v ) const { return fwd_search( v, excess( v ) - 1 ); }
+
+  size_t subtree_size( size_t v ) const { return ( find_close( v ) - v + 1 ) / 2; }
+
+  bool is_leaf( size_t v ) const { return !is_open( v + 1 ); }
+
+  size_t first_child( size_t v ) const { return is_open( v + 1 ) ? v + 1 : npos; }
+
+  size_t next_sibling( size_t v ) const
+  {
+    auto next = find_close( v ) + 1;
+    return ( next < _bit_size && is_open( next ) ) ? next : npos;
+  }
+
+  size_t parent( size_t v ) const
+  {
+    if ( v == root() )
+      return npos;
+    // 親のleadingの直前は、vの超過-2の最後の位置。
+    auto prev = bwd_search( v, excess( v ) - 2 );
+    return prev == npos ? 0 : prev + 1;
+  }
+
+private:
+  std::vector<uint64_t> _bits;
+  size_t _bit_size = 0;
+
+  // ブロックの先頭までの1の数。
+  std::vector<uint32_t> _rank;
+
+  // ブロックの中の超過の最小値（絶対値）の二分木。葉はブロック、_min_tree[1]が根。
+  std::vector<int32_t> _min_tree;
+  size_t _leaves = 1;
+
+  void push_bit( bool bit )
+  {
+    if ( _bit_size % 64 == 0 )
+      _bits.push_back( 0 );
+    if ( bit )
+      _bits.back() |= 1ULL << ( _bit_size % 64 );
+    _bit_size++;
+  }
+
+  size_t block_count() const { return ( _bit_size + block_bits - 1 ) / block_bits; }
+
+  void build_index()
+  {
+    auto blocks = block_count();
+    while( _leaves < blocks )
+      _leaves *= 2;
+    _min_tree.assign( 2 * _leaves, INT32_MAX );
+
+    int64_t e = 0;
+    uint32_t ones = 0;
+    for( size_t b = 0; b < blocks; b++ )
+    {
+      _rank.push_back( ones );
+      int64_t mn = INT32_MAX;
+      for( auto pos = b * block_bits; pos < std::min( ( b + 1 ) * block_bits, _bit_size ); pos++ )
+      {
+        bool open = is_open( pos );
+        ones += open;
+        e += open ? 1 : -1;
+        mn = std::min( mn, e );
+      }
+      _min_tree[_leaves + b] = (int32_t)mn;
+    }
+    for( auto i = _leaves - 1; i > 0; i-- )
+      _min_tree[i] = std::min( _min_tree[2 * i], _min_tree[2 * i + 1] );
+  }
+
+  /*
+    posより後ろで超過がtargetになる最初の位置。超過は1ずつしか変わらないので、target以下になる最初の位置と同じ。
+  */
+  size_t fwd_search( size_t pos, int64_t target ) const
+  {
+    auto block = pos / block_bits;
+    auto e = excess( pos );
+    auto end = std::min( ( block + 1 ) * block_bits, _bit_size );
+    for( auto p = pos + 1; p < end; p++ )
+    {
+      e += is_open( p ) ? 1 : -1;
+      if ( e == target )
+        return p;
+    }
+
+    auto found = first_block_below( block + 1, target );
+    if ( found == npos )
+      return npos;
+    auto p = found * block_bits;
+    e = excess( p );
+    while( e != target )
+    {
+      p++;
+      e += is_open( p ) ? 1 : -1;
+    }
+    return p;
+  }
+
+  /*
+    posより前で超過がtargetになる最後の位置。無ければnpos（位置-1の超過0を表す）。
+  */
+  size_t bwd_search( size_t pos, int64_t target ) const
+  {
+    auto block = pos / block_bits;
+    auto e = excess( pos );
+    for( auto p = pos; p > block * block_bits; p-- )
+    {
+      // 位置p-1の超過。
+      e -= is_open( p ) ? 1 : -1;
+      if ( e == target )
+        return p - 1;
+    }
+    if ( block == 0 )
+      return npos;
+
+    auto found = last_block_below( block - 1, target );
+    if ( found == npos )
+      return npos;
+    auto p = std::min( ( found + 1 ) * block_bits, _bit_size ) - 1;
+    e = excess( p );
+    while( e != target )
+    {
+      e -= is_open( p ) ? 1 : -1;
+      p--;
+    }
+    return p;
+  }
+
+  // first以降で、最小値がtarget以下の最初のブロック。
+  size_t first_block_below( size_t first, int64_t target ) const
+  {
+    return first_below( 1, 0, _leaves, first, target );
+  }
+
+  size_t first_below( size_t node, size_t lo, size_t hi, size_t first, int64_t target ) const
+  {
+    if ( hi <= first || _min_tree[node] > target )
+      return npos;
+    if ( hi - lo == 1 )
+      return lo;
+    auto mid = ( lo + hi ) / 2;
+    auto res = first_below( 2 * node, lo, mid, first, target );
+    return res != npos ? res : first_below( 2 * node + 1, mid, hi, first, target );
+  }
+
+  // last以前で、最小値がtarget以下の最後のブロック。
+  size_t last_block_below( size_t last, int64_t target ) const
+  {
+    return last_below( 1, 0, _leaves, last, target );
+  }
+
+  size_t last_below( size_t node, size_t lo, size_t hi, size_t last, int64_t target ) const
+  {
+    if ( lo > last || _min_tree[node] > target )
+      return npos;
+    if ( hi - lo == 1 )
+      return lo;
+    auto mid = ( lo + hi ) / 2;
+    auto res = last_below( 2 * node + 1, mid, hi, last, target );
+    return res != npos ? res : last_below( 2 * node, lo, mid, last, target );
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,251 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _FOREST_VIEW_HPP_
+#define _FOREST_VIEW_HPP_
+
+#include <cstddef>
+#include "forest.hpp"
+
+namespace symtree
+{
+
+/*
+  nodeの最初の子供。子供が無ければnullptr。
+*/
+template<typename T>
+forest<T>* first_child_of( forest<T>* node )
+{
+  auto next = node->get_link( edge_dir::leading, prior_next::next );
+  return next == node ? nullptr : next;
+}
+
+/*
+  nodeの次の兄弟。末っ子かルートならnullptr。
+*/
+template<typename T>
+forest<T>* next_sibling_of( forest<T>* node )
+{
+  auto next = node->get_link( edge_dir::trailing, prior_next::next );
+  if ( next == nullptr || next->get_link( edge_dir::leading, prior_next::prior ) != node )
+    return nullptr;
+  return next;
+}
+
+/*
+  forest_viewのiterator。forest_iteratorと同じくedge<T>を返すが、どの子供をどの順に回るかはPOLICYが決める。
+  POLICYは以下を持つ。depthはviewのルートを0とした深さ。
+    forest<T>* first_child( forest<T>* node, size_t depth ): 最初に見せる子供。無ければnullptr。
+    forest<T>* next_sibling( forest<T>* node, size_t depth ): nodeの次に見せる兄弟。無ければnullptr。
+  前にしか進めない。end()はノードがnullptr。
+*/
+template<typename T, typename POLICY>
+class view_iterator : public iterator_facade<view_iterator<T, POLICY>, edge<T>>
+{
+  const POLICY* _policy;
+  forest<T>* _root;
+  size_t _depth;
+
+public:
+  edge<T> _edge;
+
+  view_iterator( const POLICY* policy, forest<T>* root, forest<T>* node, edge_dir dir, size_t depth )
+    : _policy( policy ), _root( root ), _depth( depth ), _edge( node, dir ) {}
+
+  forest<T>* get_node() const { return _edge._node; }
+  bool is_leading() const { return _edge.is_leading(); }
+  bool is_trailing() const { return _edge.is_trailing(); }
+  size_t depth() const { return _depth; }
+
+  ////////////////////////////
+  // iterator_facade関連
+  ////////////////////////////
+
+  bool equal( const view_iterator& other ) const { return _edge.equal( other._edge ); }
+
+  edge<T>& dereference() { return _edge; }
+  const edge<T>& dereference() const { return _edge; }
+
+  void increment()
+  {
+    auto node = _edge._node;
+    if ( _edge.is_leading() )
+    {
+      auto child = _policy->first_child( node, _depth );
+      if ( child == nullptr )
+      {
+        _edge._direction = edge_dir::trailing;
+        return;
+      }
+      _edge = edge<T>( child, edge_dir::leading );
+      _depth++;
+      return;
+    }
+
+    if ( node == _root )
+    {
+      _edge = edge<T>( nullptr, edge_dir::leading );
+      return;
+    }
+    auto sibling = _policy->next_sibling( node, _depth );
+    if ( sibling != nullptr )
+    {
+      _edge = edge<T>( sibling, edge_dir::leading );
+      return;
+    }
+    // 見せない兄弟を飛ばして親に戻るので、兄弟の数だけかかる。
+    _edge = edge<T>( node->parent(), edge_dir::trailing );
+    _depth--;
+  }
+};
+
+/*
+  forest_viewの子供を回るiterator。child_iteratorと同じくTを返す。
+*/
+template<typename T, typename POLICY>
+class view_child_iterator : public iterator_facade<view_child_iterator<T, POLICY>, T>
+{
+  const POLICY* _policy;
+  forest<T>* _node;
+  size_t _depth;
+
+public:
+  view_child_iterator( const POLICY* policy, forest<T>* node, size_t depth ) : _policy( policy ), _node( node ), _depth( depth ) {}
+
+  forest<T>* get_node() const { return _node; }
+
+  void increment() { _node = _policy->next_sibling( _node, _depth ); }
+  T& dereference() const { return _node->_data; }
+  bool equal( const view_child_iterator& other ) const { return _node == other._node; }
+};
+
+/*
+  forestのツリーを、コピーせずに一部だけや違う順で見せるview。
+  begin(), end()でforest_iteratorと同じ規則のエッジを回れるので、stree_dumpなどエッジを回るものにそのまま渡せる。
+
+  auto view = prune_view( *root, []( stree<sym>& node, size_t ) { return node._data.is_enum(); } );
+  stree_dump<sym, formatter>( view );
+
+  viewのルートは常に見せる。ノードも確保せず、元のツリーも変えない。
+  iteratorはviewのPOLICYを指すので、viewより長く使ったりviewをコピーした後に古いiteratorを使ってはいけない。
+  元のツリーを変更したら、それまでのiteratorは使わない事。
+*/
+template<typename T, typename POLICY>
+class forest_view
+{
+  forest<T>* _root;
+  POLICY _policy;
+
+public:
+  using iterator = view_iterator<T, POLICY>;
+  using ch_iterator = view_child_iterator<T, POLICY>;
+
+  forest_view( forest<T>& root, POLICY policy ) : _root( &root ), _policy( policy ) {}
+
+  forest<T>& root() const { return *_root; }
+
+  iterator begin() const { return iterator( &_policy, _root, _root, edge_dir::leading, 0 ); }
+  iterator end() const { return iterator( &_policy, _root, nullptr, edge_dir::leading, 0 ); }
+
+  // ルートの子供。
+  ch_iterator begin_child() const { return ch_iterator( &_policy, _policy.first_child( _root, 0 ), 1 ); }
+
+  // parentの指すノードの子供。
+  ch_iterator begin_child( const iterator& parent ) const
+  {
+    return ch_iterator( &_policy, _policy.first_child( parent.get_node(), parent.depth() ), parent.depth() + 1 );
+  }
+
+  ch_iterator end_child() const { return ch_iterator( &_policy, nullptr, 0 ); }
+};
+
+/*
+  pred( forest<T>& node, size_t depth )がfalseのノードを、サブツリーごと見せないPOLICY。
+*/
+template<typename T, typename PRED>
+struct prune_policy
+{
+  PRED _pred;
+
+  forest<T>* first_child( forest<T>* node, size_t depth ) const { return skip( first_child_of( node ), depth + 1 ); }
+  forest<T>* next_sibling( forest<T>* node, size_t depth ) const { return skip( next_sibling_of( node ), depth ); }
+
+private:
+  forest<T>* skip( forest<T>* node, size_t depth ) const
+  {
+    while ( node != nullptr && !_pred( *node, depth ) )
+      node = next_sibling_of( node );
+    return node;
+  }
+};
+
+/*
+  兄弟をkey( const T& )の小さい順に見せるPOLICY。keyが同じ兄弟は元の順。
+  並べた配列は作らず、毎回兄弟を全部見て次を探すので、子供を一回りするのに 兄弟の数の二乗 かかる。
+*/
+template<typename T, typename KEY>
+struct sort_policy
+{
+  KEY _key;
+
+  forest<T>* first_child( forest<T>* node, size_t ) const
+  {
+    forest<T>* best = nullptr;
+    for( auto child = first_child_of( node ); child != nullptr; child = next_sibling_of( child ) )
+    {
+      if ( best == nullptr || _key( child->_data ) < _key( best->_data ) )
+        best = child;
+    }
+    return best;
+  }
+
+  forest<T>* next_sibling( forest<T>* node, size_t ) const
+  {
+    auto key = _key( node->_data );
+    forest<T>* best = nullptr;
+    bool passed = false;
+    for( auto sibling = first_child_of( node->parent() ); sibling != nullptr; sibling = next_sibling_of( sibling ) )
+    {
+      if ( sibling == node )
+      {
+        passed = true;
+        continue;
+      }
+      auto k = _key( sibling->_data );
+      bool after = key < k || ( passed && !( k < key ) );
+      if ( after && ( best == nullptr || k < _key( best->_data ) ) )
+        best = sibling;
+    }
+    return best;
+  }
+};
+
+/*
+  predがtrueのノードだけを見せるview。falseのノードはサブツリーごと見せない。
+*/
+template<typename T, typename PRED>
+forest_view<T, prune_policy<T, PRED>> prune_view( forest<T>& root, PRED pred )
+{
+  return forest_view<T, prune_policy<T, PRED>>( root, prune_policy<T, PRED> { pred } );
+}
+
+/*
+  rootから深さmaxDepthまでのノードだけを見せるview。
+*/
+template<typename T>
+auto depth_view( forest<T>& root, size_t maxDepth )
+{
+  return prune_view( root, [maxDepth]( forest<T>&, size_t depth ) { return depth <= maxDepth; } );
+}
+
+/*
+  兄弟をkeyの小さい順に並べて見せるview。
+*/
+template<typename T, typename KEY>
+forest_view<T, sort_policy<T, KEY>> sorted_view( forest<T>& root, KEY key )
+{
+  return forest_view<T, sort_policy<T, KEY>>( root, sort_policy<T, KEY> { key } );
+}
+
+}
+
+#endif
@@ -0,0 +1,49 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_ASYNC_HPP_
+#define _STREE_ASYNC_HPP_
+
+#include "stree_visit.hpp"
+#include "forest_coro.hpp"
+
+#ifdef SYMTREE_HAS_COROUTINE
+
+namespace symtree
+{
+
+/*
+    ハンドラがco_awaitできるvisitor。ハンドラはasync_task<R>を返すコルーチンにする。
+    葉で外の値が要る時はlookup_batchで待たせ、run_batchedで一回のfetchにまとめて引いてから続ける。
+
+    lookup_batch<std::string, int> env;
+    auto eval = make_async_visitor<sym, int>(
+        on<test_sym::add>([](ttree& node, auto& self) -> async_task<int> {
+            auto a = self(*node.nth_child(0));
+            auto b = self(*node.nth_child(1));
+            co_return co_await a + co_await b;
+        }),
+        on<test_sym::variable>([&env](ttree& node) -> async_task<int> {
+            var_op op(node);
+            co_return co_await env.lookup(get<0>(op));
+        })
+    );
+    auto task = eval(*root);
+    int value = run_batched(task, env, fetch);
+
+    async_taskは作った時に最初のco_awaitまで走るので、子供のtaskを全部作ってからco_awaitすれば、
+    兄弟の葉のlookupが一回のfetchに揃う。ツリーを二回（lookupを集める走査と計算の走査）回らなくて良い。
+
+    accessorを受け取るハンドラ（on<add_op>など）では、accessorはハンドラを呼ぶ間だけの一時オブジェクトなので、
+    最初のco_awaitより前に必要なものを読み出しておく事。ノードを受け取るハンドラならその心配は無い。
+*/
+template<typename ENUMTYPE, typename R, typename... HANDLERS>
+visitor<ENUMTYPE, async_task<R>, HANDLERS...> make_async_visitor(HANDLERS... handlers)
+{
+    return visitor<ENUMTYPE, async_task<R>, HANDLERS...>(handlers...);
+}
+
+}
+
+#endif
+
+#endif
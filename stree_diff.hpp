@@ -0,0 +1,268 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_DIFF_HPP_
+#define _STREE_DIFF_HPP_
+
+#include "symtree.hpp"
+#include "stree_hash.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    編集スクリプトの一つの操作。位置はすべて古いツリー（かその前の操作で入れたサブツリー）のノードで表す。
+
+    insert:  _positionに_subtreeをchainする。
+    erase:   _targetをunchainして消す。
+    replace: _targetを_subtreeに差し替える。
+    move:    _targetをunchainして_positionにchainする。
+
+    _positionはforest_iteratorのinsertと同じ規則で、兄弟のleadingならその前、親のtrailingなら末っ子になる。
+*/
+template<typename ENUMTYPE>
+struct diff_op
+{
+    using stree_ = stree<ENUMTYPE>;
+    using iterator = forest_iterator<atom<ENUMTYPE>>;
+
+    enum op_type
+    {
+        insert,
+        erase,
+        replace,
+        move
+    };
+
+    op_type _type;
+    stree_* _target;
+    iterator _position;
+    std::unique_ptr<stree_> _subtree;
+
+    diff_op(op_type type, stree_* target, const iterator& position, stree_* subtree)
+        : _type(type), _target(target), _position(position), _subtree(subtree) {}
+};
+
+/*
+    stree_diffの結果。_opsを前から順に適用すると古いツリーが新しいツリーと同じになる。
+*/
+template<typename ENUMTYPE>
+struct diff_script
+{
+    using stree_ = stree<ENUMTYPE>;
+
+    std::vector<diff_op<ENUMTYPE>> _ops;
+
+    bool empty() const { return _ops.empty(); }
+    size_t size() const { return _ops.size(); }
+
+    /*
+        diffを取った古いツリーにその場で適用する。ルートが差し替わる事があるのでrootは更新される。
+        _subtreeはツリーに移るので、適用は一度だけ。
+    */
+    void apply(stree_*& root)
+    {
+        for (auto& op : _ops)
+        {
+            switch(op._type)
+            {
+                case diff_op<ENUMTYPE>::insert:
+                {
+                    auto pos = op._position;
+                    pos.chain(op._subtree.release());
+                    break;
+                }
+                case diff_op<ENUMTYPE>::erase:
+                    retire(op._target->begin().unchain());
+                    break;
+                case diff_op<ENUMTYPE>::replace:
+                {
+                    auto newNode = op._subtree.release();
+                    auto old = op._target->begin().replace(newNode);
+                    if (old.get() == root)
+                        root = newNode;
+                    retire(old.release());
+                    break;
+                }
+                case diff_op<ENUMTYPE>::move:
+                {
+                    auto node = op._target->begin().unchain();
+                    auto pos = op._position;
+                    pos.chain(node);
+                    break;
+                }
+            }
+        }
+    }
+};
+
+/*
+    oldTreeをnewTreeにする編集スクリプトを作る。どちらのツリーも変更しない。
+
+    auto script = stree_diff(*oldRoot, *newRoot);
+    script.apply(oldRoot);
+
+    最初に両方のツリーの全サブツリーのハッシュを求め（stree_hash.hppのhash_subtrees）、ハッシュが同じサブツリーは中を見ずに同じとみなす。
+    子供の並びは、ハッシュが同じものを順に対応させ、残りを前から組にする。組のatomが同じなら中に降り、違えばreplaceにする。
+    対応した古い子供のうち、元の順番の最長増加部分列に入るものは動かさず、残りだけmoveにする。
+    insert, replaceのサブツリーはnewTreeからクローンしたもの。
+*/
+template<typename ENUMTYPE>
+diff_script<ENUMTYPE> stree_diff(stree<ENUMTYPE>& oldTree, stree<ENUMTYPE>& newTree)
+{
+    using stree_ = stree<ENUMTYPE>;
+    using op = diff_op<ENUMTYPE>;
+    using iterator = typename op::iterator;
+
+    std::unordered_map<stree_*, uint64_t> hashes;
+    auto collect = [&hashes](stree_& node, uint64_t hash, const std::string&) { hashes[&node] = hash; };
+    hash_subtrees(oldTree, collect);
+    hash_subtrees(newTree, collect);
+
+    diff_script<ENUMTYPE> script;
+    auto clone = [](stree_* node) { return node->template clone<atom_cloner<ENUMTYPE>>(); };
+    auto same_atom = [](const atom<ENUMTYPE>& a, const atom<ENUMTYPE>& b) {
+        std::string x, y;
+        atom_codec<ENUMTYPE>::write(x, a);
+        atom_codec<ENUMTYPE>::write(y, b);
+        return x == y;
+    };
+
+    if (hashes[&oldTree] == hashes[&newTree])
+        return script;
+    if (!same_atom(oldTree._data, newTree._data))
+    {
+        script._ops.emplace_back(op::replace, &oldTree, iterator(nullptr, edge_dir::leading), clone(&newTree));
+        return script;
+    }
+
+    enum match_kind { keep, modify, replace_node, insert_node };
+    struct entry
+    {
+        stree_* _new;
+        stree_* _old;
+        int _old_index;
+        match_kind _kind;
+        bool _stay;
+    };
+
+    // atomが同じでハッシュが違う組。
+    std::vector<std::pair<stree_*, stree_*>> pending { { &oldTree, &newTree } };
+    while (!pending.empty())
+    {
+        auto oldParent = pending.back().first;
+        auto newParent = pending.back().second;
+        pending.pop_back();
+
+        std::vector<stree_*> olds;
+        for (auto it = oldParent->begin_child(); it != oldParent->end_child(); it++)
+            olds.push_back(it.get_node());
+        std::vector<entry> finals;
+        for (auto it = newParent->begin_child(); it != newParent->end_child(); it++)
+            finals.push_back(entry { it.get_node(), nullptr, -1, insert_node, false });
+
+        // ハッシュが同じものを前から対応させる。
+        std::unordered_map<uint64_t, std::vector<int>> byHash;
+        for (int i = (int)olds.size() - 1; i >= 0; i--)
+            byHash[hashes[olds[i]]].push_back(i);
+        std::vector<bool> used(olds.size(), false);
+        for (auto& e : finals)
+        {
+            auto found = byHash.find(hashes[e._new]);
+            if (found == byHash.end() || found->second.empty())
+                continue;
+            e._old_index = found->second.back();
+            e._kind = keep;
+            found->second.pop_back();
+            used[e._old_index] = true;
+        }
+
+        // 残りを前から組にする。
+        size_t next = 0;
+        for (auto& e : finals)
+        {
+            if (e._kind == keep)
+                continue;
+            while (next < olds.size() && used[next])
+                next++;
+            if (next == olds.size())
+                break;
+            e._old_index = (int)next;
+            e._kind = same_atom(olds[next]->_data, e._new->_data) ? modify : replace_node;
+            used[next] = true;
+        }
+        for (auto& e : finals)
+        {
+            if (e._old_index >= 0)
+                e._old = olds[e._old_index];
+        }
+
+        // 古い順番の最長増加部分列に入るものは動かさない。
+        std::vector<int> tails, tailEntry, prevEntry(finals.size(), -1);
+        for (int i = 0; i < (int)finals.size(); i++)
+        {
+            auto idx = finals[i]._old_index;
+            if (idx < 0)
+                continue;
+            auto pos = std::lower_bound(tails.begin(), tails.end(), idx) - tails.begin();
+            if (pos == (int)tails.size())
+            {
+                tails.push_back(idx);
+                tailEntry.push_back(i);
+            }
+            else
+            {
+                tails[pos] = idx;
+                tailEntry[pos] = i;
+            }
+            prevEntry[i] = pos > 0 ? tailEntry[pos - 1] : -1;
+        }
+        for (int i = tailEntry.empty() ? -1 : tailEntry.back(); i >= 0; i = prevEntry[i])
+            finals[i]._stay = true;
+
+        for (size_t i = 0; i < olds.size(); i++)
+        {
+            if (!used[i])
+                script._ops.emplace_back(op::erase, olds[i], iterator(nullptr, edge_dir::leading), nullptr);
+        }
+
+        // 後ろから、次の兄弟の前に置いていく。
+        stree_* anchor = nullptr;
+        for (int i = (int)finals.size() - 1; i >= 0; i--)
+        {
+            auto& e = finals[i];
+            auto position = anchor != nullptr ? anchor->begin() : oldParent->begin().to_trailing();
+
+            if (e._kind == modify)
+                pending.push_back({ e._old, e._new });
+
+            if (e._kind == insert_node || (e._kind == replace_node && !e._stay))
+            {
+                if (e._old != nullptr)
+                    script._ops.emplace_back(op::erase, e._old, iterator(nullptr, edge_dir::leading), nullptr);
+                auto subtree = clone(e._new);
+                script._ops.emplace_back(op::insert, nullptr, position, subtree);
+                anchor = subtree;
+                continue;
+            }
+            if (e._kind == replace_node)
+            {
+                auto subtree = clone(e._new);
+                script._ops.emplace_back(op::replace, e._old, iterator(nullptr, edge_dir::leading), subtree);
+                anchor = subtree;
+                continue;
+            }
+            if (!e._stay)
+                script._ops.emplace_back(op::move, e._old, position, nullptr);
+            anchor = e._old;
+        }
+    }
+    return script;
+}
+
+}
+#endif
@@ -0,0 +1,219 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_HASH_HPP_
+#define _STREE_HASH_HPP_
+
+#include "symtree.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    atomのバイト列への変換。forest_lazy.hppのCODECとしても使える。
+
+    uint8_t  type
+    値       numval: uint8_t num_type, uint64_t value
+             enumval: uint64_t value
+             stringval: uint32_t size, char[size]
+    uint8_t  inline_type
+    値       inline葉がある時だけ。数値はuint64_t、文字列はuint32_t size, char[size]
+*/
+template<typename ENUMTYPE>
+struct atom_codec
+{
+    using atom_ = atom<ENUMTYPE>;
+
+    static void write(std::string& out, const atom_& value)
+    {
+        put<uint8_t>(out, (uint8_t)value._type);
+        switch(value._type)
+        {
+            case atom_::numval:
+                put<uint8_t>(out, (uint8_t)value._value._numval._type);
+                put<uint64_t>(out, value._value._numval._value);
+                break;
+            case atom_::enumval:
+                put<uint64_t>(out, (uint64_t)value._value._enumval);
+                break;
+            case atom_::stringval:
+                put_string(out, *value._value._stringval);
+                break;
+        }
+
+        put<uint8_t>(out, (uint8_t)value._inline);
+        if constexpr (atom_::inline_enabled)
+        {
+            switch(value._inline)
+            {
+                case atom_::inline_signed:
+                case atom_::inline_unsigned:
+                    put<uint64_t>(out, value.inline_num_value());
+                    break;
+                case atom_::inline_string:
+                    put_string(out, value.inline_string_value());
+                    break;
+                case atom_::no_inline:
+                    break;
+            }
+        }
+    }
+
+    static atom_ read(const char* data, size_t size)
+    {
+        UNUSED(size);
+        return read_from(data);
+    }
+
+    /*
+        dataから一つ読み、dataを読んだ分だけ進める。
+    */
+    static atom_ read_from(const char*& data)
+    {
+        auto type = (typename atom_::atom_type)get<uint8_t>(data);
+        atom_ res = read_value(type, data);
+
+        auto kind = (typename atom_::inline_type)get<uint8_t>(data);
+        if constexpr (atom_::inline_enabled)
+        {
+            switch(kind)
+            {
+                case atom_::inline_signed:
+                case atom_::inline_unsigned:
+                {
+                    auto num = get<uint64_t>(data);
+                    res.set_inline(atom_(typed_num(kind == atom_::inline_signed ? typed_num::signed_int : typed_num::unsigned_int, num)));
+                    break;
+                }
+                case atom_::inline_string:
+                    res.set_inline(atom_(get_string(data)));
+                    break;
+                case atom_::no_inline:
+                    break;
+            }
+        }
+        else
+        {
+            // inline葉を使わないENUMTYPEのデータには、inline葉は無い。
+            assert(kind == atom_::no_inline);
+            UNUSED(kind);
+        }
+        return res;
+    }
+
+private:
+    static atom_ read_value(typename atom_::atom_type type, const char*& data)
+    {
+        switch(type)
+        {
+            case atom_::numval:
+            {
+                auto ntype = (typed_num::num_type)get<uint8_t>(data);
+                return atom_(typed_num(ntype, get<uint64_t>(data)));
+            }
+            case atom_::enumval:
+                return atom_((ENUMTYPE)get<uint64_t>(data));
+            case atom_::stringval:
+                break;
+        }
+        return atom_(get_string(data));
+    }
+
+    template<typename V>
+    static void put(std::string& out, V v)
+    {
+        out.append((const char*)&v, sizeof(v));
+    }
+
+    static void put_string(std::string& out, const std::string& str)
+    {
+        put<uint32_t>(out, (uint32_t)str.size());
+        out += str;
+    }
+
+    template<typename V>
+    static V get(const char*& data)
+    {
+        V v;
+        memcpy(&v, data, sizeof(v));
+        data += sizeof(v);
+        return v;
+    }
+
+    static std::string get_string(const char*& data)
+    {
+        auto size = get<uint32_t>(data);
+        std::string res(data, size);
+        data += size;
+        return res;
+    }
+};
+
+// FNV-1a。
+inline uint64_t hash_bytes(const char* data, size_t size, uint64_t seed = 14695981039346656037ULL)
+{
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= (uint8_t)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+    ノード一つ分の中身。atomのバイト列の後に、子供の数（uint32_t）と子供のハッシュを並べたもの。
+    このバイト列のハッシュがサブツリーの構造ハッシュになる。
+*/
+template<typename ENUMTYPE>
+std::string subtree_chunk(const atom<ENUMTYPE>& data, const uint64_t* childHashes, size_t count)
+{
+    std::string res;
+    atom_codec<ENUMTYPE>::write(res, data);
+    uint32_t n = (uint32_t)count;
+    res.append((const char*)&n, sizeof(n));
+    res.append((const char*)childHashes, count * sizeof(uint64_t));
+    return res;
+}
+
+/*
+    rootの全サブツリーの構造ハッシュを求め、postorderでfn(stree<E>& node, uint64_t hash, const std::string& chunk)を呼ぶ。
+    rootのハッシュを返す。
+    同じ形と値のサブツリーは同じハッシュになる（inline葉のあるなしは区別する）。
+*/
+template<typename ENUMTYPE, typename FN>
+uint64_t hash_subtrees(stree<ENUMTYPE>& root, FN fn)
+{
+    // 子供のハッシュを積んでおき、親のtrailingでまとめて取り出す。
+    std::vector<uint64_t> stack;
+    std::vector<size_t> frames;
+    for (auto iter = root.begin(); iter != root.end(); iter++)
+    {
+        if (iter.is_leading())
+        {
+            frames.push_back(stack.size());
+            continue;
+        }
+        auto start = frames.back();
+        frames.pop_back();
+
+        auto chunk = subtree_chunk(iter.get_node()->_data, stack.data() + start, stack.size() - start);
+        auto h = hash_bytes(chunk.data(), chunk.size());
+        fn(*iter.get_node(), h, chunk);
+        stack.resize(start);
+        stack.push_back(h);
+    }
+    return stack.back();
+}
+
+template<typename ENUMTYPE>
+uint64_t stree_hash(stree<ENUMTYPE>& root)
+{
+    return hash_subtrees(root, [](stree<ENUMTYPE>&, uint64_t, const std::string&) {});
+}
+
+}
+#endif
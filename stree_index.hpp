@@ -0,0 +1,241 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_INDEX_HPP_
+#define _STREE_INDEX_HPP_
+
+#include "symtree.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    streeのノードをENUMTYPEの値ごとに引ける索引。
+    各種類のリストはドキュメント順（preorder）に並んでいるので、結果の順番は常に同じ。
+
+    索引を作るのにツリーを一回全部なめるが、その後は変更の通知（mutation_listener）を受け取り、
+    forest_iteratorのinsert, chain, unchain, erase, replace（journalのrollbackも）で変わったサブツリーの分だけ更新される。
+    位置は二分探索で探す。切り離したサブツリーは穴の後ろのノードを目印にして探す。
+    通知は同じスレッドの全てのツリーの変更で来るので、索引を作ったツリーのノードを全部集合に持っておき、それで自分のツリーか見分ける。
+
+    通知されるのは索引を作ったスレッドでの変更だけなので、ツリーはそのスレッドで変更する事。
+    compactなどforest_iteratorを通さずにノードを動かした時は、rebuild()を呼ぶ事。
+*/
+template<typename ENUMTYPE>
+struct kind_index : mutation_listener<atom<ENUMTYPE>>
+{
+    using stree_ = stree<ENUMTYPE>;
+    using siterator_ = typename stree_::iterator;
+    using atom_ = atom<ENUMTYPE>;
+    using node_list = std::vector<stree_*>;
+
+    stree_* _root;
+
+    // ENUMTYPEの値を添字にしたリスト。
+    std::vector<node_list> _lists;
+
+    // ツリーの全てのノード。通知が自分のツリーのものかをO(1)で見る為。
+    std::unordered_set<const stree_*> _members;
+
+    explicit kind_index(stree_& root) : _root(&root)
+    {
+        rebuild();
+        this->listen();
+    }
+
+    ~kind_index()
+    {
+        this->stop_listening();
+    }
+
+    kind_index(const kind_index&) = delete;
+    kind_index& operator=(const kind_index&) = delete;
+
+    void rebuild()
+    {
+        _lists.clear();
+        _members.clear();
+        add_all(collect(*_root, true));
+    }
+
+    /*
+        kindのノードをドキュメント順で返す。
+    */
+    const node_list& nodes_of(ENUMTYPE kind) const
+    {
+        static const node_list empty;
+        auto idx = static_cast<size_t>(kind);
+        return idx < _lists.size() ? _lists[idx] : empty;
+    }
+
+    size_t count(ENUMTYPE kind) const
+    {
+        return nodes_of(kind).size();
+    }
+
+    //
+    // ツリーを変更するメソッド。意味はforest_iteratorの同名のメソッドと同じで、索引は通知で更新される。
+    //
+
+    siterator_ insert(siterator_& iter, atom_&& atm)
+    {
+        return chain(iter, new stree_(std::move(atm)));
+    }
+
+    siterator_ chain(siterator_& iter, stree_* subtree)
+    {
+        return iter.chain(subtree);
+    }
+
+    stree_* unchain(siterator_& iter)
+    {
+        return iter.unchain();
+    }
+
+    /*
+        iterの指すノードをサブツリーごと削除し、次のエッジを返す。iterはleadingで無くてはいけない。
+    */
+    siterator_ erase(siterator_& iter)
+    {
+        auto next = iter.trailing_of().next_of();
+        retire(unchain(iter));
+        return next;
+    }
+
+    std::unique_ptr<stree_> replace(siterator_& iter, stree_* newNode)
+    {
+        return iter.replace(newNode);
+    }
+
+    //
+    // mutation_listener
+    //
+
+    void chained(stree_* subtree) override
+    {
+        // 前のエッジは親のleadingか兄のtrailingなので、そのノードが自分のツリーにあればつながった先も自分のツリー。
+        if (is_member(subtree->begin().prior_of().get_node()))
+            add_all(collect(*subtree, true));
+    }
+
+    void unchained(stree_* subtree, const siterator_& hole) override
+    {
+        if (is_member(subtree))
+            remove_all(collect(*subtree, false), first_after(hole));
+    }
+
+    bool erased(stree_* leaf, const siterator_& hole) override
+    {
+        if (is_member(leaf))
+            remove_all(collect(*leaf, false), first_after(hole));
+        return false;
+    }
+
+    void replaced(stree_* oldNode, stree_* newNode) override
+    {
+        if (!is_member(oldNode))
+            return;
+        if (oldNode == _root)
+            _root = newNode;
+        // 古いノードの居た場所には新しいノードがあり、まだ索引には入っていない。
+        remove_all(collect(*oldNode, false), newNode);
+        add_all(collect(*newNode, true));
+    }
+
+    bool retired(stree_*) override { return false; }
+
+private:
+    bool is_member(const stree_* node) const
+    {
+        return _members.count(node) != 0;
+    }
+
+    /*
+        holeの後で最初にleadingのエッジを持つノード。切り離したノードは索引の中でこのノードのすぐ前にある。
+        親のtrailingを上がっていくだけなので、O(深さ)。無ければnullptr。
+    */
+    static stree_* first_after(siterator_ hole)
+    {
+        while (hole.get_node() != nullptr && hole.is_trailing())
+            hole++;
+        return hole.get_node();
+    }
+
+    /*
+        サブツリーのenumのノードを種類ごとに集める。サブツリーの中ではドキュメント順になっている。
+        joinがtrueならサブツリーの全てのノードを_membersに加え、falseなら取り除く。
+    */
+    std::vector<node_list> collect(stree_& subtree, bool join)
+    {
+        std::vector<node_list> res;
+        subtree.for_each_leading([this, &res, join](siterator_& iter) {
+            if (join)
+                _members.insert(iter.get_node());
+            else
+                _members.erase(iter.get_node());
+
+            auto& data = iter.content();
+            if (data._type != atom_::enumval)
+                return;
+            auto idx = static_cast<size_t>(data._value._enumval);
+            if (idx >= res.size())
+                res.resize(idx+1);
+            res[idx].push_back(iter.get_node());
+        });
+        return res;
+    }
+
+    /*
+        サブツリーのノードはドキュメント順で連続しているので、先頭の位置を二分探索してまとめて扱える。
+        ツリーにつながっているノードにしか使えない。
+    */
+    typename node_list::iterator position_of(node_list& list, stree_* first)
+    {
+        return std::lower_bound(list.begin(), list.end(), first,
+            [](stree_* a, stree_* b) { return precedes(a, b); });
+    }
+
+    void add_all(const std::vector<node_list>& found)
+    {
+        if (found.size() > _lists.size())
+            _lists.resize(found.size());
+
+        for (auto i : irange(found.size()))
+        {
+            if (found[i].empty())
+                continue;
+            auto& list = _lists[i];
+            list.insert(position_of(list, found[i].front()), found[i].begin(), found[i].end());
+        }
+    }
+
+    /*
+        切り離したノードは、索引の中でnextの直前に並んでいる（nextがnullptrなら末尾）。
+        foundのノードはもう_membersに無いので、ツリーにあってnextより前のノードの後ろを二分探索する。
+    */
+    void remove_all(const std::vector<node_list>& found, stree_* next)
+    {
+        for (auto i : irange(found.size()))
+        {
+            if (found[i].empty())
+                continue;
+            auto& list = _lists[i];
+            auto pos = std::partition_point(list.begin(), list.end(),
+                [this, next](stree_* node) { return is_member(node) && (next == nullptr || precedes(node, next)); });
+            if (pos == list.end() || *pos != found[i].front())
+            {
+                assert(false);
+                continue;
+            }
+            assert(list.end() - pos >= (ptrdiff_t)found[i].size() && std::equal(found[i].begin(), found[i].end(), pos));
+            list.erase(pos, pos + found[i].size());
+        }
+    }
+};
+
+}
+#endif
@@ -0,0 +1,597 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_KIND_HPP_
+#define _STREE_KIND_HPP_
+
+#include "symtree.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    kind_forestのノードの種類。種類ごとにノードの大きさが違う。
+*/
+enum class node_kind : uint8_t
+{
+    enum_only,
+    num_leaf,
+    string_leaf,
+    enum_inline_num,
+    enum_inline_string
+};
+
+/*
+    kind_forestのノードの共通部分。リンクはforestと同じで、その後に種類とenumを持つ。
+    enum_onlyのノードはこれだけ。
+*/
+template<typename ENUMTYPE>
+struct kind_node
+{
+    // _edge[dir][prior_next]の順番。forestと同じ。
+    kind_node* _edge[2][2];
+    node_kind _kind;
+    uint8_t _num_type;
+    ENUMTYPE _enumval;
+
+    kind_node*& get_link(edge_dir dir, prior_next link) { return _edge[size_t(dir)][size_t(link)]; }
+    kind_node* get_link(edge_dir dir, prior_next link) const { return _edge[size_t(dir)][size_t(link)]; }
+};
+
+/*
+    数値や文字列（inline葉を含む）を持つノード。
+*/
+template<typename ENUMTYPE>
+struct kind_payload_node : kind_node<ENUMTYPE>
+{
+    union
+    {
+        uint64_t _num;
+        std::string* _string;
+    } _payload;
+};
+
+/*
+    ノードの大きさごとのプール。大きさの種類は二つだけなので、それぞれにフリーリストを持つ。
+    メモリはまとめて確保し、プールが消える時にまとめて解放する。
+*/
+class kind_node_pool
+{
+public:
+    static constexpr size_t chunk_nodes = 256;
+
+    explicit kind_node_pool(std::initializer_list<size_t> sizes)
+    {
+        for (auto size : sizes)
+            _classes.push_back(size_class { size, {}, nullptr, 0 });
+    }
+
+    ~kind_node_pool()
+    {
+        for (auto chunk : _chunks)
+            ::operator delete(chunk);
+    }
+
+    kind_node_pool(const kind_node_pool&) = delete;
+    kind_node_pool& operator=(const kind_node_pool&) = delete;
+
+    void* allocate(size_t cls)
+    {
+        auto& c = _classes[cls];
+        if (!c._free.empty())
+        {
+            auto p = c._free.back();
+            c._free.pop_back();
+            return p;
+        }
+        if (c._rest == 0)
+        {
+            c._next = static_cast<char*>(::operator new(c._size * chunk_nodes));
+            c._rest = chunk_nodes;
+            _chunks.push_back(c._next);
+        }
+        auto p = c._next;
+        c._next += c._size;
+        c._rest--;
+        return p;
+    }
+
+    void release(size_t cls, void* p) { _classes[cls]._free.push_back(p); }
+
+    size_t node_size(size_t cls) const { return _classes[cls]._size; }
+
+private:
+    struct size_class
+    {
+        size_t _size;
+        std::vector<void*> _free;
+        char* _next;
+        size_t _rest;
+    };
+
+    std::vector<size_class> _classes;
+    std::vector<char*> _chunks;
+};
+
+/*
+    kind_forestのノードの値を、atomと同じように読む為のもの。
+*/
+template<typename ENUMTYPE>
+struct kind_atom_ref
+{
+    using node_t = kind_node<ENUMTYPE>;
+    using payload_t = kind_payload_node<ENUMTYPE>;
+
+    node_t* _node;
+
+    node_kind kind() const { return _node->_kind; }
+
+    bool is_enum() const { return kind() == node_kind::enum_only || has_inline(); }
+    bool is_num() const { return kind() == node_kind::num_leaf; }
+    bool is_string() const { return kind() == node_kind::string_leaf; }
+    bool has_inline() const { return kind() == node_kind::enum_inline_num || kind() == node_kind::enum_inline_string; }
+
+    ENUMTYPE enum_value() const { assert(is_enum()); return _node->_enumval; }
+
+    // 数値の葉かinline葉の値。
+    uint64_t leaf_num() const
+    {
+        assert(kind() == node_kind::num_leaf || kind() == node_kind::enum_inline_num);
+        return payload()._num;
+    }
+
+    const std::string& leaf_string() const
+    {
+        assert(kind() == node_kind::string_leaf || kind() == node_kind::enum_inline_string);
+        return *payload()._string;
+    }
+
+    typed_num::num_type num_type() const { return (typed_num::num_type)_node->_num_type; }
+
+    atom<ENUMTYPE> to_atom() const
+    {
+        // enum_inline_*のノードは、inline葉を使うENUMTYPEの時だけできる（kind_forest::kind_ofを参照）。
+        switch(kind())
+        {
+            case node_kind::num_leaf:
+                return atom<ENUMTYPE>(typed_num(num_type(), leaf_num()));
+            case node_kind::string_leaf:
+                return atom<ENUMTYPE>(leaf_string());
+            case node_kind::enum_only:
+                break;
+            case node_kind::enum_inline_num:
+            {
+                atom<ENUMTYPE> res(_node->_enumval);
+                if constexpr (atom<ENUMTYPE>::inline_enabled)
+                    res.set_inline(atom<ENUMTYPE>(typed_num(num_type(), leaf_num())));
+                return res;
+            }
+            case node_kind::enum_inline_string:
+            {
+                atom<ENUMTYPE> res(_node->_enumval);
+                if constexpr (atom<ENUMTYPE>::inline_enabled)
+                    res.set_inline(atom<ENUMTYPE>(leaf_string()));
+                return res;
+            }
+        }
+        return atom<ENUMTYPE>(_node->_enumval);
+    }
+
+    // atomのdisplay_stringと同じ形式。stree_dumpから使われる。
+    template<typename ETOS>
+    std::string display_string() const
+    {
+        if (is_enum())
+            return "enum:" + ETOS::enum_to_str(_node->_enumval);
+        if (is_string())
+            return "string:" + leaf_string();
+        return num_string();
+    }
+
+    std::string inline_display_string() const
+    {
+        assert(has_inline());
+        if (kind() == node_kind::enum_inline_string)
+            return "string:" + leaf_string();
+        return num_string();
+    }
+
+private:
+    auto& payload() const { return static_cast<payload_t*>(_node)->_payload; }
+
+    std::string num_string() const
+    {
+        auto value = std::to_string(leaf_num());
+        return (num_type() == typed_num::signed_int ? "int:" : "uint:") + value;
+    }
+};
+
+template<typename ENUMTYPE> class kind_forest;
+
+/*
+    kind_iteratorの指すエッジ。forestのedgeと同じように使える。
+*/
+template<typename ENUMTYPE>
+struct kind_edge
+{
+    kind_node<ENUMTYPE>* _node;
+    edge_dir _direction;
+
+    bool is_leading() const { return _direction == edge_dir::leading; }
+    bool is_trailing() const { return _direction == edge_dir::trailing; }
+
+    kind_atom_ref<ENUMTYPE> operator*() const { return kind_atom_ref<ENUMTYPE> { _node }; }
+};
+
+/*
+    kind_forestのiterator。forest_iteratorと同じ規則でエッジを回る。
+*/
+template<typename ENUMTYPE>
+class kind_iterator : public iterator_facade<kind_iterator<ENUMTYPE>, kind_edge<ENUMTYPE>>
+{
+    using node_t = kind_node<ENUMTYPE>;
+    static const auto next = prior_next::next;
+    static const auto prior = prior_next::prior;
+    static const auto leading = edge_dir::leading;
+    static const auto trailing = edge_dir::trailing;
+
+    kind_forest<ENUMTYPE>* _forest;
+
+    void set_next(kind_iterator& y)
+    {
+        if (get_node() != nullptr)
+            get_node()->get_link(_edge._direction, next) = y.get_node();
+        if (y.get_node() != nullptr)
+            y.get_node()->get_link(y._edge._direction, prior) = get_node();
+    }
+
+public:
+    kind_edge<ENUMTYPE> _edge;
+
+    kind_iterator(kind_forest<ENUMTYPE>* forest, node_t* node, edge_dir dir) : _forest(forest), _edge { node, dir } {}
+
+    node_t* get_node() const { return _edge._node; }
+    kind_atom_ref<ENUMTYPE> content() const { return *_edge; }
+
+    bool equal(const kind_iterator& other) const { return _edge._node == other._edge._node && _edge._direction == other._edge._direction; }
+
+    kind_edge<ENUMTYPE>& dereference() { return _edge; }
+    const kind_edge<ENUMTYPE>& dereference() const { return _edge; }
+
+    // forest_iterator::incrementと同じ。
+    void increment()
+    {
+        auto nextNode = get_node()->get_link(_edge._direction, next);
+        if (_edge.is_leading())
+            _edge._direction = (nextNode == get_node() ? trailing : leading);
+        else if (nextNode != nullptr)
+            _edge._direction = (nextNode->get_link(leading, prior) == get_node() ? leading : trailing);
+        _edge._node = nextNode;
+    }
+
+    // forest_iterator::decrementと同じ。end()から--は出来ない。
+    void decrement()
+    {
+        auto prev = get_node()->get_link(_edge._direction, prior);
+        if (_edge.is_leading())
+            _edge._direction = (prev != nullptr && prev->get_link(trailing, next) == get_node() ? trailing : leading);
+        else
+            _edge._direction = (prev == get_node() ? leading : trailing);
+        _edge._node = prev;
+    }
+
+    kind_iterator& to_trailing() { _edge._direction = trailing; return *this; }
+    kind_iterator& to_leading() { _edge._direction = leading; return *this; }
+    kind_iterator next_of() const { auto res = *this; res++; return res; }
+    kind_iterator prior_of() const { auto res = *this; res--; return res; }
+
+    bool is_leading() const { return _edge.is_leading(); }
+    bool is_trailing() const { return _edge.is_trailing(); }
+
+    bool has_children() const
+    {
+        auto res = *this;
+        res.to_leading();
+        return get_node() != res.next_of().get_node();
+    }
+
+    /*
+        現在のエッジにvalueのノードを挿入する。挿入のルールはforest_iterator::insertと同じ。
+    */
+    kind_iterator insert(const atom<ENUMTYPE>& value)
+    {
+        kind_iterator result(_forest, _forest->make_node(value), leading);
+        auto prev = prior_of();
+        auto newTrail = result;
+        newTrail.to_trailing();
+        prev.set_next(result);
+        newTrail.set_next(*this);
+        return result;
+    }
+
+    /*
+        葉を削除し、次の有効なiteratorを返す。詳細はforest_iterator::eraseを参照。
+    */
+    kind_iterator erase()
+    {
+        assert(!has_children());
+        auto leadingPrior = *this;
+        leadingPrior.to_leading();
+        leadingPrior--;
+        auto trailingNext = *this;
+        trailingNext.to_trailing();
+        trailingNext++;
+
+        leadingPrior.set_next(trailingNext);
+        _forest->free_node(get_node());
+        return is_leading() ? leadingPrior.next_of() : trailingNext;
+    }
+};
+
+/*
+    ノードの大きさがノードの種類で変わるstree。
+
+    kind_forest<sym> packed(*root);          // streeからコピー
+    stree_dump<sym, formatter>(packed);      // streeと同じように回れる
+    auto tree = packed.to_stree();           // streeに戻す
+
+    forest<atom<E>>のノードは、enumだけのノードでもatomの一番大きい場合（数値とinline葉）の分の大きさがある。
+    kind_forestではenumだけのノードはリンクとenumだけ、数値や文字列の葉とinline葉を持つノードはその後に8byteを足した大きさになる。
+    ノードは大きさごとのプールから取り、kind_forestが消える時にまとめて解放する。
+
+    一つのkind_forestは一つのツリーを持つ。変更はinsertと葉のeraseだけ。accessorの型で読む時はkind_accessorを使う。
+*/
+template<typename ENUMTYPE>
+class kind_forest
+{
+public:
+    using node_t = kind_node<ENUMTYPE>;
+    using payload_t = kind_payload_node<ENUMTYPE>;
+    using iterator = kind_iterator<ENUMTYPE>;
+
+    explicit kind_forest(stree<ENUMTYPE>& src) : _pool({ sizeof(node_t), sizeof(payload_t) })
+    {
+        _root = make_node(src._data);
+        auto cur = begin().to_trailing();
+        for (auto iter = src.begin().next_of(); iter != src.end(); iter++)
+        {
+            if (iter.is_leading())
+                cur = cur.insert(iter.get_node()->_data).to_trailing();
+            else
+                cur++;
+        }
+    }
+
+    ~kind_forest()
+    {
+        std::vector<node_t*> nodes;
+        for (auto iter = begin(); iter != end(); iter++)
+        {
+            if (iter.is_leading())
+                nodes.push_back(iter.get_node());
+        }
+        for (auto node : nodes)
+            destroy_payload(node);
+    }
+
+    kind_forest(const kind_forest&) = delete;
+    kind_forest& operator=(const kind_forest&) = delete;
+
+    iterator begin() { return iterator(this, _root, edge_dir::leading); }
+    iterator end() { return iterator(this, _root, edge_dir::trailing).next_of(); }
+
+    node_t* root() const { return _root; }
+
+    // 生きているノードの数と、その大きさの合計。
+    size_t size() const { return _count; }
+    size_t node_bytes() const { return _bytes; }
+
+    /*
+        streeとしてコピーする。返されたツリーの寿命は呼び出し側が管理する。
+    */
+    stree<ENUMTYPE>* to_stree()
+    {
+        auto res = new stree<ENUMTYPE>(kind_atom_ref<ENUMTYPE> { _root }.to_atom());
+        auto cur = res->begin().to_trailing();
+        for (auto iter = begin().next_of(); iter != end(); iter++)
+        {
+            if (iter.is_leading())
+                cur = cur.insert(iter.content().to_atom()).to_trailing();
+            else
+                cur++;
+        }
+        return res;
+    }
+
+    /*
+        valueに合った大きさの単独のノードを作る。
+    */
+    node_t* make_node(const atom<ENUMTYPE>& value)
+    {
+        auto kind = kind_of(value);
+        auto cls = size_class(kind);
+        auto node = static_cast<node_t*>(cls == 0 ? ::new(_pool.allocate(cls)) node_t : ::new(_pool.allocate(cls)) payload_t);
+        node->get_link(edge_dir::leading, prior_next::next) = node;
+        node->get_link(edge_dir::trailing, prior_next::prior) = node;
+        node->get_link(edge_dir::leading, prior_next::prior) = nullptr;
+        node->get_link(edge_dir::trailing, prior_next::next) = nullptr;
+        node->_kind = kind;
+        node->_num_type = typed_num::signed_int;
+        node->_enumval = ENUMTYPE();
+
+        auto payload = [node]() -> auto& { return static_cast<payload_t*>(node)->_payload; };
+        switch(kind)
+        {
+            case node_kind::enum_only:
+                node->_enumval = value._value._enumval;
+                break;
+            case node_kind::num_leaf:
+                node->_num_type = value._value._numval._type;
+                payload()._num = value._value._numval._value;
+                break;
+            case node_kind::string_leaf:
+                payload()._string = new std::string(*value._value._stringval);
+                break;
+            case node_kind::enum_inline_num:
+                node->_enumval = value._value._enumval;
+                node->_num_type = value._inline == atom<ENUMTYPE>::inline_signed ? typed_num::signed_int : typed_num::unsigned_int;
+                if constexpr (atom<ENUMTYPE>::inline_enabled)
+                    payload()._num = value.inline_num_value();
+                break;
+            case node_kind::enum_inline_string:
+                node->_enumval = value._value._enumval;
+                if constexpr (atom<ENUMTYPE>::inline_enabled)
+                    payload()._string = new std::string(value.inline_string_value());
+                break;
+        }
+        _count++;
+        _bytes += _pool.node_size(cls);
+        return node;
+    }
+
+    void free_node(node_t* node)
+    {
+        destroy_payload(node);
+        auto cls = size_class(node->_kind);
+        _count--;
+        _bytes -= _pool.node_size(cls);
+        _pool.release(cls, node);
+    }
+
+    static node_kind kind_of(const atom<ENUMTYPE>& value)
+    {
+        switch(value._type)
+        {
+            case atom<ENUMTYPE>::numval:
+                return node_kind::num_leaf;
+            case atom<ENUMTYPE>::stringval:
+                return node_kind::string_leaf;
+            case atom<ENUMTYPE>::enumval:
+                break;
+        }
+        switch(value._inline)
+        {
+            case atom<ENUMTYPE>::inline_signed:
+            case atom<ENUMTYPE>::inline_unsigned:
+                return node_kind::enum_inline_num;
+            case atom<ENUMTYPE>::inline_string:
+                return node_kind::enum_inline_string;
+            case atom<ENUMTYPE>::no_inline:
+                break;
+        }
+        return node_kind::enum_only;
+    }
+
+private:
+    kind_node_pool _pool;
+    node_t* _root;
+    size_t _count = 0;
+    size_t _bytes = 0;
+
+    static size_t size_class(node_kind kind) { return kind == node_kind::enum_only ? 0 : 1; }
+
+    static void destroy_payload(node_t* node)
+    {
+        if (node->_kind == node_kind::string_leaf || node->_kind == node_kind::enum_inline_string)
+            delete static_cast<payload_t*>(node)->_payload._string;
+    }
+};
+
+template<typename ACC>
+struct kind_accessor;
+
+/*
+    kind_accessorの各フィールドの型と値。数値は値、文字列は参照、streeはkind_iterator、入れ子のaccessorはkind_accessorになる。
+    inline葉の時はiterは親のノードを指し、kind_atom_refがinline葉の値を読む。
+*/
+template<typename EN, typename T>
+struct _kind_field
+{
+    using type = T;
+    static type value(const kind_iterator<EN>& iter) { return (T)iter.content().leaf_num(); }
+};
+
+template<typename EN>
+struct _kind_field<EN, std::string>
+{
+    using type = const std::string&;
+    static type value(const kind_iterator<EN>& iter) { return iter.content().leaf_string(); }
+};
+
+template<typename EN>
+struct _kind_field<EN, stree<EN>>
+{
+    using type = kind_iterator<EN>;
+    static type value(const kind_iterator<EN>& iter) { return iter; }
+};
+
+template<typename EN, EN eid, typename... CHLDS>
+struct _kind_field<EN, accessor<EN, eid, CHLDS...>>
+{
+    using type = kind_accessor<accessor<EN, eid, CHLDS...>>;
+    static type value(const kind_iterator<EN>& iter) { return type(iter); }
+};
+
+/*
+    kind_forestのノードをaccessorと同じ型で読む為のもの。streeにコピーせずに読める。
+
+    kind_accessor<let_op> let(packed.begin());
+    auto name = get<0>(get<0>(let));        // 文字列はconst std::string&
+    kind_accessor<int_imm> imm(get<1>(let)); // streeのフィールドはkind_iterator
+
+    チェックはaccessorと同じで、種類と型はassertでだけ見る。
+*/
+template<typename ENUMTYPE, ENUMTYPE eid, typename... CHLDS>
+struct kind_accessor<accessor<ENUMTYPE, eid, CHLDS...>>
+{
+    kind_iterator<ENUMTYPE> _target;
+
+    explicit kind_accessor(const kind_iterator<ENUMTYPE>& target) : _target(target)
+    {
+        assert(_target.content().is_enum());
+        assert(_target.content().enum_value() == eid);
+        _target.to_leading();
+    }
+
+    // accessor::nth_childと同じく、inline葉は0番目の子供で、ノード自身を指す。
+    kind_iterator<ENUMTYPE> nth_child(size_t nth) const
+    {
+        if (_target.content().has_inline())
+        {
+            if (nth == 0)
+                return _target;
+            nth--;
+        }
+        auto child = _target.next_of();
+        for (; nth > 0; nth--)
+            child.to_trailing()++;
+        assert(child.is_leading());
+        return child;
+    }
+};
+
+template<size_t IDX, typename ENUMTYPE, ENUMTYPE eid, typename... TP>
+typename _kind_field<ENUMTYPE, typename select<IDX, TP...>::type>::type
+get(const kind_accessor<accessor<ENUMTYPE, eid, TP...>>& ac)
+{
+    using type = typename select<IDX, TP...>::type;
+    auto target = ac.nth_child(IDX);
+    // inline葉にはノードが無い。streeで受け取るならexpand_inline_leavesで戻してからkind_forestにする事。
+    if constexpr (std::is_same<type, stree<ENUMTYPE>>::value)
+    {
+        if (target.get_node() == ac._target.get_node())
+        {
+            assert(false);
+            throw std::runtime_error("stree field refers to an inline leaf");
+        }
+    }
+    return _kind_field<ENUMTYPE, type>::value(target);
+}
+
+}
+#endif
@@ -0,0 +1,234 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_LITERAL_HPP_
+#define _STREE_LITERAL_HPP_
+
+#include "symtree.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace symtree
+{
+
+/*
+    stree_literalの一つのノード。preorderで並べ、_sizeにサブツリーのノード数（自分を含む）を持つ。
+*/
+template<typename ENUMTYPE>
+struct literal_entry
+{
+    using atom_type = typename atom<ENUMTYPE>::atom_type;
+
+    atom_type _type = atom<ENUMTYPE>::enumval;
+    ENUMTYPE _enumval = ENUMTYPE();
+    typed_num::num_type _num_type = typed_num::signed_int;
+    uint64_t _num = 0;
+    const char* _string = nullptr;
+    size_t _size = 1;
+
+    atom<ENUMTYPE> to_atom() const
+    {
+        switch(_type)
+        {
+            case atom<ENUMTYPE>::enumval:
+                return atom<ENUMTYPE>(_enumval);
+            case atom<ENUMTYPE>::numval:
+                return atom<ENUMTYPE>(typed_num(_num_type, _num));
+            case atom<ENUMTYPE>::stringval:
+                break;
+        }
+        return atom<ENUMTYPE>(std::string(_string));
+    }
+
+    bool matches(const atom<ENUMTYPE>& value) const
+    {
+        if (_type != value._type)
+            return false;
+        switch(_type)
+        {
+            case atom<ENUMTYPE>::enumval:
+                return _enumval == value._value._enumval;
+            case atom<ENUMTYPE>::numval:
+                return _num_type == value._value._numval._type && _num == value._value._numval._value;
+            case atom<ENUMTYPE>::stringval:
+                break;
+        }
+        return *value._value._stringval == _string;
+    }
+};
+
+/*
+    コンパイル時に作るstree。ノードはpreorderで_entriesに並ぶ。tree_litで作る。
+
+    static constexpr auto pattern = tree_lit(sym::add, tree_lit(sym::variable, "x"), tree_lit(sym::int_imm, 5));
+    auto root = pattern.instantiate();   // forestを作る
+    pattern.equals(*root);               // 作らずに比べる
+
+    constexprの変数にすれば静的領域に置かれるので、起動時に何も組み立てない。
+    文字列は文字列リテラルを指すだけなので、静的な寿命の文字列しか使えない。
+*/
+template<typename ENUMTYPE, size_t N>
+struct stree_literal
+{
+    literal_entry<ENUMTYPE> _entries[N];
+
+    static constexpr size_t size() { return N; }
+
+    constexpr const literal_entry<ENUMTYPE>& operator[](size_t i) const { return _entries[i]; }
+
+    /*
+        iの子供をたどる。
+        for (auto c = lit.first_child(i); c != lit.end_of(i); c = lit.next_of(c))
+    */
+    constexpr size_t first_child(size_t i) const { return i + 1; }
+    constexpr size_t end_of(size_t i) const { return i + _entries[i]._size; }
+    constexpr size_t next_of(size_t i) const { return i + _entries[i]._size; }
+
+    /*
+        forestとして作る。返されたツリーの寿命は呼び出し側が管理する。
+    */
+    stree<ENUMTYPE>* instantiate() const
+    {
+        auto root = new stree<ENUMTYPE>(_entries[0].to_atom());
+        auto cur = root->begin().to_trailing();
+        size_t ends[N];
+        size_t depth = 0;
+        ends[depth++] = N;
+        for (size_t i = 1; i < N; i++)
+        {
+            while (ends[depth - 1] == i)
+            {
+                depth--;
+                cur++;
+            }
+            cur = cur.insert(_entries[i].to_atom()).to_trailing();
+            ends[depth++] = end_of(i);
+        }
+        return root;
+    }
+
+    /*
+        treeと同じ形と値ならtrue。treeのinline葉は0番目の子供として比べる。
+    */
+    bool equals(stree<ENUMTYPE>& tree) const
+    {
+        return equals_at(0, tree);
+    }
+
+private:
+    bool equals_at(size_t i, stree<ENUMTYPE>& node) const
+    {
+        auto& data = node._data;
+        if (!_entries[i].matches(data))
+            return false;
+
+        auto c = first_child(i);
+        if constexpr (atom<ENUMTYPE>::inline_enabled)
+        {
+            if (data.has_inline())
+            {
+                if (c == end_of(i) || !matches_inline(_entries[c], data))
+                    return false;
+                c = next_of(c);
+            }
+        }
+        for (auto it = node.begin_child(); it != node.end_child(); it++)
+        {
+            if (c == end_of(i) || !equals_at(c, *it.get_node()))
+                return false;
+            c = next_of(c);
+        }
+        return c == end_of(i);
+    }
+
+    static bool matches_inline(const literal_entry<ENUMTYPE>& entry, atom<ENUMTYPE>& data)
+    {
+        if (entry._size != 1 || entry._type != data.inline_atom_type())
+            return false;
+        if (entry._type == atom<ENUMTYPE>::stringval)
+            return data.inline_string_value() == entry._string;
+        return entry._num_type == data.inline_num_type() && entry._num == data.inline_num_value();
+    }
+};
+
+template<typename ARG>
+struct literal_size
+{
+    static constexpr size_t value = 1;
+};
+
+template<typename ENUMTYPE, size_t N>
+struct literal_size<stree_literal<ENUMTYPE, N>>
+{
+    static constexpr size_t value = N;
+};
+
+/*
+    tree_litの子供に書けるもの。サブツリーのリテラル、enum、数値、文字列リテラル。
+*/
+template<typename ENUMTYPE, size_t N>
+constexpr const stree_literal<ENUMTYPE, N>& to_literal(const stree_literal<ENUMTYPE, N>& lit) { return lit; }
+
+template<typename ENUMTYPE>
+constexpr stree_literal<ENUMTYPE, 1> to_literal(ENUMTYPE sym)
+{
+    stree_literal<ENUMTYPE, 1> res {};
+    res._entries[0]._enumval = sym;
+    return res;
+}
+
+template<typename ENUMTYPE>
+constexpr stree_literal<ENUMTYPE, 1> to_literal(int val)
+{
+    stree_literal<ENUMTYPE, 1> res {};
+    res._entries[0]._type = atom<ENUMTYPE>::numval;
+    res._entries[0]._num = (uint64_t)(int64_t)val;
+    return res;
+}
+
+template<typename ENUMTYPE>
+constexpr stree_literal<ENUMTYPE, 1> to_literal(unsigned int val)
+{
+    stree_literal<ENUMTYPE, 1> res {};
+    res._entries[0]._type = atom<ENUMTYPE>::numval;
+    res._entries[0]._num_type = typed_num::unsigned_int;
+    res._entries[0]._num = val;
+    return res;
+}
+
+template<typename ENUMTYPE>
+constexpr stree_literal<ENUMTYPE, 1> to_literal(const char* str)
+{
+    stree_literal<ENUMTYPE, 1> res {};
+    res._entries[0]._type = atom<ENUMTYPE>::stringval;
+    res._entries[0]._string = str;
+    return res;
+}
+
+template<typename ENUMTYPE, size_t N, size_t M>
+constexpr void append_literal(stree_literal<ENUMTYPE, N>& dest, size_t& pos, const stree_literal<ENUMTYPE, M>& src)
+{
+    for (size_t i = 0; i < M; i++)
+        dest._entries[pos + i] = src._entries[i];
+    pos += M;
+}
+
+/*
+    symのノードに、childrenを子供として付けたリテラルを作る。
+    tree_lit(sym::int_imm, 3) は int(3) のツリーになる。
+*/
+template<typename ENUMTYPE, typename... ARGS>
+constexpr auto tree_lit(ENUMTYPE sym, const ARGS&... children)
+{
+    constexpr size_t size = 1 + (0 + ... + literal_size<ARGS>::value);
+    stree_literal<ENUMTYPE, size> res {};
+    res._entries[0]._enumval = sym;
+    res._entries[0]._size = size;
+    size_t pos = 1;
+    (append_literal(res, pos, to_literal<ENUMTYPE>(children)), ...);
+    UNUSED(pos);
+    return res;
+}
+
+}
+#endif
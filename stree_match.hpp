@@ -0,0 +1,398 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_MATCH_HPP_
+#define _STREE_MATCH_HPP_
+
+#include "symtree.hpp"
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <vector>
+
+namespace symtree
+{
+
+//
+// 型リスト関連
+//
+
+template<typename... Ts>
+struct type_list
+{
+    static constexpr size_t size = sizeof...(Ts);
+};
+
+template<typename L, typename T>
+struct tl_index;
+
+template<typename T, typename... RESTs>
+struct tl_index<type_list<T, RESTs...>, T> : std::integral_constant<size_t, 0> {};
+
+template<typename T, typename U, typename... RESTs>
+struct tl_index<type_list<U, RESTs...>, T> : std::integral_constant<size_t, 1 + tl_index<type_list<RESTs...>, T>::value> {};
+
+template<typename L, typename T>
+struct tl_contains;
+
+template<typename T>
+struct tl_contains<type_list<>, T> : std::false_type {};
+
+template<typename T, typename U, typename... RESTs>
+struct tl_contains<type_list<U, RESTs...>, T>
+    : std::integral_constant<bool, std::is_same<T, U>::value || tl_contains<type_list<RESTs...>, T>::value> {};
+
+// Lに無い時だけTを末尾に追加する。
+template<typename L, typename T, bool = tl_contains<L, T>::value>
+struct tl_append_unique
+{
+    using type = L;
+};
+
+template<typename... Ts, typename T>
+struct tl_append_unique<type_list<Ts...>, T, false>
+{
+    using type = type_list<Ts..., T>;
+};
+
+
+//
+// パターンの平坦化
+//
+
+/*
+    パターンに出てくるaccessorを、入れ子の中身まで含めて重複無しで並べる。
+    子供のaccessorが先に並ぶ。accessor以外（stree, int64_t, std::stringなど）は何も追加しない。
+*/
+template<typename L, typename... Ts>
+struct _collect_patterns
+{
+    using type = L;
+};
+
+template<typename L, typename T, typename... RESTs>
+struct _collect_patterns<L, T, RESTs...>
+{
+    using type = typename _collect_patterns<L, RESTs...>::type;
+};
+
+template<typename L, typename EN, EN eid, typename... CHLDS, typename... RESTs>
+struct _collect_patterns<L, accessor<EN, eid, CHLDS...>, RESTs...>
+{
+    using with_children = typename _collect_patterns<L, CHLDS...>::type;
+    using with_self = typename tl_append_unique<with_children, accessor<EN, eid, CHLDS...>>::type;
+    using type = typename _collect_patterns<with_self, RESTs...>::type;
+};
+
+
+/*
+    マッチャーのスタックに積まれる、マッチ済みのノード。
+    stateのi番目のビットが立っていたら、平坦化したi番目のパターンにマッチしている。
+    _inlineがtrueの時は_nodeのinline葉を表す（stateは常に空）。
+*/
+template<typename EN, size_t N>
+struct _match_entry
+{
+    stree<EN>* _node;
+    std::bitset<N> _state;
+    bool _inline = false;
+
+    typename atom<EN>::atom_type leaf_type() const
+    {
+        if constexpr (atom<EN>::inline_enabled)
+            if (_inline)
+                return _node->_data.inline_atom_type();
+        return _node->_data._type;
+    }
+};
+
+/*
+    子供一つがパターンの要素にマッチするかを調べる。
+    stree<EN>はワイルドカード（ノードの無いinline葉にはマッチしない）、int64_t, uint64_t, std::stringは葉の型だけを見る。
+*/
+template<typename EN, typename FLAT, typename CHLD>
+struct _child_matcher
+{
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>& ent)
+    {
+        return !ent._inline;
+    }
+};
+
+template<typename EN, typename FLAT>
+struct _child_matcher<EN, FLAT, int64_t>
+{
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>& ent) { return ent.leaf_type() == atom<EN>::numval; }
+};
+
+template<typename EN, typename FLAT>
+struct _child_matcher<EN, FLAT, uint64_t>
+{
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>& ent) { return ent.leaf_type() == atom<EN>::numval; }
+};
+
+template<typename EN, typename FLAT>
+struct _child_matcher<EN, FLAT, std::string>
+{
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>& ent) { return ent.leaf_type() == atom<EN>::stringval; }
+};
+
+template<typename EN, typename FLAT, EN eid, typename... CHLDS>
+struct _child_matcher<EN, FLAT, accessor<EN, eid, CHLDS...>>
+{
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>& ent)
+    {
+        return ent._state[tl_index<FLAT, accessor<EN, eid, CHLDS...>>::value];
+    }
+};
+
+/*
+    平坦化したパターン一つ分の判定。ノードの種類は呼び出し側でチェック済み。
+    子供の数が一致して、各子供が要素にマッチすればマッチ。
+*/
+template<typename EN, typename FLAT, typename ACC>
+struct _pattern_matcher;
+
+template<typename EN, typename FLAT, EN eid, typename... CHLDS>
+struct _pattern_matcher<EN, FLAT, accessor<EN, eid, CHLDS...>>
+{
+    static constexpr EN kind = eid;
+
+    template<size_t N>
+    static bool match(const _match_entry<EN, N>* children, size_t count)
+    {
+        if (count != sizeof...(CHLDS))
+            return false;
+        return match_children(children, std::make_index_sequence<sizeof...(CHLDS)>());
+    }
+
+private:
+    template<size_t N, size_t... IDX>
+    static bool match_children(const _match_entry<EN, N>* children, std::index_sequence<IDX...>)
+    {
+        bool res = true;
+        // 展開用のダミー配列。先頭の0は子供が居ないパターンの為。
+        bool dummy[] = { true, (res = res && _child_matcher<EN, FLAT, CHLDS>::match(children[IDX]))... };
+        UNUSED(dummy);
+        return res;
+    }
+};
+
+
+/*
+    ノード一つがパターン一つにマッチするかを、サブツリーを直接たどって調べる。
+    ツリー全体では無く、特定のノードだけを調べ直したい時に使う（tree_matcherと同じ規則）。
+    match_inlineは、親のatomの持つinline葉が要素にマッチするかを調べる。
+    streeの要素はノードを受け取る所なので、ノードの無いinline葉にはマッチしない（expand_inline_leavesで戻してから使う）。
+*/
+template<typename EN, typename T>
+struct _shape_matcher
+{
+    static bool match(stree<EN>&) { return true; }
+    static bool match_inline(const atom<EN>&) { return false; }
+};
+
+template<typename EN>
+struct _shape_matcher<EN, int64_t>
+{
+    static bool match(stree<EN>& node) { return node._data._type == atom<EN>::numval; }
+    static bool match_inline(const atom<EN>& parent) { return parent.inline_atom_type() == atom<EN>::numval; }
+};
+
+template<typename EN>
+struct _shape_matcher<EN, uint64_t> : _shape_matcher<EN, int64_t> {};
+
+template<typename EN>
+struct _shape_matcher<EN, std::string>
+{
+    static bool match(stree<EN>& node) { return node._data._type == atom<EN>::stringval; }
+    static bool match_inline(const atom<EN>& parent) { return parent.inline_atom_type() == atom<EN>::stringval; }
+};
+
+template<typename EN, EN eid, typename... CHLDS>
+struct _shape_matcher<EN, accessor<EN, eid, CHLDS...>>
+{
+    static bool match(stree<EN>& node)
+    {
+        if (node._data._type != atom<EN>::enumval || node._data._value._enumval != eid)
+            return false;
+
+        // 子供を一回だけたどる。inline葉があればそれが最初の子供。
+        auto iter = node.begin_child();
+        auto end = node.end_child();
+        bool inl = node._data.has_inline();
+        bool res = true;
+        bool dummy[] = { true, (res = res && match_child<CHLDS>(node, inl, iter, end))... };
+        UNUSED(dummy);
+        return res && !inl && iter == end;
+    }
+
+    // inline葉は数値か文字列なので、accessorにはマッチしない。
+    static bool match_inline(const atom<EN>&) { return false; }
+
+private:
+    template<typename CHLD>
+    static bool match_child(stree<EN>& node, bool& inl, child_iterator<atom<EN>>& iter, const child_iterator<atom<EN>>& end)
+    {
+        if constexpr (atom<EN>::inline_enabled)
+        {
+            if (inl)
+            {
+                inl = false;
+                return _shape_matcher<EN, CHLD>::match_inline(node._data);
+            }
+        }
+        return iter != end && _shape_matcher<EN, CHLD>::match(*(iter++).get_node());
+    }
+};
+
+template<typename ACC, typename EN>
+bool matches(stree<EN>& node)
+{
+    return _shape_matcher<EN, ACC>::match(node);
+}
+
+/*
+    パターンの入れ子の深さ。accessor一段で1、ワイルドカードや葉は0。
+    あるノードのマッチ結果は、そのノードからこの深さまでの子孫（一番下は種類と数だけ）にしか依存しない。
+*/
+template<typename T>
+struct pattern_depth : std::integral_constant<size_t, 0> {};
+
+template<typename EN, EN eid, typename... CHLDS>
+struct pattern_depth<accessor<EN, eid, CHLDS...>>
+    : std::integral_constant<size_t, 1 + std::max({ (size_t)0, pattern_depth<CHLDS>::value... })> {};
+
+
+/*
+    accessorで書いた複数のパターンを一回のツリーの走査でまとめてマッチするマッチャー。
+
+    using matcher = tree_matcher<test_sym, add_op, let_op>;
+    matcher m;
+    m.match(root, [](size_t pattern, ttree& node) { ... });
+
+    パターンは入れ子のaccessorを含んでも良い。streeはワイルドカードで何にでもマッチする。
+    accessorと違い、子供の数がパターンと一致しないとマッチしない。
+
+    入れ子も含めた全accessorを平坦化し、各ノードについて「どのaccessorにマッチしたか」をビットで持つボトムアップのツリーオートマトンとして動く。
+    ノードのtrailingで、子供たちのビットとノードの種類だけを見てノードのビットを決めるので、nth_childで子供をたどり直す事は無い。
+    ノードの種類ごとに調べるべきパターンの表をコンストラクタで作っておく。
+    inline葉は、ノードのleadingで最初の子供としてスタックに積む。
+*/
+template<typename ENUMTYPE, typename... PATTERNS>
+struct tree_matcher
+{
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+    using flat_patterns = typename _collect_patterns<type_list<>, PATTERNS...>::type;
+    static constexpr size_t flat_size = flat_patterns::size;
+    using entry = _match_entry<ENUMTYPE, flat_size>;
+    using match_fn = bool (*)(const entry*, size_t);
+
+    // ENUMTYPEの値を添字にした、調べるべき平坦化済みパターンの番号の表。
+    std::vector<std::vector<size_t>> _by_kind;
+
+    // 平坦化済みパターンの番号を添字にした、判定関数とPATTERNSの何番目か（PATTERNSに無い場合は-1）。
+    std::array<match_fn, flat_size> _matchers;
+    std::array<int, flat_size> _top_index;
+
+    tree_matcher()
+    {
+        init(flat_patterns());
+    }
+
+    /*
+        rootの中でPATTERNSのどれかにマッチしたノードごとに fn(size_t patternIndex, stree_& node) を呼ぶ。
+        patternIndexはPATTERNSの何番目か。呼ばれる順番はpostorder（子供が先）。
+    */
+    template<typename FN>
+    void match(stree_& root, FN fn) const
+    {
+        std::vector<entry> stack;
+        std::vector<size_t> frames;
+
+        for (auto iter = root.begin(); iter != root.end(); iter++)
+        {
+            if (iter.is_leading())
+            {
+                frames.push_back(stack.size());
+                if (iter.get_node()->_data.has_inline())
+                    stack.push_back(entry { iter.get_node(), std::bitset<flat_size>(), true });
+                continue;
+            }
+
+            auto start = frames.back();
+            frames.pop_back();
+
+            entry ent { iter.get_node(), std::bitset<flat_size>() };
+            auto& data = ent._node->_data;
+            if (data._type == atom_::enumval)
+            {
+                auto kind = static_cast<size_t>(data._value._enumval);
+                if (kind < _by_kind.size())
+                {
+                    for (auto i : _by_kind[kind])
+                    {
+                        if (_matchers[i](stack.data() + start, stack.size() - start))
+                            ent._state.set(i);
+                    }
+                }
+            }
+            stack.resize(start);
+
+            if (ent._state.any())
+            {
+                for (auto i : irange(flat_size))
+                {
+                    if (ent._state[i] && _top_index[i] >= 0)
+                        fn((size_t)_top_index[i], *ent._node);
+                }
+            }
+            stack.push_back(ent);
+        }
+    }
+
+    /*
+        マッチしたノードをPATTERNSの順に分けて返す。各リストはpostorder。
+    */
+    std::array<std::vector<stree_*>, sizeof...(PATTERNS)> match_all(stree_& root) const
+    {
+        std::array<std::vector<stree_*>, sizeof...(PATTERNS)> res;
+        match(root, [&res](size_t pattern, stree_& node) { res[pattern].push_back(&node); });
+        return res;
+    }
+
+private:
+    template<typename... FLAT>
+    void init(type_list<FLAT...>)
+    {
+        _matchers = { &_pattern_matcher<ENUMTYPE, flat_patterns, FLAT>::template match<flat_size>... };
+        _top_index = { top_index<FLAT>(std::make_index_sequence<sizeof...(PATTERNS)>())... };
+
+        const ENUMTYPE kinds[] = { _pattern_matcher<ENUMTYPE, flat_patterns, FLAT>::kind... };
+        for (auto i : irange(flat_size))
+        {
+            auto kind = static_cast<size_t>(kinds[i]);
+            if (kind >= _by_kind.size())
+                _by_kind.resize(kind+1);
+            _by_kind[kind].push_back(i);
+        }
+    }
+
+    template<typename ACC, size_t... IDX>
+    static int top_index(std::index_sequence<IDX...>)
+    {
+        int res = -1;
+        // PATTERNSに同じ型が複数ある場合は最初のものを使う。
+        int dummy[] = { 0, (res = (res < 0 && std::is_same<ACC, PATTERNS>::value) ? (int)IDX : res)... };
+        UNUSED(dummy);
+        return res;
+    }
+};
+
+}
+#endif
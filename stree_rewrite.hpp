@@ -0,0 +1,330 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_REWRITE_HPP_
+#define _STREE_REWRITE_HPP_
+
+#include "symtree.hpp"
+#include "forest_pool.hpp"
+#include "stree_match.hpp"
+#include <algorithm>
+#include <deque>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    書き換え規則。ACCのパターンにマッチしたノードに対して
+        stree<E>* fn(ACC& op, rewrite_context<E>& ctx)
+    を呼び、返されたサブツリーでノードを差し替える。nullptrを返したら書き換えない。
+    nullptrを返す時も、それまでにtakeしたサブツリーは元の位置に戻され、makeしたノードはプールに戻される。
+    make_rule<add_op>([](add_op& op, auto& ctx) { ... }) のように作る。
+*/
+template<typename ACC, typename FN>
+struct rewrite_rule
+{
+    using pattern = ACC;
+    FN _fn;
+};
+
+template<typename ACC, typename FN>
+rewrite_rule<ACC, FN> make_rule(FN fn)
+{
+    return rewrite_rule<ACC, FN> { fn };
+}
+
+/*
+    書き換え規則が新しいサブツリーを作る為の道具。
+    ノードはプールから取るので、差し替えで捨てられたノードが使い回される。
+*/
+template<typename ENUMTYPE>
+struct rewrite_context
+{
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+
+    // takeで取り出したサブツリーと、取り出す前にあった位置（戻す時はそこにchainする）。
+    struct taken_subtree
+    {
+        stree_* _node;
+        typename stree_::iterator _hole;
+    };
+
+    node_pool<atom_> _pool;
+
+    // 今回の書き換えで古いサブツリーから取り出して使い回しているサブツリー。
+    std::vector<taken_subtree> _taken;
+
+    // 今回の書き換えでmakeしたノード。
+    std::vector<stree_*> _made;
+
+    // 今規則を適用しているノード。
+    stree_* _matched = nullptr;
+
+    template<typename T>
+    stree_* make(T value)
+    {
+        auto node = _pool.make(atom_(value));
+        _made.push_back(node);
+        return node;
+    }
+
+    /*
+        valueのノードを作り、childrenをその順で子供にする。
+    */
+    template<typename T>
+    stree_* make(T value, std::initializer_list<stree_*> children)
+    {
+        auto node = make(value);
+        for (auto child : children)
+            node->append_child(child);
+        return node;
+    }
+
+    /*
+        マッチしたノードの子孫nodeを古いサブツリーから切り離し、新しいサブツリーの部品として使えるようにする。
+        取り出したサブツリーの中身は変わっていないので、書き換え後に調べ直す事はしない。
+        inline葉はノードが無いので取り出せない（accessorのstreeのフィールドはinline葉を指さない）。
+    */
+    stree_* take(stree_& node)
+    {
+        if (&node == _matched)
+        {
+            assert(false);
+            throw std::runtime_error("cannot take the matched node itself");
+        }
+        auto iter = node.begin();
+        // 戻す位置はサブツリーの次のエッジ（弟のleadingか親のtrailing）。
+        auto hole = iter.trailing_of().next_of();
+        auto res = iter.unchain();
+        _taken.push_back(taken_subtree { res, hole });
+        return res;
+    }
+
+    bool is_taken(stree_* node) const
+    {
+        return std::find_if(_taken.begin(), _taken.end(), [node](const taken_subtree& t) { return t._node == node; }) != _taken.end();
+    }
+
+    /*
+        規則がnullptrを返した時の後始末。takeしたサブツリーを取り出した順と逆に元の位置に戻し、makeしたノードをプールに戻す。
+        後で取り出したものの位置は先に取り出したものを指している事があるので、逆順に戻す。
+        takeしたサブツリーの中身は変えていない前提（makeしたノードの子供にしただけなら外して戻す）。
+    */
+    void restore()
+    {
+        for (auto iter = _taken.rbegin(); iter != _taken.rend(); iter++)
+        {
+            auto node = iter->_node;
+            if (!node->is_root())
+                node->begin().unchain();
+            iter->_hole.chain(node);
+        }
+        _taken.clear();
+        recycle_unused(nullptr, [](stree_*) {});
+    }
+
+    /*
+        書き換えが終わった時の後始末。resultに使われなかったmakeしたノードとtakeしたサブツリーをプールに戻す。
+        takeしたサブツリーは元のツリーのノードなので、戻す前にfn(stree_*)を呼ぶ。
+    */
+    template<typename F>
+    void finish(stree_* result, F fn)
+    {
+        for (auto& t : _taken)
+        {
+            if (t._node != result && t._node->is_root())
+                discard(t._node, fn);
+        }
+        _taken.clear();
+        // 使わなかったmakeしたノードの子供にしたtakeしたサブツリーは、ここで一緒に戻る。
+        recycle_unused(result, fn);
+    }
+
+    /*
+        ツリーから切り離したサブツリーをプールに戻す。各ノードについて先にfn(stree_*)を呼ぶ。
+        変更の記録（forest_journalなど）が預かった時は、rollbackでツリーに戻るかもしれないのでプールには入れない。
+    */
+    template<typename F>
+    void discard(stree_* subtree, F fn)
+    {
+        if (!hand_over_detached(subtree))
+        {
+            _pool.recycle(subtree, fn);
+            return;
+        }
+        for (auto iter = subtree->begin(); iter != subtree->end(); iter++)
+        {
+            if (iter.is_leading())
+                fn(iter.get_node());
+        }
+    }
+
+private:
+    // makeしたノードのうち、どこにもつながっていないものをサブツリーごとプールに戻す。
+    template<typename F>
+    void recycle_unused(stree_* result, F fn)
+    {
+        std::vector<stree_*> roots;
+        for (auto node : _made)
+        {
+            if (node != result && node->is_root())
+                roots.push_back(node);
+        }
+        _made.clear();
+        for (auto node : roots)
+            _pool.recycle(node, fn);
+    }
+};
+
+/*
+    規則を不動点まで繰り返し適用する書き換えエンジン。
+
+    auto rw = make_rewriter<test_sym>(make_rule<add_op>(...), make_rule<sub_op>(...));
+    rw.run(root);
+
+    最初は全ノードをpostorderで作業リストに入れる。書き換えが起きたら、
+        - 新しく作られたノード（takeで使い回した部分は除く）
+        - 差し替えた位置からパターンの深さ分の祖先
+    だけを作業リストに足すので、ツリー全体をなめ直す事は無い。
+    差し替えはchild_iterator::replaceで行い、古いサブツリーのノードはプールに戻して次の書き換えで使い回す（forest_journalなどの変更の記録が預かった時は戻さない）。
+
+    規則は書かれた順に試し、最初にnullptr以外を返したものを使う。
+*/
+template<typename ENUMTYPE, typename... RULES>
+struct rewriter
+{
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+
+    static constexpr size_t depth = std::max({ (size_t)0, pattern_depth<typename RULES::pattern>::value... });
+
+    std::tuple<RULES...> _rules;
+    rewrite_context<ENUMTYPE> _ctx;
+
+    std::deque<stree_*> _worklist;
+    // 作業リストに入っていて、まだ生きているノード。
+    std::unordered_set<stree_*> _pending;
+
+    explicit rewriter(RULES... rules) : _rules(rules...) {}
+
+    /*
+        rootに規則を不動点まで適用し、書き換えた回数を返す。
+        ルートが書き換えられる事もあるので、rootはポインタの参照で受け取る。
+        max_rewritesを超えたら不動点で無くても止める。
+    */
+    size_t run(stree_*& root, size_t max_rewrites = std::numeric_limits<size_t>::max())
+    {
+        _worklist.clear();
+        _pending.clear();
+        for (auto iter = root->begin(); iter != root->end(); iter++)
+        {
+            if (iter.is_trailing())
+                push(iter.get_node());
+        }
+
+        size_t count = 0;
+        while (!_worklist.empty() && count < max_rewrites)
+        {
+            auto node = _worklist.front();
+            _worklist.pop_front();
+            if (_pending.erase(node) == 0)
+                continue;
+
+            auto newNode = apply(*node, std::make_index_sequence<sizeof...(RULES)>());
+            if (newNode == nullptr)
+                continue;
+
+            replace_at(root, node, newNode);
+            count++;
+        }
+        return count;
+    }
+
+private:
+    void push(stree_* node)
+    {
+        if (node->_data._type != atom_::enumval)
+            return;
+        if (_pending.insert(node).second)
+            _worklist.push_back(node);
+    }
+
+    template<typename RULE>
+    stree_* try_rule(RULE& rule, stree_& node)
+    {
+        using pattern = typename RULE::pattern;
+        if (!matches<pattern>(node))
+            return nullptr;
+        pattern op(node);
+        _ctx._matched = &node;
+        auto res = rule._fn(op, _ctx);
+        if (res == nullptr)
+            _ctx.restore();
+        return res;
+    }
+
+    template<size_t... IDX>
+    stree_* apply(stree_& node, std::index_sequence<IDX...>)
+    {
+        stree_* res = nullptr;
+        stree_* dummy[] = { nullptr, (res = (res != nullptr ? res : try_rule(std::get<IDX>(_rules), node)))... };
+        UNUSED(dummy);
+        return res;
+    }
+
+    void replace_at(stree_*& root, stree_* node, stree_* newNode)
+    {
+        assert(node != newNode);
+
+        auto parent = node->parent();
+        std::unique_ptr<stree_> old;
+        if (parent == nullptr)
+        {
+            old = root->begin().replace(newNode);
+            root = newNode;
+        }
+        else
+        {
+            auto iter = parent->begin_child();
+            while (iter.get_node() != node)
+                iter++;
+            old = iter.replace(newNode);
+        }
+
+        _ctx.discard(old.release(), [this](stree_* dead) { _pending.erase(dead); });
+
+        // 新しく作られたノードをpostorderで積む。使い回したサブツリーは飛ばす。
+        for (auto iter = newNode->begin(); iter != newNode->end(); iter++)
+        {
+            if (iter.is_leading())
+            {
+                if (_ctx.is_taken(iter.get_node()))
+                    iter.to_trailing();
+                continue;
+            }
+            push(iter.get_node());
+        }
+        _ctx.finish(newNode, [this](stree_* dead) { _pending.erase(dead); });
+
+        for (size_t i = 0; i < depth && parent != nullptr; i++)
+        {
+            push(parent);
+            parent = parent->parent();
+        }
+    }
+};
+
+template<typename ENUMTYPE, typename... RULES>
+rewriter<ENUMTYPE, RULES...> make_rewriter(RULES... rules)
+{
+    return rewriter<ENUMTYPE, RULES...>(rules...);
+}
+
+}
+#endif
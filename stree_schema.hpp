@@ -0,0 +1,266 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_SCHEMA_HPP_
+#define _STREE_SCHEMA_HPP_
+
+#include "symtree.hpp"
+#include "stree_match.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace symtree
+{
+
+template<typename ENUMTYPE>
+struct schema_violation
+{
+    stree<ENUMTYPE>* _node;
+    std::string _message;
+};
+
+/*
+    スキーマに合わないツリーをvalidateした時に投げられる例外。違反はすべて_violationsに入っている。
+*/
+template<typename ENUMTYPE>
+struct schema_error : std::runtime_error
+{
+    std::vector<schema_violation<ENUMTYPE>> _violations;
+
+    explicit schema_error(std::vector<schema_violation<ENUMTYPE>>&& violations)
+        : std::runtime_error(violations.front()._message), _violations(std::move(violations)) {}
+};
+
+/*
+    スキーマの子供一つ分のチェック。
+    入れ子のaccessorは種類だけを見る（そのノード自身の形は、そのノードを訪れた時にその種類の唯一の形で調べる）。
+    check_inlineは親のatomの持つinline葉のチェック。streeの子供にはノードが要るので、inline葉は違反になる。
+*/
+template<typename EN, typename T>
+struct _schema_child
+{
+    static bool check(stree<EN>&) { return true; }
+    static bool check_inline(const atom<EN>&) { return false; }
+    static const char* expected() { return "any node"; }
+};
+
+template<typename EN>
+struct _schema_child<EN, int64_t>
+{
+    static bool check(stree<EN>& node) { return node._data._type == atom<EN>::numval && !node.has_children(); }
+    static bool check_inline(const atom<EN>& parent) { return parent.inline_atom_type() == atom<EN>::numval; }
+    static const char* expected() { return "number leaf"; }
+};
+
+template<typename EN>
+struct _schema_child<EN, uint64_t> : _schema_child<EN, int64_t> {};
+
+template<typename EN>
+struct _schema_child<EN, std::string>
+{
+    static bool check(stree<EN>& node) { return node._data._type == atom<EN>::stringval && !node.has_children(); }
+    static bool check_inline(const atom<EN>& parent) { return parent.inline_atom_type() == atom<EN>::stringval; }
+    static const char* expected() { return "string leaf"; }
+};
+
+template<typename EN, EN eid, typename... CHLDS>
+struct _schema_child<EN, accessor<EN, eid, CHLDS...>>
+{
+    static bool check(stree<EN>& node)
+    {
+        return node._data._type == atom<EN>::enumval && node._data._value._enumval == eid;
+    }
+    static bool check_inline(const atom<EN>&) { return false; }
+    static const char* expected() { return "enum node"; }
+};
+
+/*
+    accessor一つ分の形のチェック。合っていれば空文字列、違っていれば理由を返す。
+*/
+template<typename EN, typename ACC>
+struct _schema_shape;
+
+template<typename EN, EN eid, typename... CHLDS>
+struct _schema_shape<EN, accessor<EN, eid, CHLDS...>>
+{
+    static constexpr EN kind = eid;
+
+    static std::string check(stree<EN>& node)
+    {
+        auto iter = node.begin_child();
+        auto end = node.end_child();
+        // inline葉があればそれが最初の子供。
+        bool inl = node._data.has_inline();
+        std::string res;
+        size_t idx = 0;
+        bool dummy[] = { true, (res = res.empty() ? check_child<CHLDS>(node, inl, iter, end, idx++) : res, true)... };
+        UNUSED(dummy);
+        UNUSED(idx);
+
+        if (res.empty() && (inl || iter != end))
+            res = "too many children, expected " + std::to_string(sizeof...(CHLDS));
+        return res;
+    }
+
+private:
+    template<typename CHLD>
+    static std::string check_child(stree<EN>& node, bool& inl, child_iterator<atom<EN>>& iter, const child_iterator<atom<EN>>& end, size_t idx)
+    {
+        if constexpr (atom<EN>::inline_enabled)
+        {
+            if (inl)
+            {
+                inl = false;
+                if (!_schema_child<EN, CHLD>::check_inline(node._data))
+                    return "child " + std::to_string(idx) + " is not " + _schema_child<EN, CHLD>::expected();
+                return "";
+            }
+        }
+        if (iter == end)
+            return "too few children, expected " + std::to_string(sizeof...(CHLDS));
+        auto child = (iter++).get_node();
+        if (!_schema_child<EN, CHLD>::check(*child))
+            return "child " + std::to_string(idx) + " is not " + _schema_child<EN, CHLD>::expected();
+        return "";
+    }
+};
+
+
+/*
+    平坦化した形の種類がすべて違うならtrue。
+*/
+template<typename EN, typename L>
+struct _schema_kinds_unique;
+
+template<typename EN>
+struct _schema_kinds_unique<EN, type_list<>> : std::true_type {};
+
+template<typename EN, typename ACC, typename... RESTs>
+struct _schema_kinds_unique<EN, type_list<ACC, RESTs...>>
+    : std::integral_constant<bool,
+        (true && ... && (_schema_shape<EN, ACC>::kind != _schema_shape<EN, RESTs>::kind))
+        && _schema_kinds_unique<EN, type_list<RESTs...>>::value> {};
+
+
+template<typename SCHEMA>
+struct validated;
+
+/*
+    accessorで書いた形の集まり。ツリーがこれに従っているかを一回の走査で調べる。
+
+    using my_schema = schema<test_sym, let_op, add_op, sub_op, int_imm, var_op>;
+    auto tree = my_schema::validate(root);   // 違反があればschema_errorを投げる
+    auto op = tree.view<add_op>(node);         // 以後はチェック無しで読める
+
+    入れ子のaccessorも形として扱う。一つの種類に形は一つだけ（入れ子の中も含めて、種類が同じで形の違うaccessorがあるとコンパイルできない）。
+    そうすれば、どのノードもその種類の形で調べられるので、入れ子の子供は種類を見るだけで入れ子の形まで保証される。
+    スキーマに無い種類のenumのノードや、enumでないルートは違反になる。
+    数値や文字列の葉は、親の形の中でだけ許される（子供が居たら違反）。
+*/
+template<typename ENUMTYPE, typename... SHAPES>
+struct schema
+{
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+    using shapes = typename _collect_patterns<type_list<>, SHAPES...>::type;
+    using violation = schema_violation<ENUMTYPE>;
+
+    static_assert(_schema_kinds_unique<ENUMTYPE, shapes>::value, "schema declares more than one shape for the same kind");
+
+    /*
+        違反をすべて集めて返す。各ノードの子供は親から一回ずつ調べるだけなので、全体で線形時間。
+    */
+    static std::vector<violation> check(stree_& root)
+    {
+        std::vector<violation> res;
+        if (root._data._type != atom_::enumval)
+            res.push_back({ &root, "root is not an enum node" });
+
+        root.for_each_leading([&res](typename stree_::iterator& iter) {
+            auto& node = *iter.get_node();
+            if (node._data._type != atom_::enumval)
+                return;
+
+            auto msg = check_node(node, shapes());
+            if (!msg.empty())
+                res.push_back({ &node, msg });
+        });
+        return res;
+    }
+
+    /*
+        rootを検証し、違反が無ければ検証済みの印を返す。違反があればschema_errorを投げる。
+    */
+    static validated<schema> validate(stree_& root)
+    {
+        auto violations = check(root);
+        if (!violations.empty())
+            throw schema_error<ENUMTYPE>(std::move(violations));
+        return validated<schema>(root);
+    }
+
+private:
+    template<typename... FLAT>
+    static std::string check_node(stree_& node, type_list<FLAT...>)
+    {
+        auto kind = node._data._value._enumval;
+        std::string first;
+        bool declared = false;
+        bool ok = false;
+        bool dummy[] = { true, (ok = ok || try_shape<FLAT>(node, kind, declared, first))... };
+        UNUSED(dummy);
+
+        if (ok)
+            return "";
+        if (!declared)
+            return "kind " + std::to_string(static_cast<size_t>(kind)) + " is not in the schema";
+        return "kind " + std::to_string(static_cast<size_t>(kind)) + ": " + first;
+    }
+
+    template<typename SHAPE>
+    static bool try_shape(stree_& node, ENUMTYPE kind, bool& declared, std::string& first)
+    {
+        using shape = _schema_shape<ENUMTYPE, SHAPE>;
+        if (shape::kind != kind)
+            return false;
+
+        declared = true;
+        auto msg = shape::check(node);
+        if (msg.empty())
+            return true;
+        if (first.empty())
+            first = msg;
+        return false;
+    }
+};
+
+/*
+    スキーマで検証済みのツリーの印。schema::validateでしか作れない。
+    view<ACC>はACCがスキーマにある形の時だけコンパイルでき、チェックの無いunchecked<ACC>を返す。
+    スキーマには種類ごとに形が一つしか無いので、ACCの種類のノードはACCの形（入れ子の形も含む）で検証されている。
+    nodeがACCの種類である事は呼び出し側が保証する（visitorでunchecked<ACC>を使えば種類で振り分けられる）。
+    検証後にツリーを変更したら、もう一度validateする事。
+*/
+template<typename SCHEMA>
+struct validated
+{
+    using stree_ = typename SCHEMA::stree_;
+
+    stree_& _root;
+
+    stree_& root() const { return _root; }
+
+    template<typename ACC>
+    unchecked<ACC> view(stree_& node) const
+    {
+        static_assert(tl_contains<typename SCHEMA::shapes, ACC>::value, "ACC is not in the schema");
+        return unchecked<ACC>(node);
+    }
+
+private:
+    friend SCHEMA;
+    explicit validated(stree_& root) : _root(root) {}
+};
+
+}
+#endif
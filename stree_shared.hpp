@@ -0,0 +1,99 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_SHARED_HPP_
+#define _STREE_SHARED_HPP_
+
+#include "symtree.hpp"
+#include "forest_shared.hpp"
+#include <cstdint>
+#include <string>
+
+#ifdef SYMTREE_HAS_SHARED_MEMORY
+
+namespace symtree
+{
+
+/*
+    shared_forestに置けるatom。文字列はshared_forestのバイト領域のoffsetと長さで持つ。
+*/
+template<typename ENUMTYPE>
+struct shared_atom
+{
+    using atom_type = typename atom<ENUMTYPE>::atom_type;
+
+    atom_type _type;
+    typed_num _numval;
+    ENUMTYPE _enumval;
+    uint64_t _string_offset;
+    uint32_t _string_size;
+
+    bool is_enum() const { return _type == atom<ENUMTYPE>::enumval; }
+    bool is_num() const { return _type == atom<ENUMTYPE>::numval; }
+    bool is_string() const { return _type == atom<ENUMTYPE>::stringval; }
+};
+
+template<typename ENUMTYPE>
+using shared_stree = shared_forest<shared_atom<ENUMTYPE>>;
+
+/*
+    atomをshared_atomにする。文字列はdestのバイト領域にコピーする。書き込み中に呼ぶ事。
+*/
+template<typename ENUMTYPE>
+shared_atom<ENUMTYPE> to_shared_atom(shared_stree<ENUMTYPE>& dest, const atom<ENUMTYPE>& src)
+{
+    shared_atom<ENUMTYPE> res { src._type, typed_num(typed_num::signed_int, 0), ENUMTYPE(), 0, 0 };
+    switch(src._type)
+    {
+        case atom<ENUMTYPE>::numval:
+            res._numval = src._value._numval;
+            break;
+        case atom<ENUMTYPE>::enumval:
+            res._enumval = src._value._enumval;
+            break;
+        case atom<ENUMTYPE>::stringval:
+            res._string_size = (uint32_t)src._value._stringval->size();
+            res._string_offset = dest.add_bytes(src._value._stringval->data(), res._string_size);
+            break;
+    }
+    return res;
+}
+
+/*
+    srcのツリーをdestにコピーし、ルートの添字を返す。書き込み中に呼ぶ事。
+    inline葉は普通の子供に戻してコピーする。
+*/
+template<typename ENUMTYPE>
+uint32_t copy_stree(shared_stree<ENUMTYPE>& dest, stree<ENUMTYPE>& src)
+{
+    auto root = dest.create(to_shared_atom(dest, src._data));
+    auto cur = dest.begin(root).to_trailing();
+    for (auto iter = src.begin(); iter != src.end(); iter++)
+    {
+        auto& data = iter.get_node()->_data;
+        if (iter.is_leading())
+        {
+            if (iter.get_node() != &src)
+                cur = cur.insert(to_shared_atom(dest, data)).to_trailing();
+            if constexpr (atom<ENUMTYPE>::inline_enabled)
+                if (data.has_inline())
+                    cur.insert(to_shared_atom(dest, data.copy().take_inline()));
+        }
+        else if (iter.get_node() != &src)
+        {
+            cur++;
+        }
+    }
+    return root;
+}
+
+template<typename ENUMTYPE>
+std::string shared_atom_string(const shared_stree<ENUMTYPE>& tree, const shared_atom<ENUMTYPE>& value)
+{
+    assert(value.is_string());
+    return std::string(tree.bytes(value._string_offset), value._string_size);
+}
+
+}
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_STORE_HPP_
+#define _STREE_STORE_HPP_
+
+#include "symtree.hpp"
+#include "stree_hash.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace symtree
+{
+
+/*
+    streeをサブツリーの構造ハッシュをキーにしてファイルに貯めておくストア。
+
+    stree_store<test_sym> store( "trees.bin" );
+    auto key = store.put( *root );
+    ...
+    auto tree = store.get( key );   // 新しいforestを作る。寿命は呼び出し側が管理。
+
+    ファイルには subtree_chunk（atomと子供のハッシュ）をハッシュごとに一つだけ、以下の形で追記していく。
+        uint64_t hash
+        uint32_t size
+        char     chunk[size]
+    すでにあるハッシュのサブツリーは書かないので、少しだけ違うツリーを何度もputしても、増えるのは違う所からルートまでの分だけ。
+    チャンクはpostorderで書くので、ファイルの中では子供が必ず親より前にある。
+
+    開く時にファイルを一回読んで、ハッシュから位置への表を作る。
+    最後のレコードが途中で切れていたら（追記の途中で落ちたなど）、そのレコードを捨ててファイルを切り詰める。
+    ハッシュは64bitなので、表にはチャンクの大きさと、別のseedで求めたもう一つのハッシュも持っておく。
+    putで同じハッシュのチャンクがあった時はそれらを比べ、違えば衝突として例外を投げる。ファイルは読まない。
+*/
+template<typename ENUMTYPE>
+class stree_store
+{
+public:
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+
+    explicit stree_store(const std::string& path) : _path(path)
+    {
+        // 無ければ作る。
+        std::ofstream(path, std::ios::binary | std::ios::app);
+        _file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!_file)
+            throw std::runtime_error("cannot open " + path);
+        load_index();
+    }
+
+    stree_store(const stree_store&) = delete;
+    stree_store& operator=(const stree_store&) = delete;
+
+    /*
+        rootを書き込み、rootのハッシュを返す。まだ無いサブツリーだけを書く。
+    */
+    uint64_t put(stree_& root)
+    {
+        auto key = hash_subtrees(root, [this](stree_&, uint64_t hash, const std::string& chunk) {
+            auto found = _index.find(hash);
+            if (found != _index.end())
+            {
+                if (found->second._size != chunk.size() || found->second._check != check_hash(chunk))
+                    throw std::runtime_error("hash collision in stree_store");
+                return;
+            }
+            append(hash, chunk);
+        });
+        _file.flush();
+        return key;
+    }
+
+    bool contains(uint64_t hash) const { return _index.find(hash) != _index.end(); }
+
+    // 貯めているチャンク（重複の無いサブツリー）の数。
+    size_t chunk_count() const { return _index.size(); }
+
+    // ファイルの大きさ。
+    uint64_t stored_bytes() const { return _end; }
+
+    /*
+        hashのツリーを読んで新しいforestを作る。無ければnullptr。
+    */
+    stree_* get(uint64_t hash)
+    {
+        if (!contains(hash))
+            return nullptr;
+
+        struct frame
+        {
+            stree_* _node;
+            std::vector<uint64_t> _children;
+            size_t _next;
+        };
+
+        std::vector<frame> stack;
+        auto root = read_node(hash, stack);
+        while (!stack.empty())
+        {
+            auto& top = stack.back();
+            if (top._next == top._children.size())
+            {
+                stack.pop_back();
+                continue;
+            }
+            auto parent = top._node;
+            auto child = read_node(top._children[top._next++], stack);
+            parent->append_child(child);
+        }
+        return root;
+    }
+
+private:
+    struct location
+    {
+        uint64_t _offset;
+        uint32_t _size;
+        // 衝突を見る為の、チャンクのもう一つのハッシュ。
+        uint64_t _check;
+    };
+
+    static uint64_t check_hash(const std::string& chunk)
+    {
+        return hash_bytes(chunk.data(), chunk.size(), 0x9e3779b97f4a7c15ULL);
+    }
+
+    std::string _path;
+    std::fstream _file;
+    std::unordered_map<uint64_t, location> _index;
+    uint64_t _end = 0;
+
+    void load_index()
+    {
+        _file.seekg(0, std::ios::end);
+        uint64_t size = _file.tellg();
+        uint64_t offset = 0;
+        while (offset + sizeof(uint64_t) + sizeof(uint32_t) <= size)
+        {
+            _file.seekg(offset);
+            uint64_t hash;
+            uint32_t chunkSize;
+            _file.read((char*)&hash, sizeof(hash));
+            _file.read((char*)&chunkSize, sizeof(chunkSize));
+            uint64_t body = offset + sizeof(hash) + sizeof(chunkSize);
+            if (body + chunkSize > size)
+                break;
+            location loc { body, chunkSize, 0 };
+            loc._check = check_hash(read_chunk(loc));
+            _index[hash] = loc;
+            offset = body + chunkSize;
+        }
+        _end = offset;
+        _file.clear();
+
+        // 切れたレコードの後ろに追記すると位置がずれるので、完全なレコードの所まで切り詰める。
+        if (_end != size)
+        {
+            _file.close();
+            std::filesystem::resize_file(_path, _end);
+            _file.open(_path, std::ios::binary | std::ios::in | std::ios::out);
+            if (!_file)
+                throw std::runtime_error("cannot open " + _path);
+        }
+    }
+
+    std::string read_chunk(const location& loc)
+    {
+        std::string chunk(loc._size, '\0');
+        _file.seekg(loc._offset);
+        _file.read(&chunk[0], loc._size);
+        return chunk;
+    }
+
+    void append(uint64_t hash, const std::string& chunk)
+    {
+        // getで読むと位置が動くので、毎回末尾に合わせる。
+        uint32_t size = (uint32_t)chunk.size();
+        _file.seekp(_end);
+        _file.write((const char*)&hash, sizeof(hash));
+        _file.write((const char*)&size, sizeof(size));
+        _file.write(chunk.data(), chunk.size());
+        _index[hash] = location { _end + sizeof(hash) + sizeof(size), size, check_hash(chunk) };
+        _end += sizeof(hash) + sizeof(size) + size;
+    }
+
+    // チャンクを読んでノードを作り、子供のハッシュをstackに積む。
+    template<typename FRAMES>
+    stree_* read_node(uint64_t hash, FRAMES& stack)
+    {
+        auto chunk = read_chunk(_index.at(hash));
+
+        const char* p = chunk.data();
+        auto node = new stree_(atom_codec<ENUMTYPE>::read_from(p));
+
+        uint32_t count;
+        memcpy(&count, p, sizeof(count));
+        p += sizeof(count);
+        std::vector<uint64_t> children(count);
+        if (count > 0)
+            memcpy(children.data(), p, count * sizeof(uint64_t));
+
+        stack.push_back({ node, std::move(children), 0 });
+        return node;
+    }
+};
+
+}
+#endif
@@ -0,0 +1,207 @@
+/* -*- coding: utf-8 -*- マルチバイト */
+
+#ifndef _STREE_VISIT_HPP_
+#define _STREE_VISIT_HPP_
+
+#include "symtree.hpp"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
+namespace symtree
+{
+
+/*
+    ノードの種類ごとのハンドラ。on<...>()とotherwise()で作る。
+    ACCがaccessorならハンドラにはACCを、streeならノードそのものを渡す。
+    ハンドラは fn(op, visitor) か fn(op) のどちらの形でも良い。visitorを受け取ると子供を再帰的に訪問できる。
+*/
+template<typename ENUMTYPE, ENUMTYPE eid, typename ACC, typename FN, bool DEFAULT = false>
+struct visit_handler
+{
+    static constexpr ENUMTYPE kind = eid;
+    static constexpr bool is_default = DEFAULT;
+    FN _fn;
+
+    template<typename V>
+    auto invoke(stree<ENUMTYPE>& node, V& self)
+    {
+        ACC op(node);
+        return invoke_fn(op, self, std::is_invocable<FN&, ACC&, V&>());
+    }
+
+private:
+    template<typename V>
+    auto invoke_fn(ACC& op, V& self, std::true_type) { return _fn(op, self); }
+
+    template<typename V>
+    auto invoke_fn(ACC& op, V&, std::false_type) { return _fn(op); }
+};
+
+// streeを渡す場合はaccessorを作らない。
+template<typename ENUMTYPE, ENUMTYPE eid, typename FN, bool DEFAULT>
+struct visit_handler<ENUMTYPE, eid, stree<ENUMTYPE>, FN, DEFAULT>
+{
+    static constexpr ENUMTYPE kind = eid;
+    static constexpr bool is_default = DEFAULT;
+    FN _fn;
+
+    template<typename V>
+    auto invoke(stree<ENUMTYPE>& node, V& self)
+    {
+        return invoke_fn(node, self, std::is_invocable<FN&, stree<ENUMTYPE>&, V&>());
+    }
+
+private:
+    template<typename V>
+    auto invoke_fn(stree<ENUMTYPE>& node, V& self, std::true_type) { return _fn(node, self); }
+
+    template<typename V>
+    auto invoke_fn(stree<ENUMTYPE>& node, V&, std::false_type) { return _fn(node); }
+};
+
+template<typename ACC>
+struct _accessor_kind;
+
+template<typename EN, EN eid, typename... CHLDS>
+struct _accessor_kind<accessor<EN, eid, CHLDS...>>
+{
+    using enum_type = EN;
+    static constexpr EN value = eid;
+};
+
+template<typename ACC, bool CHECKED>
+struct _accessor_kind<materialized<ACC, CHECKED>> : _accessor_kind<ACC> {};
+
+/*
+    accessorの種類のノードのハンドラ。on<add_op>([](add_op& op, auto& self) { ... })
+    on<materialized<add_op>>とすれば、全フィールドを読み終えたものを受け取れる。
+*/
+template<typename ACC, typename FN>
+visit_handler<typename _accessor_kind<ACC>::enum_type, _accessor_kind<ACC>::value, ACC, FN>
+on(FN fn)
+{
+    return { fn };
+}
+
+/*
+    ENUMTYPEの値で指定するハンドラ。ノードそのものを受け取る。on<test_sym::add>([](ttree& node) { ... })
+*/
+template<auto eid, typename FN>
+visit_handler<decltype(eid), eid, stree<decltype(eid)>, FN>
+on(FN fn)
+{
+    return { fn };
+}
+
+/*
+    どのハンドラにも当てはまらないノード（enum以外の葉も含む）のハンドラ。
+*/
+template<typename ENUMTYPE, typename FN>
+visit_handler<ENUMTYPE, static_cast<ENUMTYPE>(0), stree<ENUMTYPE>, FN, true>
+otherwise(FN fn)
+{
+    return { fn };
+}
+
+
+/*
+    ENUMTYPEの値ごとのハンドラを、コンパイル時に作った表で呼び分けるvisitor。
+
+    auto eval = make_visitor<test_sym, int>(
+        on<int_imm>([](int_imm& op) { return (int)get<0>(op); }),
+        on<add_op>([](add_op& op, auto& self) { return self(get<0>(op)) + self(get<1>(op)); })
+    );
+    eval(root);
+
+    表はハンドラのENUMTYPEの値の最大値+1の大きさの関数ポインタの配列で、atomの型を一回見た後は添字で引くだけ。
+    同じ種類のハンドラが複数ある場合は先に書いたものが使われる。
+    ハンドラに渡すaccessorは子供を読む度に兄弟をたどる。全フィールドを一回で読みたい時はon<materialized<add_op>>を使う。
+    otherwiseが無い場合、ハンドラの無いノードを訪問するとassertで落ちる（リリースビルドではruntime_error）。
+*/
+template<typename ENUMTYPE, typename R, typename... HANDLERS>
+struct visitor
+{
+    static_assert(sizeof...(HANDLERS) > 0, "visitor needs at least one handler");
+
+    using stree_ = stree<ENUMTYPE>;
+    using atom_ = atom<ENUMTYPE>;
+    using entry_fn = R (*)(visitor&, stree_&);
+
+    static constexpr size_t table_size = 1 + std::max({ (size_t)HANDLERS::kind... });
+
+    std::tuple<HANDLERS...> _handlers;
+
+    explicit visitor(HANDLERS... handlers) : _handlers(handlers...) {}
+
+    R operator()(stree_& node)
+    {
+        static constexpr auto table = make_table(std::index_sequence_for<HANDLERS...>());
+        static constexpr auto fallback = default_entry(std::index_sequence_for<HANDLERS...>());
+
+        if (node._data._type != atom_::enumval)
+            return fallback(*this, node);
+
+        auto kind = static_cast<size_t>(node._data._value._enumval);
+        if (kind >= table_size)
+            return fallback(*this, node);
+        return table[kind](*this, node);
+    }
+
+private:
+    template<size_t I>
+    static R call(visitor& self, stree_& node)
+    {
+        return std::get<I>(self._handlers).invoke(node, self);
+    }
+
+    static R call_unhandled(visitor&, stree_&)
+    {
+        assert(false);
+        throw std::runtime_error("no handler for this node");
+    }
+
+    template<size_t... IDX>
+    static constexpr entry_fn default_entry(std::index_sequence<IDX...>)
+    {
+        const bool defaults[] = { HANDLERS::is_default... };
+        const entry_fn fns[] = { &call<IDX>... };
+        for (size_t i = 0; i < sizeof...(HANDLERS); i++)
+        {
+            if (defaults[i])
+                return fns[i];
+        }
+        return &call_unhandled;
+    }
+
+    template<size_t... IDX>
+    static constexpr std::array<entry_fn, table_size> make_table(std::index_sequence<IDX...> seq)
+    {
+        std::array<entry_fn, table_size> table {};
+        auto fallback = default_entry(seq);
+        for (size_t i = 0; i < table_size; i++)
+            table[i] = fallback;
+
+        const size_t kinds[] = { (size_t)HANDLERS::kind... };
+        const bool defaults[] = { HANDLERS::is_default... };
+        const entry_fn fns[] = { &call<IDX>... };
+        // 先に書いたハンドラを優先するので後ろから埋める。
+        for (size_t i = sizeof...(HANDLERS); i > 0; i--)
+        {
+            if (!defaults[i-1])
+                table[kinds[i-1]] = fns[i-1];
+        }
+        return table;
+    }
+};
+
+template<typename ENUMTYPE, typename R, typename... HANDLERS>
+visitor<ENUMTYPE, R, HANDLERS...> make_visitor(HANDLERS... handlers)
+{
+    return visitor<ENUMTYPE, R, HANDLERS...>(handlers...);
+}
+
+}
+#endif
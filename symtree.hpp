@@ -5,9 +5,13 @@
 
 #include "util.hpp"
 #include "forest.hpp"
+#include <array>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 
 namespace symtree
 {
@@ -28,6 +32,19 @@ struct typed_num
     typed_num &operator=(typed_num&&) = default;
 };
 
+/*
+    atomの設定。使うenumごとに特殊化する。
+    inline_leavesがtrueの時だけinline葉（atom::set_inlineを参照）の領域を持つ。
+    falseならatomはinline葉の分だけ小さい。
+
+    namespace symtree { template<> struct atom_traits<sym> { static constexpr bool inline_leaves = true; }; }
+*/
+template<typename ENUMTYPE>
+struct atom_traits
+{
+    static constexpr bool inline_leaves = false;
+};
+
 template<typename ENUMTYPE>
 struct atom
 {
@@ -45,6 +62,7 @@ struct atom
         std::string* _stringval;
 
         value(ENUMTYPE eval) : _enumval(eval) {}
+        value(const typed_num& num) : _numval(num) {}
         value(int val) : _numval(typed_num::signed_int, val) {}
         value(unsigned int val) : _numval(typed_num::unsigned_int, val) {}
         value(const std::string& str)
@@ -65,23 +83,209 @@ struct atom
         }
     };
 
+    /*
+        inline葉の型。
+        enumのノードは、最初の子供の数値や文字列の葉をノードを作らずに自分の中に持てる（inline葉）。
+        論理的にはinline葉が0番目の子供で、実際の子供はその後に続く。
+        stree_builderのinlineモードやinline_leaves()で作る。atom_traits<ENUMTYPE>::inline_leavesがtrueの時だけ使える。
+        inline葉を読み書きするメソッドは、falseのENUMTYPEで使うとコンパイルエラーになる。
+        どのENUMTYPEでも使うコードでは、has_inline()を見る所をif constexpr (inline_enabled)で囲む。
+    */
+    enum inline_type : uint8_t
+    {
+        no_inline,
+        inline_signed,
+        inline_unsigned,
+        inline_string
+    };
+
+    union inline_value
+    {
+        uint64_t _num;
+        std::string* _stringval;
+    };
+
+    // inline葉を使わない時の領域。_valueの前の隙間に入るので、atomは大きくならない。
+    struct no_inline_value {};
+
+    static constexpr bool inline_enabled = atom_traits<ENUMTYPE>::inline_leaves;
+
     atom_type _type;
+    inline_type _inline = no_inline;
+    typename std::conditional<inline_enabled, inline_value, no_inline_value>::type _inline_value{};
     value _value;
 
     atom(ENUMTYPE eval) : _type(atom_type::enumval), _value(eval) {}
+    explicit atom(const typed_num& num) : _type(atom_type::numval), _value(num) {}
     atom(int val) : _type(atom_type::numval), _value(val) {}
     atom(unsigned int val) : _type(atom_type::numval), _value(val) {}
     atom(const std::string& str) : _type(atom_type::stringval), _value(str) {} 
 
-    atom(atom<ENUMTYPE>&& other) : _type(other._type), _value(other._value)
+    atom(atom<ENUMTYPE>&& other) : _type(other._type), _inline(other._inline), _inline_value(other._inline_value), _value(other._value)
     {
         other._type = atom_type::numval;
         other._value._numval = typed_num(typed_num::signed_int, 0);
+        other._inline = no_inline;
+    }
+
+    atom<ENUMTYPE>& operator=(atom<ENUMTYPE>&& other)
+    {
+        if (this != &other)
+        {
+            _value.destroy(_type);
+            destroy_inline();
+            _type = other._type;
+            _value = other._value;
+            _inline = other._inline;
+            _inline_value = other._inline_value;
+            other._type = atom_type::numval;
+            other._value._numval = typed_num(typed_num::signed_int, 0);
+            other._inline = no_inline;
+        }
+        return *this;
     }
 
     ~atom()
     {
         _value.destroy(_type);
+        destroy_inline();
+    }
+
+    bool has_inline() const { return inline_enabled && _inline != no_inline; }
+
+    // inline葉のatom_type。
+    atom_type inline_atom_type() const
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(has_inline());
+        return _inline == inline_string ? atom_type::stringval : atom_type::numval;
+    }
+
+    /*
+        数値か文字列の葉leafの値をinline葉として持つ。leafの中身はmoveされる。
+    */
+    void set_inline(atom<ENUMTYPE>&& leaf)
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(_type == atom_type::enumval && !has_inline());
+        switch(leaf._type)
+        {
+            case atom_type::numval:
+                _inline_value._num = leaf._value._numval._value;
+                _inline = leaf._value._numval._type == typed_num::signed_int ? inline_signed : inline_unsigned;
+                return;
+            case atom_type::stringval:
+                _inline_value._stringval = leaf._value._stringval;
+                _inline = inline_string;
+                leaf._type = atom_type::numval;
+                leaf._value._numval = typed_num(typed_num::signed_int, 0);
+                return;
+            case atom_type::enumval:
+                assert(false);
+                return;
+        }
+    }
+
+    /*
+        inline葉を普通の葉のatomとして取り出す。
+    */
+    atom<ENUMTYPE> take_inline()
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(has_inline());
+        auto kind = _inline;
+        _inline = no_inline;
+        if (kind == inline_string)
+        {
+            atom<ENUMTYPE> res(typed_num(typed_num::signed_int, 0));
+            res._type = atom_type::stringval;
+            res._value._stringval = _inline_value._stringval;
+            return res;
+        }
+        return atom<ENUMTYPE>(typed_num(kind == inline_signed ? typed_num::signed_int : typed_num::unsigned_int, _inline_value._num));
+    }
+
+    /*
+        数値の葉の値。inline葉はinline_num_value()で読む。
+    */
+    uint64_t leaf_num() const
+    {
+        assert(_type == atom_type::numval);
+        return _value._numval._value;
+    }
+
+    /*
+        文字列の葉の値。inline葉はinline_string_value()で読む。
+    */
+    std::string& leaf_string()
+    {
+        assert(_type == atom_type::stringval);
+        return *_value._stringval;
+    }
+
+    // inline葉の値。
+    uint64_t inline_num_value() const
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(has_inline() && _inline != inline_string);
+        return _inline_value._num;
+    }
+
+    // 数値のinline葉の符号の有無。
+    typed_num::num_type inline_num_type() const
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(has_inline() && _inline != inline_string);
+        return _inline == inline_signed ? typed_num::signed_int : typed_num::unsigned_int;
+    }
+
+    std::string& inline_string_value() const
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        assert(_inline == inline_string);
+        return *_inline_value._stringval;
+    }
+
+    /*
+        同じ値のatomを作る。atomはmoveしかできないので、コピーが要る時はこれを使う。
+    */
+    atom<ENUMTYPE> copy() const
+    {
+        atom<ENUMTYPE> res(typed_num(typed_num::signed_int, 0));
+        switch(_type)
+        {
+            case atom_type::enumval:
+                res = atom<ENUMTYPE>(_value._enumval);
+                break;
+            case atom_type::numval:
+                res = atom<ENUMTYPE>(_value._numval);
+                break;
+            case atom_type::stringval:
+                res = atom<ENUMTYPE>(*_value._stringval);
+                break;
+        }
+        if constexpr (inline_enabled)
+            if (has_inline())
+                res.set_inline(_inline == inline_string ? atom<ENUMTYPE>(inline_string_value()) : atom<ENUMTYPE>(typed_num(_inline == inline_signed ? typed_num::signed_int : typed_num::unsigned_int, inline_num_value())));
+        return res;
+    }
+
+    // チェックしない版。スキーマで検証済みのツリー用。
+    // inline葉があればinline葉の値。
+    uint64_t leaf_num_unchecked() const
+    {
+        if constexpr (inline_enabled)
+            if (_inline != no_inline)
+                return _inline_value._num;
+        return _value._numval._value;
+    }
+
+    std::string& leaf_string_unchecked()
+    {
+        if constexpr (inline_enabled)
+            if (_inline != no_inline)
+                return *_inline_value._stringval;
+        return *_value._stringval;
     }
 
     /*
@@ -111,12 +315,47 @@ struct atom
         }
     }
 
+    /*
+        デバッグ用。inline葉をdisplay_stringと同じ形式で返す。
+    */
+    std::string inline_display_string()
+    {
+        static_assert(inline_enabled, "enable inline leaves with atom_traits");
+        switch(_inline)
+        {
+            case inline_signed:
+                return "int:" + std::to_string(inline_num_value());
+            case inline_unsigned:
+                return "uint:" + std::to_string(inline_num_value());
+            case inline_string:
+                return "string:" + inline_string_value();
+            case no_inline:
+                break;
+        }
+        assert(false);
+        return "";
+    }
 
+private:
+    void destroy_inline()
+    {
+        if constexpr (inline_enabled)
+            if (_inline == inline_string)
+                delete _inline_value._stringval;
+        _inline = no_inline;
+    }
 };
 
 template<typename ENUMTYPE>
 using stree = forest<atom<ENUMTYPE>>;
 
+// forest::cloneに渡す為のもの。root->clone<atom_cloner<E>>()
+template<typename ENUMTYPE>
+struct atom_cloner
+{
+    static atom<ENUMTYPE> clone(const atom<ENUMTYPE>& src) { return src.copy(); }
+};
+
 inline void indent( std::stringstream &out, int level )
 {
   for (auto i: irange( level ))
@@ -128,32 +367,61 @@ inline void indent( std::stringstream &out, int level )
 
 
 /*
-  ETOSは std::string enum_to_str(ENUMTYPE e)をstatic methodに持つstruct
+  stree_dumpの出力をエッジ一つずつ書いていくもの。forest_resume.hppのforest_walkと組み合わせると、途中で止めながらdumpできる。
+  ETOSはstree_dumpと同じ。
 */
 template<typename E, typename ETOS>
-std::string stree_dump(stree<E>& root)
+struct stree_dump_writer
 {
-    std::stringstream buf;
-    int level = 0;
-    for (auto& edge : root)
+    std::stringstream _buf;
+    int _level = 0;
+
+    template<typename EDGE>
+    void operator()(const EDGE& edge)
     {
         if ( edge._direction == edge_dir::leading )
         {
-            indent(buf, level);
-            level++;
+            indent(_buf, _level);
+            _level++;
             std::string str = (*edge).template display_string<ETOS>();
-            buf << "<" << str << ">" << std::endl;
+            _buf << "<" << str << ">" << std::endl;
+
+            // inline葉は、普通の葉と同じように最初の子供として出力する。
+            if constexpr (atom<E>::inline_enabled)
+            {
+                if ((*edge).has_inline())
+                {
+                    std::string leaf = (*edge).inline_display_string();
+                    indent(_buf, _level);
+                    _buf << "<" << leaf << ">" << std::endl;
+                    indent(_buf, _level);
+                    _buf << "</" << leaf << ">" << std::endl;
+                }
+            }
         }
         else
         {
-            level--;
-            indent(buf, level);
+            _level--;
+            indent(_buf, _level);
             std::string str = (*edge).template display_string<ETOS>();
-            buf << "</" << str << ">" << std::endl;
+            _buf << "</" << str << ">" << std::endl;
         }
     }
-  return buf.str();
 
+    std::string str() const { return _buf.str(); }
+};
+
+/*
+  ETOSは std::string enum_to_str(ENUMTYPE e)をstatic methodに持つstruct
+  rootはforest_iteratorと同じ規則でエッジを回れるものなら良い（stree<E>やarena_forest::tree_view、forest_view.hppのviewなど）。
+*/
+template<typename E, typename ETOS, typename TREE = stree<E>>
+std::string stree_dump(TREE& root)
+{
+    stree_dump_writer<E, ETOS> writer;
+    for (auto& edge : root)
+        writer(edge);
+    return writer.str();
 }
 
 
@@ -183,6 +451,9 @@ struct stree_builder
     stree_ *_root;
     siterator_ _iter;
 
+    // trueの時、enumのノードの最初の子供として追加した数値や文字列はinline葉にする。
+    bool _inline_leaves = false;
+
     stree_builder() : _root(nullptr), _iter(nullptr, edge_dir::trailing) {}
     ~stree_builder()
     {
@@ -205,9 +476,21 @@ struct stree_builder
         create_root_by_atom(atom_(value));
     }
 
+    /*
+        atmを今の位置に追加する。
+        inline葉にした場合はノードを作らないので、親のleadingを返す。
+    */
     siterator_ append_atom(atom_&& atm)
     {
         assert(_root != nullptr);
+        if constexpr (atom_::inline_enabled)
+        {
+            if (_inline_leaves && can_inline(atm))
+            {
+                _iter.get_node()->_data.set_inline(std::move(atm));
+                return _iter.leading_of();
+            }
+        }
         return _iter.insert(std::move(atm));
     }
 
@@ -225,6 +508,17 @@ struct stree_builder
         return _iter;
     }
 
+    bool can_inline(const atom_& atm) const
+    {
+        auto& parent = _iter.get_node()->_data;
+        return atom_::inline_enabled
+            && atm._type != atom_::enumval
+            && _iter.is_trailing()
+            && parent._type == atom_::enumval
+            && !parent.has_inline()
+            && !_iter.has_children();
+    }
+
     void go_up()
     {
         // いつもparentには兄弟はいない前提。
@@ -252,6 +546,55 @@ scoped_iterator<ENUMTYPE>::~scoped_iterator()
     tree->go_up();
 }
 
+/*
+    rootの中で、最初の子供が数値か文字列の葉であるenumのノードについて、その葉をinline葉にする。
+    inline葉にしたノードの数を返す。
+*/
+template<typename ENUMTYPE>
+size_t inline_leaves(stree<ENUMTYPE>& root)
+{
+    using atom_ = atom<ENUMTYPE>;
+    static_assert(atom_::inline_enabled, "enable inline leaves with atom_traits");
+
+    std::vector<stree<ENUMTYPE>*> targets;
+    root.for_each_leading([&targets](typename stree<ENUMTYPE>::iterator& iter) {
+        auto& data = iter.get_node()->_data;
+        if (data._type != atom_::enumval || data.has_inline() || !iter.has_children())
+            return;
+        auto first = iter.next_of();
+        if (first.get_node()->_data._type != atom_::enumval && !first.has_children())
+            targets.push_back(iter.get_node());
+    });
+
+    for (auto node : targets)
+    {
+        auto first = node->begin().next_of();
+        node->_data.set_inline(std::move(first.get_node()->_data));
+        first.erase();
+    }
+    return targets.size();
+}
+
+/*
+    inline_leavesの逆。inline葉を普通の最初の子供のノードに戻す。戻したノードの数を返す。
+*/
+template<typename ENUMTYPE>
+size_t expand_inline_leaves(stree<ENUMTYPE>& root)
+{
+    static_assert(atom<ENUMTYPE>::inline_enabled, "enable inline leaves with atom_traits");
+    std::vector<stree<ENUMTYPE>*> targets;
+    root.for_each_leading([&targets](typename stree<ENUMTYPE>::iterator& iter) {
+        if (iter.get_node()->_data.has_inline())
+            targets.push_back(iter.get_node());
+    });
+
+    for (auto node : targets)
+    {
+        node->begin().next_of().insert(node->_data.take_inline());
+    }
+    return targets.size();
+}
+
 //
 // accessor related
 //
@@ -278,6 +621,27 @@ struct _accessor_leaf_base
 template<typename EN, size_t IDX, typename T>
 struct _accessor_leaf;
 
+/*
+    葉の値。inline葉の時はnodeは親のノード（accessor::nth_childを参照）で、inline葉の値を読む。
+*/
+template<typename EN>
+uint64_t _leaf_num(stree<EN>& node)
+{
+    if constexpr (atom<EN>::inline_enabled)
+        if (node._data.has_inline())
+            return node._data.inline_num_value();
+    return node._data.leaf_num();
+}
+
+template<typename EN>
+std::string& _leaf_string(stree<EN>& node)
+{
+    if constexpr (atom<EN>::inline_enabled)
+        if (node._data.has_inline())
+            return node._data.inline_string_value();
+    return node._data.leaf_string();
+}
+
 
 template<typename EN, size_t IDX>
 struct _accessor_leaf<EN, IDX, int64_t> : _accessor_leaf_base<EN>
@@ -285,9 +649,7 @@ struct _accessor_leaf<EN, IDX, int64_t> : _accessor_leaf_base<EN>
     _accessor_leaf(stree<EN>& node) : _accessor_leaf_base<EN>(node) {}
     int64_t to_value(stree<EN>& node)
     {
-        using atom_ = atom<EN>;
-        assert( node._data._type == atom_::numval );
-        return (int64_t)node._data._value._numval._value;
+        return (int64_t)_leaf_num(node);
     }
 };
 
@@ -297,9 +659,7 @@ struct _accessor_leaf<EN, IDX, uint64_t> : _accessor_leaf_base<EN>
     _accessor_leaf(stree<EN>& node) : _accessor_leaf_base<EN>(node) {}
     uint64_t to_value(stree<EN>& node)
     {
-        using atom_ = atom<EN>;
-        assert( node._data._type == atom_::numval );
-        return node._data._value._numval._value;
+        return _leaf_num(node);
     }
 };
 
@@ -309,9 +669,7 @@ struct _accessor_leaf<EN, IDX, std::string> : _accessor_leaf_base<EN>
     _accessor_leaf(stree<EN>& node) : _accessor_leaf_base<EN>(node) {}
     std::string& to_value(stree<EN>& node)
     {
-        using atom_ = atom<EN>;
-        assert( node._data._type == atom_::stringval );
-        return *node._data._value._stringval;
+        return _leaf_string(node);
     }
 };
 
@@ -347,8 +705,15 @@ struct accessor
 
     accessor(stree<ENUMTYPE>& node) : _base(node), _target(node) {}
 
+    // inline葉は0番目の子供で、ノード自身を指す（葉の値はノードのatomから読む）。
     stree<ENUMTYPE>* nth_child( size_t nth )
     {
+        if (_target._data.has_inline())
+        {
+            if (nth == 0)
+                return &_target;
+            nth--;
+        }
         return _target.nth_child( (int)nth );
     }
 
@@ -378,6 +743,12 @@ get(accessor<ENUMTYPE, eid, TP...>& ac)
 {
     using type = typename select<IDX, TP...>::type;
     auto target = ac.nth_child(IDX);
+    // inline葉にはノードが無い。streeで受け取るならexpand_inline_leavesで戻しておく事。
+    if (target == &ac._target)
+    {
+        assert(false);
+        throw std::runtime_error("stree field refers to an inline leaf");
+    }
     return static_cast<_accessor_leaf<ENUMTYPE, IDX, type>&>(ac._base).to_value(*target);
 }
 
@@ -391,5 +762,183 @@ get(accessor<ENUMTYPE, eid, TP...>& ac)
     return static_cast<_accessor_leaf<ENUMTYPE, IDX, type>&>(ac._base).to_value(*target);
 }
 
+//
+// materialized accessor
+//
+
+template<typename ACC, bool CHECKED = true>
+struct materialized;
+
+/*
+    スキーマで検証済みのツリー用。チェックを一切しないmaterialized。stree_schema.hppを参照。
+*/
+template<typename ACC>
+using unchecked = materialized<ACC, false>;
+
+/*
+    materializedの各フィールドの型と値。
+    streeとstd::stringは参照、数値は値、入れ子のaccessorはmaterializedになる。
+    CHECKEDの時の型のチェックは_accessor_leafと同じ。
+*/
+template<typename EN, typename T, bool CHECKED>
+struct _materialized_field
+{
+    using type = T;
+    static type value(stree<EN>& node)
+    {
+        if constexpr (CHECKED)
+            return _accessor_leaf<EN, 0, T>(node).to_value(node);
+        return (T)node._data.leaf_num_unchecked();
+    }
+};
+
+template<typename EN, bool CHECKED>
+struct _materialized_field<EN, stree<EN>, CHECKED>
+{
+    using type = stree<EN>&;
+    static type value(stree<EN>& node) { return node; }
+};
+
+template<typename EN, bool CHECKED>
+struct _materialized_field<EN, std::string, CHECKED>
+{
+    using type = std::string&;
+    static type value(stree<EN>& node)
+    {
+        if constexpr (CHECKED)
+            return _accessor_leaf<EN, 0, std::string>(node).to_value(node);
+        return node._data.leaf_string_unchecked();
+    }
+};
+
+template<typename EN, EN eid, typename... CHLDS, bool CHECKED>
+struct _materialized_field<EN, accessor<EN, eid, CHLDS...>, CHECKED>
+{
+    using type = materialized<accessor<EN, eid, CHLDS...>, CHECKED>;
+    static type value(stree<EN>& node) { return type(node); }
+};
+
+template<typename EN, typename... CHLDS>
+struct _first_is_tree : std::false_type {};
+
+template<typename EN, typename... RESTs>
+struct _first_is_tree<EN, stree<EN>, RESTs...> : std::true_type {};
+
+/*
+    accessorの全フィールドを、コンストラクタで子供を一回たどるだけで求めておくもの。
+    種類と子供の数のチェックもコンストラクタで一回だけ行う。
+    getやstructured bindingで読む時はtupleから取り出すだけ。
+
+    auto [v, value, body] = materialize<let_op>(node);
+
+    CHECKEDがfalse（unchecked<ACC>）の時はチェックを一切せず、リンクを直接たどるだけ（分岐はinline葉の有無だけ）。
+*/
+template<typename ENUMTYPE, ENUMTYPE eid, typename... CHLDS, bool CHECKED>
+struct materialized<accessor<ENUMTYPE, eid, CHLDS...>, CHECKED>
+{
+    using fields_t = std::tuple<typename _materialized_field<ENUMTYPE, CHLDS, CHECKED>::type...>;
+
+    stree<ENUMTYPE>& _target;
+    fields_t _fields;
+
+    explicit materialized(stree<ENUMTYPE>& node)
+        : _target(node), _fields(resolve(node, std::make_index_sequence<sizeof...(CHLDS)>())) {}
+
+private:
+    template<size_t... IDX>
+    static fields_t resolve(stree<ENUMTYPE>& node, std::index_sequence<IDX...>)
+    {
+        std::array<stree<ENUMTYPE>*, sizeof...(CHLDS)> children;
+        if constexpr (CHECKED)
+            resolve_checked(node, children);
+        else
+            resolve_unchecked(node, children);
+
+        return fields_t(_materialized_field<ENUMTYPE, CHLDS, CHECKED>::value(*std::get<IDX>(children))...);
+    }
+
+    static void resolve_checked(stree<ENUMTYPE>& node, std::array<stree<ENUMTYPE>*, sizeof...(CHLDS)>& children)
+    {
+        using atom_ = atom<ENUMTYPE>;
+        assert( node._data._type == atom_::enumval );
+        assert( node._data._value._enumval == eid );
+
+        auto iter = node.begin_child();
+        auto end = node.end_child();
+        size_t first = 0;
+        if (node._data.has_inline())
+        {
+            assert( sizeof...(CHLDS) > 0 );
+            // inline葉にはノードが無いので、streeのフィールドでは受け取れない。
+            if (_first_is_tree<ENUMTYPE, CHLDS...>::value)
+            {
+                assert(false);
+                throw std::runtime_error("stree field refers to an inline leaf");
+            }
+            children[first++] = &node;
+        }
+        for (auto i : irange(first, sizeof...(CHLDS)))
+        {
+            assert( iter != end );
+            children[i] = (iter++).get_node();
+        }
+        assert( iter == end );
+        UNUSED(end);
+    }
+
+    // 最初の子供はleadingのnext、弟はtrailingのnext。inline葉があればノード自身が最初の子供。
+    static void resolve_unchecked(stree<ENUMTYPE>& node, std::array<stree<ENUMTYPE>*, sizeof...(CHLDS)>& children)
+    {
+        auto child = node.get_link(edge_dir::leading, prior_next::next);
+        size_t first = 0;
+        if (sizeof...(CHLDS) > 0 && node._data.has_inline())
+            children[first++] = &node;
+        for (auto i : irange(first, sizeof...(CHLDS)))
+        {
+            children[i] = child;
+            child = child->get_link(edge_dir::trailing, prior_next::next);
+        }
+    }
+};
+
+template<typename ACC, typename ENUMTYPE>
+materialized<ACC> materialize(stree<ENUMTYPE>& node)
+{
+    return materialized<ACC>(node);
+}
+
+template<size_t IDX, typename ACC, bool CHECKED>
+typename std::tuple_element<IDX, typename materialized<ACC, CHECKED>::fields_t>::type&
+get(materialized<ACC, CHECKED>& m)
+{
+    return std::get<IDX>(m._fields);
+}
+
+template<size_t IDX, typename ACC, bool CHECKED>
+const typename std::tuple_element<IDX, typename materialized<ACC, CHECKED>::fields_t>::type&
+get(const materialized<ACC, CHECKED>& m)
+{
+    return std::get<IDX>(m._fields);
+}
+
+template<size_t IDX, typename ACC, bool CHECKED>
+typename std::tuple_element<IDX, typename materialized<ACC, CHECKED>::fields_t>::type&&
+get(materialized<ACC, CHECKED>&& m)
+{
+    return std::get<IDX>(std::move(m._fields));
+}
+
+}
+
+// materializedのstructured binding用。
+namespace std
+{
+template<typename ACC, bool CHECKED>
+struct tuple_size<symtree::materialized<ACC, CHECKED>>
+    : tuple_size<typename symtree::materialized<ACC, CHECKED>::fields_t> {};
+
+template<size_t IDX, typename ACC, bool CHECKED>
+struct tuple_element<IDX, symtree::materialized<ACC, CHECKED>>
+    : tuple_element<IDX, typename symtree::materialized<ACC, CHECKED>::fields_t> {};
 }
 #endif
\ No newline at end of file
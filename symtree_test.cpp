@@ -3,9 +3,25 @@
 #include "nfiftest.hpp"
 
 #include "symtree.hpp"
+#include "forest_journal.hpp"
+#include "forest_map.hpp"
+#include "forest_resume.hpp"
+#include "stree_async.hpp"
+#include "stree_diff.hpp"
+#include "stree_index.hpp"
+#include "stree_kind.hpp"
+#include "stree_literal.hpp"
+#include "stree_match.hpp"
+#include "stree_rewrite.hpp"
+#include "stree_schema.hpp"
+#include "stree_shared.hpp"
+#include "stree_store.hpp"
+#include "stree_visit.hpp"
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <filesystem>
+#include <fstream>
 #include <tuple>
 
 using namespace std;
@@ -44,6 +60,31 @@ enum class test_sym
   let
 };
 
+// inline葉のテスト用。test_symと同じ要素で、inline葉を使う。
+enum class inline_sym
+{
+  int_imm,
+  variable,
+  sub,
+  add,
+  let
+};
+
+namespace symtree
+{
+template<>
+struct atom_traits<inline_sym>
+{
+  static constexpr bool inline_leaves = true;
+};
+}
+
+// inline葉を使わないenum。
+enum class plain_sym
+{
+  value
+};
+
 struct enum_formatter
 {
   static std::string enum_to_str(test_sym sym)
@@ -62,6 +103,11 @@ struct enum_formatter
         return "let";
     }
   }
+
+  static std::string enum_to_str(inline_sym sym)
+  {
+    return enum_to_str((test_sym)sym);
+  }
 };
 
 using ttree = stree<test_sym>;
@@ -76,6 +122,32 @@ inline std::string ttree_dump(ttree& root)
   return stree_dump<test_sym, enum_formatter>(root);
 } 
 
+using itree = stree<inline_sym>;
+using itree_builder = stree_builder<inline_sym>;
+using iatom = atom<inline_sym>;
+
+inline std::string itree_dump(itree& root)
+{
+  return stree_dump<inline_sym, enum_formatter>(root);
+}
+
+// test_symのツリーを同じ形のinline_symのツリーにする。
+inline itree* to_inline_tree(ttree& src)
+{
+  return map_tree<iatom>(src, [](const tatom& a) {
+    switch(a._type)
+    {
+      case tatom::enumval:
+        return iatom((inline_sym)a._value._enumval);
+      case tatom::numval:
+        return iatom(a._value._numval);
+      case tatom::stringval:
+        break;
+    }
+    return iatom(*a._value._stringval);
+  });
+}
+
 using var_op = taccessor<test_sym::variable, string>;
 using int_imm = taccessor<test_sym::int_imm, int64_t>;
 using add_op = taccessor<test_sym::add, ttree, ttree>;
@@ -214,6 +286,10 @@ static std::vector<TestPair> test_cases1 = {
   expr root_expr(*root);
   REQUIRE( 6 == root_expr.eval() );
 
+  // 子供は読む度にたどるので、ツリーを変えた後も古い子供を返さない。
+  REQUIRE( nullptr == op1.nth_child(2) );
+  auto old = root->nth_child(0)->begin().replace(new ttree(tatom(test_sym::variable)));
+  REQUIRE( test_sym::variable == get<0>(op1)._data._value._enumval );
 }},
 {"let accessorのテスト", []{
   ttree_builder builder;
@@ -258,7 +334,1112 @@ static std::vector<TestPair> test_cases1 = {
   REQUIRE( "x" == get<0>(v) );
 
 
-}}
+}},
+{"kind_indexのテスト", []{
+  ttree_builder builder;
+
+  // let x = 3+4 in x+5
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(3);
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(4);
+    }
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(5);
+    }
+  }
+
+  auto root = builder._root;
+  kind_index<test_sym> index(*root);
+  auto value = root->nth_child(1);
+  auto body = root->nth_child(2);
+
+  if (SECTION("ドキュメント順に並んでいる")) {SG g;
+    REQUIRE( 1 == index.count(test_sym::let) );
+    REQUIRE( 2 == index.count(test_sym::add) );
+    REQUIRE( 0 == index.count(test_sym::sub) );
+
+    auto& ints = index.nodes_of(test_sym::int_imm);
+    REQUIRE( 3 == ints.size() );
+    REQUIRE( ints[0] == value->nth_child(0) );
+    REQUIRE( ints[1] == value->nth_child(1) );
+    REQUIRE( ints[2] == body->nth_child(1) );
+  }
+
+  if (SECTION("途中にinsertしても順番が保たれる")) {SG g;
+    // valueの3と4の間にint_immを入れる。
+    auto iter = value->nth_child(0)->begin().to_trailing();
+    iter++;
+    auto inserted = index.insert(iter, tatom(test_sym::int_imm));
+
+    auto& ints = index.nodes_of(test_sym::int_imm);
+    REQUIRE( 4 == ints.size() );
+    REQUIRE( ints[1] == inserted.get_node() );
+    REQUIRE( ints[2] == value->nth_child(2) );
+  }
+
+  if (SECTION("eraseとreplace")) {SG g;
+    auto iter = value->begin();
+    index.erase(iter);
+    REQUIRE( 1 == index.count(test_sym::add) );
+    REQUIRE( 1 == index.count(test_sym::int_imm) );
+    REQUIRE( index.nodes_of(test_sym::add)[0] == body );
+
+    auto newNode = new ttree(tatom(test_sym::sub));
+    auto biter = body->begin();
+    auto old = index.replace(biter, newNode);
+    REQUIRE( 0 == index.count(test_sym::add) );
+    REQUIRE( 0 == index.count(test_sym::int_imm) );
+    REQUIRE( 1 == index.count(test_sym::variable) );
+    REQUIRE( newNode == index.nodes_of(test_sym::sub)[0] );
+  }
+
+  if (SECTION("forest_iteratorで直接変更しても更新される")) {SG g;
+    value->begin().erase_subtree();
+    REQUIRE( 1 == index.count(test_sym::add) );
+    REQUIRE( 1 == index.count(test_sym::int_imm) );
+
+    // bodyの5の前にint_immを入れる。
+    auto five = body->nth_child(1);
+    auto inserted = five->begin().insert(tatom(test_sym::int_imm));
+    auto& ints = index.nodes_of(test_sym::int_imm);
+    REQUIRE( 2 == ints.size() );
+    REQUIRE( ints[0] == inserted.get_node() );
+    REQUIRE( ints[1] == five );
+
+    // 他のツリーの変更は関係無い。
+    ttree other(tatom(test_sym::add));
+    other.append_child(new ttree(tatom(test_sym::int_imm)));
+    REQUIRE( 2 == index.count(test_sym::int_imm) );
+
+    // 他のツリーへ移すと消え、戻すと入る。
+    auto moved = five->begin().unchain();
+    other.begin().to_trailing().chain(moved);
+    REQUIRE( 1 == index.count(test_sym::int_imm) );
+    body->begin().to_trailing().chain(moved->begin().unchain());
+    REQUIRE( 2 == index.count(test_sym::int_imm) );
+    REQUIRE( index.nodes_of(test_sym::int_imm)[1] == five );
+  }
+
+  if (SECTION("journalのrollbackでも戻る")) {SG g;
+    forest_journal<tatom> journal(*root);
+    journal.begin();
+    value->begin().erase_subtree();
+    body->nth_child(1)->begin().insert(tatom(test_sym::sub));
+    REQUIRE( 1 == index.count(test_sym::sub) );
+    journal.rollback();
+
+    REQUIRE( 0 == index.count(test_sym::sub) );
+    auto& ints = index.nodes_of(test_sym::int_imm);
+    REQUIRE( 3 == ints.size() );
+    REQUIRE( ints[0] == value->nth_child(0) );
+    REQUIRE( ints[1] == value->nth_child(1) );
+    REQUIRE( ints[2] == body->nth_child(1) );
+  }
+}},
+{"tree_matcherのテスト", []{
+  ttree_builder builder;
+
+  // let x = 3+4 in x+5
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(3);
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(4);
+    }
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(5);
+    }
+  }
+
+  auto root = builder._root;
+  auto value = root->nth_child(1);
+  auto body = root->nth_child(2);
+
+  using add_var_int = taccessor<test_sym::add, var_op, int_imm>;
+  using add_int_int = taccessor<test_sym::add, int_imm, int_imm>;
+  using let_of_add = taccessor<test_sym::let, var_op, add_int_int, ttree>;
+
+  tree_matcher<test_sym, add_op, add_var_int, let_of_add, sub_op> matcher;
+  auto res = matcher.match_all(*root);
+
+  REQUIRE( 2 == res[0].size() );
+  REQUIRE( value == res[0][0] );
+  REQUIRE( body == res[0][1] );
+
+  REQUIRE( 1 == res[1].size() );
+  REQUIRE( body == res[1][0] );
+
+  REQUIRE( 1 == res[2].size() );
+  REQUIRE( root == res[2][0] );
+
+  REQUIRE( 0 == res[3].size() );
+
+  // マッチしたノードにはそのままaccessorが使える。
+  add_var_int op(*res[1][0]);
+  auto var = get<0>(op);
+  auto imm = get<1>(op);
+  REQUIRE( "x" == get<0>(var) );
+  REQUIRE( 5 == get<0>(imm) );
+}},
+{"rewriterのテスト", []{
+  auto alloc_count = g_node_alloc_count;
+  {
+    ttree_builder builder;
+
+    // (x + (3-3)) + (1+2)
+    builder.create_root(test_sym::add);
+    {
+      auto with_guard = builder.append_with(test_sym::add);
+      {
+        auto with2 = builder.append_with(test_sym::variable);
+        builder.append("x");
+      }
+      {
+        auto with2 = builder.append_with(test_sym::sub);
+        {
+          auto with3 = builder.append_with(test_sym::int_imm);
+          builder.append(3);
+        }
+        {
+          auto with3 = builder.append_with(test_sym::int_imm);
+          builder.append(3);
+        }
+      }
+    }
+    {
+      auto with_guard = builder.append_with(test_sym::add);
+      {
+        auto with2 = builder.append_with(test_sym::int_imm);
+        builder.append(1);
+      }
+      {
+        auto with2 = builder.append_with(test_sym::int_imm);
+        builder.append(2);
+      }
+    }
+
+    using add_imm = taccessor<test_sym::add, int_imm, int_imm>;
+    using sub_imm = taccessor<test_sym::sub, int_imm, int_imm>;
+    using add_zero = taccessor<test_sym::add, ttree, int_imm>;
+
+    auto rw = make_rewriter<test_sym>(
+      make_rule<add_imm>([](add_imm& op, rewrite_context<test_sym>& ctx) {
+        auto left = get<0>(op);
+        auto right = get<1>(op);
+        return ctx.make(test_sym::int_imm, { ctx.make((int)(get<0>(left) + get<0>(right))) });
+      }),
+      make_rule<sub_imm>([](sub_imm& op, rewrite_context<test_sym>& ctx) {
+        auto left = get<0>(op);
+        auto right = get<1>(op);
+        return ctx.make(test_sym::int_imm, { ctx.make((int)(get<0>(left) - get<0>(right))) });
+      }),
+      make_rule<add_zero>([](add_zero& op, rewrite_context<test_sym>& ctx) -> ttree* {
+        auto right = get<1>(op);
+        if (get<0>(right) != 0)
+          return nullptr;
+        return ctx.take(get<0>(op));
+      })
+    );
+
+    auto expect = R"(<enum:add>
+  <enum:var>
+    <string:x>
+    </string:x>
+  </enum:var>
+  <enum:int>
+    <int:3>
+    </int:3>
+  </enum:int>
+</enum:add>
+)";
+
+    // journalのトランザクションの中なら、書き換えをrollbackで取り消せる。
+    auto original = ttree_dump(*builder._root);
+    {
+      forest_journal<tatom> journal(*builder._root);
+      journal.begin();
+      REQUIRE( 3 == rw.run(builder._root) );
+      REQUIRE( expect == ttree_dump(*builder._root) );
+      journal.rollback();
+      builder._root = journal.root();
+      REQUIRE( original == ttree_dump(*builder._root) );
+    }
+
+    auto before = g_node_alloc_count;
+    REQUIRE( 3 == rw.run(builder._root) );
+    REQUIRE( expect == ttree_dump(*builder._root) );
+
+    // 新しく確保したのは、プールが空だった最初の書き換え（3-3）の2ノードだけ。
+    // 1+2の書き換えは、捨てたノードをプールから取って使い回している。
+    REQUIRE( 2 == g_node_alloc_count - before );
+    REQUIRE( 0 < rw._ctx._pool.size() );
+    REQUIRE( rw._ctx._taken.empty() );
+    REQUIRE( rw._ctx._made.empty() );
+    REQUIRE( 0 == rw.run(builder._root) );
+
+    // 取り出して作ってからnullptrを返しても、ツリーは元のままで、作ったノードはプールに戻る。
+    auto undo = make_rewriter<test_sym>(
+      make_rule<add_op>([](add_op& op, rewrite_context<test_sym>& ctx) -> ttree* {
+        auto& a = get<0>(op);
+        auto& b = get<1>(op);
+        auto left = ctx.take(a);
+        auto right = ctx.take(b);
+        ctx.make(test_sym::sub, { right, left });
+        return nullptr;
+      })
+    );
+    REQUIRE( 0 == undo.run(builder._root) );
+    REQUIRE( expect == ttree_dump(*builder._root) );
+    REQUIRE( 1 == undo._ctx._pool.size() );
+    REQUIRE( undo._ctx._taken.empty() );
+  }
+  REQUIRE( alloc_count == g_node_alloc_count );
+}},
+{"visitorのテスト", []{
+  ttree_builder builder;
+
+  // 3 + (7 - x)
+  builder.create_root(test_sym::add);
+  {
+    auto with_guard = builder.append_with(test_sym::int_imm);
+    builder.append(3);
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::sub);
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(7);
+    }
+    {
+      auto with2 = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+  }
+
+  auto root = builder._root;
+
+  auto eval = make_visitor<test_sym, int>(
+    on<int_imm>([](int_imm& op) { return (int)get<0>(op); }),
+    on<add_op>([](add_op& op, auto& self) { return self(get<0>(op)) + self(get<1>(op)); }),
+    on<sub_op>([](sub_op& op, auto& self) { return self(get<0>(op)) - self(get<1>(op)); }),
+    on<test_sym::variable>([](ttree& node) {
+      var_op op(node);
+      return get<0>(op) == "x" ? 2 : 0;
+    })
+  );
+  REQUIRE( 8 == eval(*root) );
+
+  int others = 0;
+  auto count_add = make_visitor<test_sym, int>(
+    on<test_sym::add>([](ttree&) { return 1; }),
+    otherwise<test_sym>([&others](ttree&) { others++; return 0; })
+  );
+  REQUIRE( 1 == count_add(*root) );
+  REQUIRE( 0 == count_add(*root->nth_child(1)) );
+  REQUIRE( 0 == count_add(*root->nth_child(0)->nth_child(0)) );
+  REQUIRE( 2 == others );
+}},
+{"materializedのテスト", []{
+  ttree_builder builder;
+
+  // let x = 3+4 in x
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(3);
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(4);
+    }
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+
+  auto root = builder._root;
+
+  using let_of_add = taccessor<test_sym::let, var_op, taccessor<test_sym::add, int_imm, int_imm>, ttree>;
+  auto [v, value, body] = materialize<let_of_add>(*root);
+
+  REQUIRE( "x" == get<0>(v) );
+  REQUIRE( 3 == get<0>(get<0>(value)) );
+  REQUIRE( 4 == get<0>(get<1>(value)) );
+  REQUIRE( &body == root->nth_child(2) );
+
+  // 文字列は参照なので、書き換えるとツリーの方も変わる。
+  get<0>(v) = "y";
+  var_op op(*root->nth_child(0));
+  REQUIRE( "y" == get<0>(op) );
+
+  auto eval = make_visitor<test_sym, int>(
+    on<materialized<int_imm>>([](materialized<int_imm>& op) { return (int)get<0>(op); }),
+    on<materialized<add_op>>([](materialized<add_op>& op, auto& self) { return self(get<0>(op)) + self(get<1>(op)); })
+  );
+  REQUIRE( 7 == eval(value._target) );
+}},
+{"schemaのテスト", []{
+  using expr_schema = schema<test_sym, let_op, add_op, sub_op, int_imm>;
+
+  ttree_builder builder;
+
+  // let x = 3 in x+5
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::int_imm);
+    builder.append(3);
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(5);
+    }
+  }
+  auto root = builder._root;
+
+  if (SECTION("正しいツリーは検証を通ってチェック無しで読める")) {SG g;
+    REQUIRE( expr_schema::check(*root).empty() );
+
+    auto tree = expr_schema::validate(*root);
+    auto let = tree.view<let_op>(tree.root());
+    REQUIRE( "x" == get<0>(get<0>(let)) );
+
+    auto eval = make_visitor<test_sym, int>(
+      on<unchecked<int_imm>>([](unchecked<int_imm>& op) { return (int)get<0>(op); }),
+      on<unchecked<var_op>>([](unchecked<var_op>&) { return 3; }),
+      on<unchecked<add_op>>([](unchecked<add_op>& op, auto& self) { return self(get<0>(op)) + self(get<1>(op)); })
+    );
+    REQUIRE( 8 == eval(get<2>(let)) );
+  }
+
+  if (SECTION("違反はすべて報告される")) {SG g;
+    // int_immの中身を文字列に、addの子供を3つに、subの下に未知の種類。
+    auto imm = root->nth_child(1);
+    imm->nth_child(0)->begin().replace(new ttree(tatom("three")));
+
+    auto body = root->nth_child(2);
+    auto iter = body->begin().to_trailing();
+    auto sub = iter.insert(tatom(test_sym::sub)).to_trailing();
+    sub.insert(tatom(test_sym::let));
+
+    auto violations = expr_schema::check(*root);
+    REQUIRE( 4 == violations.size() );
+    REQUIRE( imm == violations[0]._node );
+    REQUIRE( "kind 0: child 0 is not number leaf" == violations[0]._message );
+    REQUIRE( body == violations[1]._node );
+    REQUIRE( "kind 3: too many children, expected 2" == violations[1]._message );
+    REQUIRE( "kind 2: too few children, expected 2" == violations[2]._message );
+    REQUIRE( "kind 4: too few children, expected 3" == violations[3]._message );
+
+    bool thrown = false;
+    try
+    {
+      expr_schema::validate(*root);
+    }
+    catch(schema_error<test_sym>& e)
+    {
+      thrown = true;
+      REQUIRE( 4 == e._violations.size() );
+    }
+    REQUIRE( thrown );
+  }
+
+  if (SECTION("入れ子の形も検証される")) {SG g;
+    // letのbodyはint+intの形。x+5はその形に合わない。
+    using add_imm = taccessor<test_sym::add, int_imm, int_imm>;
+    using let_of_imm = taccessor<test_sym::let, var_op, int_imm, add_imm>;
+    using nested_schema = schema<test_sym, let_of_imm>;
+
+    auto violations = nested_schema::check(*root);
+    REQUIRE( 1 == violations.size() );
+    REQUIRE( root->nth_child(2) == violations[0]._node );
+
+    auto four = new ttree(tatom(test_sym::int_imm));
+    four->append_child(new ttree(tatom(4)));
+    root->nth_child(2)->nth_child(0)->begin().replace(four);
+    auto tree = nested_schema::validate(*root);
+    auto [v, value, body] = tree.view<let_of_imm>(tree.root());
+    REQUIRE( 4 == get<0>(get<0>(body)) );
+    UNUSED(v);
+    UNUSED(value);
+  }
+}},
+{"inline葉のテスト", []{
+  // symはtest_symかinline_sym。
+  auto build = [](auto& builder, auto sym) {
+    using E = decltype(sym);
+    // let x = 3 in x+5
+    builder.create_root(E::let);
+    {
+      auto with_guard = builder.append_with(E::variable);
+      builder.append("x");
+    }
+    {
+      auto with_guard = builder.append_with(E::int_imm);
+      builder.append(3);
+    }
+    {
+      auto with_guard = builder.append_with(E::add);
+      {
+        auto with2 = builder.append_with(E::variable);
+        builder.append("x");
+      }
+      {
+        auto with2 = builder.append_with(E::int_imm);
+        builder.append(5);
+      }
+    }
+  };
+
+  using ivar_op = accessor<inline_sym, inline_sym::variable, string>;
+  using iint_imm = accessor<inline_sym, inline_sym::int_imm, int64_t>;
+  using iadd_op = accessor<inline_sym, inline_sym::add, itree, itree>;
+  using ilet_op = accessor<inline_sym, inline_sym::let, ivar_op, itree, itree>;
+
+  ttree_builder normal;
+  build(normal, test_sym());
+  auto expect = ttree_dump(*normal._root);
+
+  auto before = g_node_alloc_count;
+  itree_builder builder;
+  builder._inline_leaves = true;
+  build(builder, inline_sym());
+  auto root = builder._root;
+
+  // 葉の4ノード分が減る。
+  REQUIRE( 6 == g_node_alloc_count - before );
+  REQUIRE( root->nth_child(1)->_data.has_inline() );
+  REQUIRE( expect == itree_dump(*root) );
+
+  if (SECTION("accessorとmaterializedで普通に読める")) {SG g;
+    ilet_op let(*root);
+    ivar_op v = get<0>(let);
+    REQUIRE( "x" == get<0>(v) );
+
+    iint_imm imm(get<1>(let));
+    REQUIRE( 3 == get<0>(imm) );
+
+    auto [v2, value, body] = materialize<ilet_op>(*root);
+    REQUIRE( "x" == get<0>(v2) );
+    iadd_op add(body);
+    iint_imm five(get<1>(add));
+    REQUIRE( 5 == get<0>(five) );
+    UNUSED(value);
+  }
+
+  if (SECTION("マッチャーとスキーマも同じ規則")) {SG g;
+    using expr_schema = schema<inline_sym, ilet_op, iadd_op, iint_imm>;
+    REQUIRE( expr_schema::check(*root).empty() );
+    auto tree = expr_schema::validate(*root);
+    REQUIRE( 3 == get<0>(tree.view<iint_imm>(*root->nth_child(1))) );
+
+    REQUIRE( matches<ilet_op>(*root) );
+    REQUIRE( !matches<iadd_op>(*root->nth_child(1)) );
+
+    tree_matcher<inline_sym, iint_imm, ivar_op, ilet_op> matcher;
+    auto res = matcher.match_all(*root);
+    REQUIRE( 2 == res[0].size() );
+    REQUIRE( 2 == res[1].size() );
+    REQUIRE( 1 == res[2].size() );
+  }
+
+  if (SECTION("普通のツリーとの相互変換")) {SG g;
+    REQUIRE( 4 == expand_inline_leaves(*root) );
+    REQUIRE( !root->nth_child(1)->_data.has_inline() );
+    REQUIRE( expect == itree_dump(*root) );
+
+    std::unique_ptr<itree> other(to_inline_tree(*normal._root));
+    REQUIRE( 4 == inline_leaves(*other) );
+    REQUIRE( expect == itree_dump(*other) );
+    iint_imm imm(*other->nth_child(1));
+    REQUIRE( 3 == get<0>(imm) );
+  }
+
+  if (SECTION("streeのフィールドはinline葉を受け取らない")) {SG g;
+    using imm_any = accessor<inline_sym, inline_sym::int_imm, itree>;
+    auto& imm = *root->nth_child(1);
+    REQUIRE( !matches<imm_any>(imm) );
+    using imm_schema = schema<inline_sym, ilet_op, iadd_op, imm_any>;
+    REQUIRE( !imm_schema::check(*root).empty() );
+
+    tree_matcher<inline_sym, imm_any> matcher;
+    REQUIRE( matcher.match_all(*root)[0].empty() );
+
+    // 戻せば普通の子供として受け取れる。
+    expand_inline_leaves(*root);
+    REQUIRE( matches<imm_any>(imm) );
+    imm_any acc(imm);
+    REQUIRE( 3 == get<0>(acc)._data.leaf_num() );
+  }
+
+  if (SECTION("inline葉を使わないenumのatomは大きくならない")) {SG g;
+    REQUIRE( !atom<plain_sym>::inline_enabled );
+    REQUIRE( !tatom::inline_enabled );
+    REQUIRE( sizeof(atom<plain_sym>) < sizeof(iatom) );
+    REQUIRE( sizeof(atom<plain_sym>) == sizeof(tatom) );
+
+    stree_builder<plain_sym> plain;
+    plain._inline_leaves = true;
+    plain.create_root(plain_sym::value);
+    plain.append(3);
+    REQUIRE( plain._root->has_children() );
+    REQUIRE( !plain._root->_data.has_inline() );
+  }
+}},
+{"stree_storeのテスト", []{
+  // let x = 3 in x+n
+  auto build = [](ttree_builder& builder, int n) {
+    builder.create_root(test_sym::let);
+    {
+      auto with_guard = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+    {
+      auto with_guard = builder.append_with(test_sym::int_imm);
+      builder.append(3);
+    }
+    {
+      auto with_guard = builder.append_with(test_sym::add);
+      {
+        auto with2 = builder.append_with(test_sym::variable);
+        builder.append("x");
+      }
+      {
+        auto with2 = builder.append_with(test_sym::int_imm);
+        builder.append(n);
+      }
+    }
+  };
+
+  ttree_builder tree1, tree2;
+  build(tree1, 5);
+  build(tree2, 6);
+
+  const char* path = "stree_store_test.bin";
+  std::remove(path);
+
+  uint64_t key1, key2;
+  {
+    stree_store<test_sym> store(path);
+    key1 = store.put(*tree1._root);
+    REQUIRE( key1 == stree_hash(*tree1._root) );
+    // var xは二か所にあるが一つだけ。
+    REQUIRE( 8 == store.chunk_count() );
+
+    auto size = store.stored_bytes();
+    REQUIRE( key1 == store.put(*tree1._root) );
+    REQUIRE( size == store.stored_bytes() );
+
+    // 6, int 6, add, letだけ増える。
+    key2 = store.put(*tree2._root);
+    REQUIRE( key1 != key2 );
+    REQUIRE( 12 == store.chunk_count() );
+  }
+
+  // 開き直しても読める。
+  stree_store<test_sym> store(path);
+  REQUIRE( 12 == store.chunk_count() );
+
+  auto loaded1 = store.get(key1);
+  auto loaded2 = store.get(key2);
+  REQUIRE( ttree_dump(*tree1._root) == ttree_dump(*loaded1) );
+  REQUIRE( ttree_dump(*tree2._root) == ttree_dump(*loaded2) );
+  REQUIRE( nullptr == store.get(key1 ^ 1) );
+
+  // inline葉のあるツリーはハッシュも別。
+  const char* ipath = "stree_store_inline_test.bin";
+  std::remove(ipath);
+  {
+    std::unique_ptr<itree> inlined(to_inline_tree(*loaded1));
+    REQUIRE( key1 == stree_hash(*inlined) );
+    inline_leaves(*inlined);
+
+    stree_store<inline_sym> istore(ipath);
+    auto key3 = istore.put(*inlined);
+    REQUIRE( key3 != key1 );
+    std::unique_ptr<itree> loaded3(istore.get(key3));
+    REQUIRE( loaded3->nth_child(1)->_data.has_inline() );
+    REQUIRE( ttree_dump(*tree1._root) == itree_dump(*loaded3) );
+  }
+
+  delete loaded1;
+  delete loaded2;
+  std::remove(path);
+  std::remove(ipath);
+}},
+{"stree_storeはハッシュが同じでも中身を比べる", []{
+  ttree_builder builder;
+  builder.create_root(test_sym::int_imm);
+  builder.append(3);
+
+  const char* path = "stree_store_test.bin";
+  std::remove(path);
+  {
+    stree_store<test_sym> store(path);
+    store.put(*builder._root);
+  }
+
+  // 最後のチャンク（ルート）の中身を同じ大きさの別のバイトに書き換え、同じハッシュで違う中身のチャンクがある状態を作る。
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(-1, std::ios::end);
+    file.put('\x7f');
+  }
+
+  stree_store<test_sym> store(path);
+  bool thrown = false;
+  try
+  {
+    store.put(*builder._root);
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  REQUIRE( thrown );
+  std::remove(path);
+}},
+{"stree_storeは途中で切れたレコードを捨てる", []{
+  ttree_builder builder;
+  builder.create_root(test_sym::int_imm);
+  builder.append(3);
+
+  const char* path = "stree_store_test.bin";
+  std::remove(path);
+  uint64_t key, full;
+  {
+    stree_store<test_sym> store(path);
+    key = store.put(*builder._root);
+    full = store.stored_bytes();
+    REQUIRE( 2 == store.chunk_count() );
+  }
+
+  // ルートのレコードを途中で切る。
+  std::filesystem::resize_file(path, full - 3);
+  uint64_t truncated;
+  {
+    stree_store<test_sym> store(path);
+    REQUIRE( 1 == store.chunk_count() );
+    REQUIRE( !store.contains(key) );
+    truncated = store.stored_bytes();
+    REQUIRE( truncated < full - 3 );
+    REQUIRE( truncated == std::filesystem::file_size(path) );
+
+    // 切り詰めた所から書き直せる。
+    REQUIRE( key == store.put(*builder._root) );
+    REQUIRE( full == store.stored_bytes() );
+  }
+
+  // ヘッダの途中で切れていても同じ。
+  std::filesystem::resize_file(path, truncated + 5);
+  stree_store<test_sym> store(path);
+  REQUIRE( 1 == store.chunk_count() );
+  REQUIRE( truncated == std::filesystem::file_size(path) );
+  REQUIRE( key == store.put(*builder._root) );
+  auto loaded = store.get(key);
+  REQUIRE( ttree_dump(*builder._root) == ttree_dump(*loaded) );
+  delete loaded;
+  std::remove(path);
+}},
+{"stree_diffのテスト", []{
+  // add(左, 右)。引数は int_imm の値で、負なら var x。
+  auto build = [](ttree_builder& builder, std::vector<int> args) {
+    builder.create_root(test_sym::add);
+    for (auto n : args)
+    {
+      if (n < 0)
+      {
+        auto with_guard = builder.append_with(test_sym::variable);
+        builder.append("x");
+      }
+      else
+      {
+        auto with_guard = builder.append_with(test_sym::int_imm);
+        builder.append(n);
+      }
+    }
+  };
+  auto check = [&build](std::vector<int> from, std::vector<int> to) {
+    ttree_builder oldTree, newTree;
+    build(oldTree, from);
+    build(newTree, to);
+    auto script = stree_diff(*oldTree._root, *newTree._root);
+    auto size = script.size();
+    script.apply(oldTree._root);
+    REQUIRE( ttree_dump(*newTree._root) == ttree_dump(*oldTree._root) );
+    return size;
+  };
+
+  if (SECTION("同じツリー")) {SG g;
+    REQUIRE( 0 == check({-1, 5}, {-1, 5}) );
+  }
+
+  if (SECTION("葉が一つ違う")) {SG g;
+    ttree_builder oldTree, newTree;
+    build(oldTree, {-1, 5});
+    build(newTree, {-1, 6});
+    auto script = stree_diff(*oldTree._root, *newTree._root);
+    REQUIRE( 1 == script.size() );
+    REQUIRE( diff_op<test_sym>::replace == script._ops[0]._type );
+    REQUIRE( 5 == script._ops[0]._target->_data._value._numval._value );
+  }
+
+  if (SECTION("入れ替え")) {SG g;
+    REQUIRE( 1 == check({-1, 5}, {5, -1}) );
+    REQUIRE( 1 == check({1, 2, 3, 4}, {4, 1, 2, 3}) );
+  }
+
+  if (SECTION("挿入と削除")) {SG g;
+    REQUIRE( 1 == check({1, 2, 3}, {1, 7, 2, 3}) );
+    REQUIRE( 1 == check({1, 2, 3}, {1, 3}) );
+    check({1, 2, 3}, {3, -1, 8, 2});
+    check({}, {1, 2});
+    check({1, 2}, {});
+  }
+
+  if (SECTION("ルートが違う")) {SG g;
+    ttree_builder oldTree, newTree;
+    build(oldTree, {1, 2});
+    newTree.create_root(test_sym::sub);
+    {
+      auto with_guard = newTree.append_with(test_sym::int_imm);
+      newTree.append(1);
+    }
+    auto script = stree_diff(*oldTree._root, *newTree._root);
+    REQUIRE( 1 == script.size() );
+    script.apply(oldTree._root);
+    REQUIRE( ttree_dump(*newTree._root) == ttree_dump(*oldTree._root) );
+  }
+
+  if (SECTION("journalで適用を取り消せる")) {SG g;
+    auto allocated = g_node_alloc_count;
+    {
+      ttree_builder oldTree, newTree;
+      build(oldTree, {1, 2, 3});
+      build(newTree, {3, -1, 8, 2});
+      auto original = ttree_dump(*oldTree._root);
+
+      forest_journal<tatom> journal(*oldTree._root);
+      journal.begin();
+      stree_diff(*oldTree._root, *newTree._root).apply(oldTree._root);
+      REQUIRE( ttree_dump(*newTree._root) == ttree_dump(*oldTree._root) );
+      journal.rollback();
+      REQUIRE( original == ttree_dump(*oldTree._root) );
+
+      // ルートの差し替えも戻る。
+      ttree_builder subTree;
+      subTree.create_root(test_sym::sub);
+      journal.begin();
+      stree_diff(*oldTree._root, *subTree._root).apply(oldTree._root);
+      REQUIRE( journal.root() == oldTree._root );
+      journal.rollback();
+      oldTree._root = journal.root();
+      REQUIRE( original == ttree_dump(*oldTree._root) );
+    }
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+}},
+#ifdef SYMTREE_HAS_SHARED_MEMORY
+{"shared_streeのテスト", []{
+  // let x = 3 in x
+  ttree_builder builder;
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::int_imm);
+    builder.append(3);
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  std::unique_ptr<itree> root(to_inline_tree(*builder._root));
+  inline_leaves(*root);
+
+  std::vector<char> mem(shared_stree<inline_sym>::required_bytes(16, 16, 64));
+  auto tree = shared_stree<inline_sym>::create_in(mem.data(), mem.size(), 16, 16, 64);
+  tree.begin_update();
+  tree.set_root(copy_stree(tree, *root));
+  tree.end_update();
+
+  // inline葉も子供に戻っている。
+  REQUIRE( 7 == tree.size() );
+  std::vector<std::string> leaves;
+  for (auto& edge : tree.tree(tree.root()))
+  {
+    auto& value = *edge;
+    if (edge.is_leading() && value.is_string())
+      leaves.push_back(shared_atom_string(tree, value));
+    if (edge.is_leading() && value.is_num())
+      leaves.push_back(std::to_string(value._numval._value));
+  }
+  REQUIRE( (std::vector<std::string> { "x", "3", "x" }) == leaves );
+}},
+#endif
+{"stree_literalのテスト", []{
+  // let x = 3 in x+5
+  static constexpr auto expr = tree_lit(test_sym::let,
+    tree_lit(test_sym::variable, "x"),
+    tree_lit(test_sym::int_imm, 3),
+    tree_lit(test_sym::add,
+      tree_lit(test_sym::variable, "x"),
+      tree_lit(test_sym::int_imm, 5)));
+  static_assert(10 == expr.size(), "size is known at compile time");
+  static_assert(3 == expr.next_of(expr.first_child(0)), "int_imm 3");
+
+  ttree_builder builder;
+  builder.create_root(test_sym::let);
+  {
+    auto with_guard = builder.append_with(test_sym::variable);
+    builder.append("x");
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::int_imm);
+    builder.append(3);
+  }
+  {
+    auto with_guard = builder.append_with(test_sym::add);
+    {
+      auto with2 = builder.append_with(test_sym::variable);
+      builder.append("x");
+    }
+    {
+      auto with2 = builder.append_with(test_sym::int_imm);
+      builder.append(5);
+    }
+  }
+
+  if (SECTION("forestにする")) {SG g;
+    std::unique_ptr<ttree> root(expr.instantiate());
+    REQUIRE( ttree_dump(*builder._root) == ttree_dump(*root) );
+  }
+
+  if (SECTION("作らずに比べる")) {SG g;
+    REQUIRE( expr.equals(*builder._root) );
+
+    static constexpr auto iexpr = tree_lit(inline_sym::let,
+      tree_lit(inline_sym::variable, "x"),
+      tree_lit(inline_sym::int_imm, 3),
+      tree_lit(inline_sym::add,
+        tree_lit(inline_sym::variable, "x"),
+        tree_lit(inline_sym::int_imm, 5)));
+    std::unique_ptr<itree> root(to_inline_tree(*builder._root));
+    inline_leaves(*root);
+    REQUIRE( iexpr.equals(*root) );
+
+    // 数値の符号の有無も比べる。
+    static constexpr auto unsignedExpr = tree_lit(inline_sym::let,
+      tree_lit(inline_sym::variable, "x"),
+      tree_lit(inline_sym::int_imm, 3),
+      tree_lit(inline_sym::add,
+        tree_lit(inline_sym::variable, "x"),
+        tree_lit(inline_sym::int_imm, 5u)));
+    REQUIRE( !unsignedExpr.equals(*root) );
+
+    constexpr auto other = tree_lit(test_sym::let, tree_lit(test_sym::variable, "y"));
+    REQUIRE( !other.equals(*builder._root) );
+  }
+}},
+{"kind_forestのテスト", []{
+  // let x = 3 in x+5
+  static constexpr auto expr = tree_lit(test_sym::let,
+    tree_lit(test_sym::variable, "x"),
+    tree_lit(test_sym::int_imm, 3),
+    tree_lit(test_sym::add,
+      tree_lit(test_sym::variable, "x"),
+      tree_lit(test_sym::int_imm, 5u)));
+  std::unique_ptr<ttree> root(expr.instantiate());
+  auto expect = ttree_dump(*root);
+
+  if (SECTION("streeと同じように回れる")) {SG g;
+    kind_forest<test_sym> packed(*root);
+    REQUIRE( 10 == packed.size() );
+    REQUIRE( expect == (stree_dump<test_sym, enum_formatter>(packed)) );
+
+    // enumだけのノードは小さい。
+    REQUIRE( sizeof(kind_node<test_sym>) < sizeof(kind_payload_node<test_sym>) );
+    REQUIRE( sizeof(kind_payload_node<test_sym>) < sizeof(ttree) );
+    REQUIRE( 6 * sizeof(kind_node<test_sym>) + 4 * sizeof(kind_payload_node<test_sym>) == packed.node_bytes() );
+
+    std::unique_ptr<ttree> back(packed.to_stree());
+    REQUIRE( expect == ttree_dump(*back) );
+  }
+
+  if (SECTION("inline葉")) {SG g;
+    std::unique_ptr<itree> iroot(to_inline_tree(*root));
+    inline_leaves(*iroot);
+    kind_forest<inline_sym> packed(*iroot);
+    REQUIRE( 6 == packed.size() );
+    REQUIRE( expect == (stree_dump<inline_sym, enum_formatter>(packed)) );
+    auto var = packed.begin().next_of();
+    REQUIRE( var.content().has_inline() );
+    REQUIRE( "x" == var.content().leaf_string() );
+
+    using ivar_op = accessor<inline_sym, inline_sym::variable, string>;
+    using iint_imm = accessor<inline_sym, inline_sym::int_imm, int64_t>;
+    using iadd_op = accessor<inline_sym, inline_sym::add, itree, itree>;
+    using ilet_op = accessor<inline_sym, inline_sym::let, ivar_op, itree, itree>;
+    kind_accessor<ilet_op> let(packed.begin());
+    REQUIRE( "x" == get<0>(get<0>(let)) );
+    REQUIRE( 3 == get<0>(kind_accessor<iint_imm>(get<1>(let))) );
+    kind_accessor<iadd_op> add(get<2>(let));
+    REQUIRE( 5 == get<0>(kind_accessor<iint_imm>(get<1>(add))) );
+  }
+
+  if (SECTION("streeにせずにaccessorで読む")) {SG g;
+    kind_forest<test_sym> packed(*root);
+    kind_accessor<let_op> let(packed.begin());
+    REQUIRE( "x" == get<0>(get<0>(let)) );
+    REQUIRE( 3 == get<0>(kind_accessor<int_imm>(get<1>(let))) );
+
+    kind_accessor<add_op> add(get<2>(let));
+    REQUIRE( "x" == get<0>(kind_accessor<var_op>(get<0>(add))) );
+    REQUIRE( 5 == get<0>(kind_accessor<int_imm>(get<1>(add))) );
+
+    // streeにコピーしないので、ノードの数は変わらない。
+    auto before = g_node_alloc_count;
+    get<0>(get<0>(let));
+    REQUIRE( before == g_node_alloc_count );
+  }
+
+  if (SECTION("insertとerase")) {SG g;
+    kind_forest<test_sym> packed(*root);
+    auto iter = packed.begin().to_trailing();
+    iter.insert(tatom("y"));
+    REQUIRE( 11 == packed.size() );
+
+    auto leaf = packed.begin().to_trailing().prior_of();
+    REQUIRE( "y" == leaf.content().leaf_string() );
+    leaf.erase();
+    REQUIRE( expect == (stree_dump<test_sym, enum_formatter>(packed)) );
+  }
+}},
+{"途中で止めるstree_dumpのテスト", []{
+  static constexpr auto expr = tree_lit(inline_sym::add,
+    tree_lit(inline_sym::variable, "x"),
+    tree_lit(inline_sym::sub, tree_lit(inline_sym::int_imm, 3), tree_lit(inline_sym::int_imm, 5)));
+  std::unique_ptr<itree> root(expr.instantiate());
+  inline_leaves(*root);
+
+  forest_walk<iatom> walk(*root);
+  stree_dump_writer<inline_sym, enum_formatter> writer;
+  int rounds = 0;
+  for (;;)
+  {
+    rounds++;
+    auto budget = work_budget::steps(3);
+    if (walk.resume(budget, [&writer](const forest_iterator<iatom>& iter) { writer(*iter); }))
+      break;
+  }
+  REQUIRE( 4 == rounds );
+  REQUIRE( itree_dump(*root) == writer.str() );
+}},
+#ifdef SYMTREE_HAS_COROUTINE
+{"async visitorのテスト", []{
+  // (x + 3) - (y + z)
+  static constexpr auto expr = tree_lit(test_sym::sub,
+    tree_lit(test_sym::add, tree_lit(test_sym::variable, "x"), tree_lit(test_sym::int_imm, 3)),
+    tree_lit(test_sym::add, tree_lit(test_sym::variable, "y"), tree_lit(test_sym::variable, "z")));
+  std::unique_ptr<ttree> root(expr.instantiate());
+
+  lookup_batch<std::string, int> env;
+  std::vector<std::vector<std::string>> requests;
+  auto fetch = [&requests](const std::vector<std::string>& keys) {
+    requests.push_back(keys);
+    std::vector<int> values;
+    for (auto& key : keys)
+      values.push_back(key == "x" ? 10 : key == "y" ? 20 : 30);
+    return values;
+  };
+
+  auto eval = make_async_visitor<test_sym, int>(
+    on<int_imm>([](int_imm& op) -> async_task<int> { co_return (int)get<0>(op); }),
+    on<test_sym::add>([](ttree& node, auto& self) -> async_task<int> {
+      auto a = self(*node.nth_child(0));
+      auto b = self(*node.nth_child(1));
+      co_return co_await a + co_await b;
+    }),
+    on<sub_op>([](sub_op& op, auto& self) -> async_task<int> {
+      // accessorは最初のco_awaitより前に読む。
+      auto a = self(get<0>(op));
+      auto b = self(get<1>(op));
+      co_return co_await a - co_await b;
+    }),
+    on<test_sym::variable>([&env](ttree& node) -> async_task<int> {
+      var_op op(node);
+      co_return co_await env.lookup(get<0>(op));
+    })
+  );
+
+  auto task = eval(*root);
+  REQUIRE( !task.done() );
+  REQUIRE( 3 == env.pending_count() );
+
+  REQUIRE( 13 - 50 == run_batched(task, env, fetch) );
+  REQUIRE( 1 == env.fetch_count() );
+  REQUIRE( ( std::vector<std::string> { "x", "y", "z" } ) == requests[0] );
+
+  // lookupの無いツリーはその場で終わる。
+  auto plain = eval(*root->nth_child(0)->nth_child(1));
+  REQUIRE( plain.done() );
+  REQUIRE( 3 == plain.result() );
+}},
+#endif
 };
 
 void register_symtree_test(std::vector<TestPair>& testCases)
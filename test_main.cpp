@@ -1,8 +1,24 @@
 #include "nfiftest.hpp"
 #include "forest.hpp"
+#include "forest_size.hpp"
+#include "forest_arena.hpp"
+#include "forest_compact.hpp"
+#include "forest_succinct.hpp"
+#include "forest_lazy.hpp"
+#include "forest_cursor.hpp"
+#include "forest_journal.hpp"
+#include "forest_shared.hpp"
+#include "forest_map.hpp"
+#include "forest_view.hpp"
+#include "forest_resume.hpp"
+#include "forest_coro.hpp"
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <filesystem>
+#ifdef SYMTREE_HAS_SHARED_MEMORY
+#include <sys/wait.h>
+#endif
 
 using namespace std;
 using namespace symtree;
@@ -13,7 +29,8 @@ using namespace nfiftest;
 #define REQUIRE(expr) if(!(expr)) throw nfiftest::assert_fail_error(__FILE__, __LINE__, #expr)
 
 
-string dump_tree( forest<string>& node )
+template<typename TREE>
+string dump_tree( TREE& node )
 {
   stringstream actual;
   for (auto& edge : node)
@@ -56,6 +73,28 @@ struct string_cloner
   }
 };
 
+struct string_codec
+{
+  static void write( string& out, const string& value ) { out += value; }
+  static string read( const char* data, size_t size ) { return string( data, size ); }
+};
+
+// サブツリーのサイズの注釈を付けるテスト用のノード。
+struct sized_label
+{
+  string _label;
+  sized_label( const char* label ) : _label( label ) {}
+};
+
+namespace symtree
+{
+template<>
+struct forest_traits<sized_label>
+{
+  using annotation = subtree_size_annotation;
+};
+}
+
 
 std::vector<TestPair> test_cases1 = {
 {"forestの少し複雑なツリーのテスト", []{
@@ -715,6 +754,1340 @@ std::vector<TestPair> test_cases1 = {
     }
 
   }  
+}},
+{"arena_forestのテスト", []{
+  // forestの少し複雑なツリーのテストと同じツリー。
+  arena_forest<string> arena;
+  auto root = arena.create( "grandmother" );
+  auto i = arena.begin( root ).to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto tree = arena.tree( root );
+
+  auto expect = R"(<grandmother>
+<mother>
+<me>
+</me>
+<sister>
+</sister>
+<brother>
+</brother>
+</mother>
+<aunt>
+<cousin>
+</cousin>
+</aunt>
+<uncle>
+</uncle>
+</grandmother>
+)";
+
+  if (SECTION("forestと同じように回れる")) {SG g;
+    REQUIRE( 8 == arena.size() );
+    REQUIRE( expect == dump_tree( tree ) );
+
+    auto iter = arena.begin( root );
+    iter.skip_n_children( 2 );
+    REQUIRE( iter.content() == "aunt" );
+    REQUIRE( iter.is_trailing() );
+    REQUIRE( root == iter.parent_index() );
+
+    // 後ろからも回れる。
+    auto last = arena.begin( root ).to_trailing();
+    last--;
+    REQUIRE( last.content() == "uncle" );
+    REQUIRE( last.is_trailing() );
+  }
+
+  if (SECTION("forestとの相互変換")) {SG g;
+    auto f = arena.to_forest( root );
+    REQUIRE( expect == dump_tree( *f ) );
+
+    arena_forest<string> arena2;
+    auto root2 = arena2.copy_from( *f );
+    auto tree2 = arena2.tree( root2 );
+    REQUIRE( expect == dump_tree( tree2 ) );
+    // preorderに並ぶ。
+    REQUIRE( "sister" == arena2.at( 3 )._data );
+    delete f;
+  }
+
+  if (SECTION("unchain, chain, erase")) {SG g;
+    auto iter = arena.begin( root ).next_of();
+    auto mother = iter.unchain();
+    REQUIRE( iter.content() == "aunt" );
+    REQUIRE( arena.is_root( mother ) );
+
+    // uncleの後ろにつなぎ直す。
+    auto end = arena.begin( root ).to_trailing();
+    end.chain( mother );
+
+    auto cousin = arena.begin( root ).next_of().next_of();
+    REQUIRE( cousin.content() == "cousin" );
+    cousin.erase();
+
+    auto moved = R"(<grandmother>
+<aunt>
+</aunt>
+<uncle>
+</uncle>
+<mother>
+<me>
+</me>
+<sister>
+</sister>
+<brother>
+</brother>
+</mother>
+</grandmother>
+)";
+    REQUIRE( moved == dump_tree( tree ) );
+
+    // 消したノードは使い回す。
+    auto before = arena._nodes.size();
+    arena.begin( root ).to_trailing().insert( "cousin2" );
+    REQUIRE( before == arena._nodes.size() );
+
+    arena.destroy( root );
+    REQUIRE( 0 == arena.size() );
+  }
+
+  if (SECTION("リンクは16byteで、memcpyしても壊れない")) {SG g;
+    REQUIRE( sizeof( arena_node<uint32_t> ) == 20 );
+
+    arena_forest<uint32_t> nums;
+    auto r = nums.create( 1 );
+    auto it = nums.begin( r ).to_trailing();
+    it.insert( 2 ).to_trailing().insert( 3 );
+    it.insert( 4 );
+
+    arena_forest<uint32_t> copied;
+    copied._nodes.resize( nums._nodes.size(), arena_node<uint32_t> { {}, 0 } );
+    memcpy( copied._nodes.data(), nums._nodes.data(), nums._nodes.size() * sizeof( arena_node<uint32_t> ) );
+
+    std::vector<uint32_t> order;
+    for( auto& edge : copied.tree( r ) )
+    {
+      if ( edge.is_leading() )
+        order.push_back( *edge );
+    }
+    REQUIRE( ( std::vector<uint32_t> { 1, 2, 3, 4 } ) == order );
+  }
+}},
+{"compactのテスト", []{
+  auto root = new forest<string>( "grandmother" );
+  auto i = root->begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+
+  // motherを末尾に移動して、ノードの順番をばらばらにしておく。
+  auto mother = root->begin().next_of().unchain();
+  root->append_child( mother );
+  auto expect = dump_tree( *root );
+
+  auto count = g_node_alloc_count;
+  auto sister = root->nth_child( 2 )->nth_child( 1 );
+  auto iter = sister->begin().to_trailing();
+
+  auto res = compact( root );
+  root = res._root;
+  REQUIRE( count == g_node_alloc_count );
+  REQUIRE( expect == dump_tree( *root ) );
+
+  if (SECTION("preorderで連続して並ぶ")) {SG g;
+    std::vector<forest<string>*> nodes;
+    root->for_each_leading( [&nodes]( forest<string>::iterator& it ) { nodes.push_back( it.get_node() ); } );
+    REQUIRE( 8 == nodes.size() );
+    for( auto k : irange( nodes.size() ) )
+      REQUIRE( root + k == nodes[k] );
+    REQUIRE( "mother" == root[4]._data );
+  }
+
+  if (SECTION("iteratorを付け替えられる")) {SG g;
+    auto newIter = res.remap( iter );
+    REQUIRE( newIter.content() == "sister" );
+    REQUIRE( newIter.is_trailing() );
+    newIter++;
+    REQUIRE( newIter.content() == "brother" );
+    REQUIRE( nullptr == res.remap( root ) );
+  }
+
+  if (SECTION("並べ直した後も変更できて、全部消すとブロックも消える")) {SG g;
+    // ブロックのノードも普通に消せる。
+    auto newSister = res.remap( sister );
+    newSister->begin().erase();
+    root->begin().to_trailing().insert( "niece" );
+    root->nth_child( 0 )->begin().replace( new forest<string>( "aunt2" ) );
+    REQUIRE( count - 1 == g_node_alloc_count );
+
+    auto expect2 = R"(<grandmother>
+<aunt2>
+</aunt2>
+<uncle>
+</uncle>
+<mother>
+<me>
+</me>
+<brother>
+</brother>
+</mother>
+<niece>
+</niece>
+</grandmother>
+)";
+    REQUIRE( expect2 == dump_tree( *root ) );
+
+    // 古いノードは前のブロックのものもヒープのものも消え、新しいブロックに7ノード。
+    auto again = compact( res );
+    REQUIRE( count - 1 == g_node_alloc_count );
+    REQUIRE( expect2 == dump_tree( *again._root ) );
+
+    {
+      block_tree<string> moved( std::move( again ) );
+      moved._root->nth_child( 2 )->begin().erase_subtree();
+      REQUIRE( count - 4 == g_node_alloc_count );
+    }
+    REQUIRE( count - 8 == g_node_alloc_count );
+  }
+
+  if (SECTION("ルートを受け取ってdeleteで消せる")) {SG g;
+    res._root = nullptr;
+    delete root->nth_child( 1 )->begin().unchain();
+    REQUIRE( count - 1 == g_node_alloc_count );
+    delete root;
+    REQUIRE( count - 8 == g_node_alloc_count );
+  }
+}},
+{"succinct_forestのテスト", []{
+  if (SECTION("小さいツリー")) {SG g;
+    forest<string> node( "A" );
+    auto i = node.begin().to_trailing();
+    i.insert( "B" ).to_trailing().insert( "D" );
+    i.insert( "C" );
+
+    succinct_forest<string> s( node );
+    REQUIRE( 4 == s.size() );
+    REQUIRE( 8 == s.bit_size() );
+
+    auto b = s.first_child( s.root() );
+    REQUIRE( "B" == s.data( b ) );
+    auto d = s.first_child( b );
+    REQUIRE( "D" == s.data( d ) );
+    REQUIRE( s.is_leaf( d ) );
+    REQUIRE( s.npos == s.next_sibling( d ) );
+    auto c = s.next_sibling( b );
+    REQUIRE( "C" == s.data( c ) );
+    REQUIRE( s.root() == s.parent( c ) );
+    REQUIRE( b == s.parent( d ) );
+    REQUIRE( s.npos == s.parent( s.root() ) );
+    REQUIRE( 2 == s.depth( d ) );
+    REQUIRE( 2 == s.subtree_size( b ) );
+    REQUIRE( 4 == s.subtree_size( s.root() ) );
+    REQUIRE( c == s.node_at( 3 ) );
+  }
+
+  if (SECTION("ブロックをまたぐ大きなツリーでforestと一致する")) {SG g;
+    // 疑似乱数で親を選んで2000ノードのツリーを作る。
+    forest<int> root( 0 );
+    std::vector<forest<int>*> nodes { &root };
+    uint32_t seed = 12345;
+    for( auto k : irange( 1, 2000 ) )
+    {
+      seed = seed * 1103515245 + 12345;
+      auto parent = nodes[( seed >> 8 ) % nodes.size()];
+      auto child = new forest<int>( k );
+      parent->append_child( child );
+      nodes.push_back( child );
+    }
+
+    succinct_forest<int> s( root );
+    REQUIRE( 2000 == s.size() );
+
+    std::vector<forest<int>*> preorder;
+    root.for_each_leading( [&preorder]( forest<int>::iterator& it ) { preorder.push_back( it.get_node() ); } );
+
+    std::vector<size_t> depths;
+    for( auto k : irange( preorder.size() ) )
+    {
+      auto node = preorder[k];
+      auto v = s.node_at( k );
+      REQUIRE( k == s.preorder( v ) );
+      REQUIRE( node->_data == s.data( v ) );
+
+      auto parent = node->parent();
+      if ( parent == nullptr )
+      {
+        REQUIRE( s.npos == s.parent( v ) );
+      }
+      else
+      {
+        REQUIRE( parent->_data == s.data( s.parent( v ) ) );
+      }
+
+      size_t d = 0;
+      for( auto p = parent; p != nullptr; p = p->parent() )
+        d++;
+      REQUIRE( d == s.depth( v ) );
+
+      size_t size = 0;
+      node->for_each_leading( [&size]( forest<int>::iterator& ) { size++; } );
+      REQUIRE( size == s.subtree_size( v ) );
+
+      auto first = node->nth_child( 0 );
+      if ( first == nullptr )
+      {
+        REQUIRE( s.npos == s.first_child( v ) );
+      }
+      else
+      {
+        REQUIRE( first->_data == s.data( s.first_child( v ) ) );
+      }
+
+      auto next = node->begin().to_trailing().next_of();
+      if ( next.get_node() != nullptr && next.is_leading() )
+      {
+        REQUIRE( next.get_node()->_data == s.data( s.next_sibling( v ) ) );
+      }
+      else
+      {
+        REQUIRE( s.npos == s.next_sibling( v ) );
+      }
+    }
+  }
+}},
+{"lazy_forestのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto expect = dump_tree( node );
+
+  // カレントディレクトリは汚さない。失敗して途中で抜けても消す。
+  auto path = ( std::filesystem::temp_directory_path() / "symtree_lazy_forest_test.bin" ).string();
+  struct remover
+  {
+    std::string _path;
+    ~remover() { std::remove( _path.c_str() ); }
+  } cleanup { path };
+  {
+    ofstream out( path, ios::binary );
+    write_lazy_forest<string_codec>( node, out );
+  }
+
+  if (SECTION("降りた所だけ読む")) {SG g;
+    lazy_forest<string, string_codec> tree( path );
+    REQUIRE( 1 == tree.resident() );
+
+    auto iter = tree.begin();
+    iter++;
+    REQUIRE( "mother" == iter.content() );
+    REQUIRE( 4 == tree.resident() );
+
+    // motherの中は飛ばす。
+    iter.to_trailing();
+    iter++;
+    REQUIRE( "aunt" == iter.content() );
+    REQUIRE( iter.has_children() );
+    REQUIRE( 4 == tree.resident() );
+
+    auto children = lazy_child_iterator<string, string_codec>( iter );
+    REQUIRE( "cousin" == *children );
+    REQUIRE( 5 == tree.resident() );
+    children++;
+    REQUIRE( children == children.end() );
+
+    REQUIRE( expect == dump_tree( tree ) );
+    REQUIRE( 8 == tree.resident() );
+  }
+
+  if (SECTION("budgetを超えたら古いサブツリーを捨てる")) {SG g;
+    lazy_forest<string, string_codec> tree( path, 5 );
+    REQUIRE( expect == dump_tree( tree ) );
+    // motherの子供は、auntに降りた時に捨てられている。
+    REQUIRE( 5 == tree.resident() );
+
+    // もう一度回っても同じ。
+    REQUIRE( expect == dump_tree( tree ) );
+    REQUIRE( 5 >= tree.resident() );
+  }
+
+  if (SECTION("開けないファイルは例外")) {SG g;
+    bool thrown = false;
+    try
+    {
+      lazy_forest<string, string_codec> tree( path + ".missing" );
+    }
+    catch( const std::runtime_error& )
+    {
+      thrown = true;
+    }
+    REQUIRE( thrown );
+  }
+}},
+{"forest_journalのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto original = dump_tree( node );
+  auto allocated = g_node_alloc_count;
+
+  forest_journal<string> journal( node );
+  std::vector<size_t> batches;
+  journal.subscribe( [&batches]( const std::vector<journal_record<string>>& batch ) { batches.push_back( batch.size() ); } );
+
+  auto mother = node.nth_child( 0 );
+  auto aunt = node.nth_child( 1 );
+  auto uncle = node.nth_child( 2 );
+
+  if (SECTION("rollbackで元に戻る")) {SG g;
+    journal.begin();
+    mother->begin().to_trailing().insert( "baby" );
+    aunt->begin().erase( aunt->begin().to_trailing().next_of() );
+    journal.retire( uncle->begin().unchain() );
+    journal.retire( mother->begin().replace( new forest<string>( "stepmother" ) ).release() );
+    REQUIRE( original != dump_tree( node ) );
+    REQUIRE( 5 == journal.records().size() );
+
+    journal.rollback();
+    REQUIRE( original == dump_tree( node ) );
+    REQUIRE( allocated == g_node_alloc_count );
+    REQUIRE( mother == node.nth_child( 0 ) );
+    REQUIRE( batches.empty() );
+  }
+
+  if (SECTION("commitでまとめて通知")) {SG g;
+    journal.begin();
+    mother->begin().to_trailing().insert( "baby" );
+    aunt->nth_child( 0 )->begin().erase();
+    REQUIRE( batches.empty() );
+    journal.commit();
+
+    REQUIRE( 1 == batches.size() );
+    REQUIRE( 2 == batches[0] );
+    REQUIRE( journal.records().empty() );
+    REQUIRE( allocated == g_node_alloc_count );
+    REQUIRE( "baby" == node.nth_child( 0 )->nth_child( 3 )->_data );
+    REQUIRE( !aunt->has_children() );
+  }
+
+  if (SECTION("入れ子のトランザクション")) {SG g;
+    journal.begin();
+    uncle->begin().to_trailing().insert( "a" );
+    journal.begin();
+    uncle->begin().to_trailing().insert( "b" );
+    journal.rollback();
+    journal.commit();
+
+    REQUIRE( 1 == batches.size() );
+    REQUIRE( 1 == batches[0] );
+    REQUIRE( "a" == uncle->nth_child( 0 )->_data );
+    REQUIRE( nullptr == uncle->nth_child( 1 ) );
+  }
+
+  if (SECTION("トランザクションの外はすぐに通知")) {SG g;
+    uncle->begin().to_trailing().insert( "a" );
+    uncle->nth_child( 0 )->begin().erase();
+    REQUIRE( 2 == batches.size() );
+    REQUIRE( original == dump_tree( node ) );
+  }
+
+  if (SECTION("他のツリーの変更は記録しない")) {SG g;
+    forest<string> other( "other" );
+    other.begin().to_trailing().insert( "a" );
+    auto moved = uncle->begin().unchain();
+    other.begin().to_trailing().chain( moved );
+    moved->begin().to_trailing().insert( "b" );
+    REQUIRE( 1 == batches.size() );
+    node.begin().to_trailing().chain( moved->begin().unchain() );
+    REQUIRE( 2 == batches.size() );
+    REQUIRE( "b" == node.nth_child( 2 )->nth_child( 0 )->_data );
+  }
+}},
+{"forest_journalを閉じずに消すとrollbackする", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  i.insert( "mother" ).to_trailing().insert( "me" );
+  i.insert( "aunt" ).to_trailing().insert( "cousin" );
+  i.insert( "uncle" );
+  auto original = dump_tree( node );
+  auto allocated = g_node_alloc_count;
+
+  {
+    forest_journal<string> journal( node );
+    journal.begin();
+    node.nth_child( 0 )->begin().to_trailing().insert( "baby" );
+    node.nth_child( 1 )->nth_child( 0 )->begin().erase();
+    journal.retire( node.nth_child( 2 )->begin().unchain() );
+    journal.begin();
+    node.nth_child( 1 )->begin().to_trailing().insert( "x" );
+  }
+  REQUIRE( original == dump_tree( node ) );
+  REQUIRE( allocated == g_node_alloc_count );
+}},
+{"forest_cursorのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+
+  forest_cursor<string> c( &node );
+
+  if (SECTION("上下左右")) {SG g;
+    REQUIRE( 3 == c.child_count() );
+    REQUIRE( c.down( 0 ) );
+    REQUIRE( c.down( 2 ) );
+    REQUIRE( "brother" == *c );
+    REQUIRE( 2 == c.depth() );
+    REQUIRE( 2 == c.index() );
+    REQUIRE( !c.right() );
+    REQUIRE( !c.down( 0 ) );
+    REQUIRE( c.left() );
+    REQUIRE( "sister" == *c );
+    REQUIRE( 1 == c.index() );
+
+    REQUIRE( c.up() );
+    REQUIRE( "mother" == *c );
+    REQUIRE( c.right() );
+    REQUIRE( c.right() );
+    REQUIRE( "uncle" == *c );
+    REQUIRE( !c.right() );
+    REQUIRE( c.left() );
+    REQUIRE( c.down( 0 ) );
+    REQUIRE( "cousin" == *c );
+
+    REQUIRE( c.up() );
+    REQUIRE( c.up() );
+    REQUIRE( !c.up() );
+    REQUIRE( c.is_root() );
+    REQUIRE( !c.left() );
+  }
+
+  if (SECTION("カーソルを通した変更")) {SG g;
+    c.down( 0 );
+    c.down( 1 );
+    c.insert_before( "twin" );
+    c.insert_after( "baby" );
+    REQUIRE( "sister" == *c );
+    REQUIRE( 2 == c.index() );
+
+    c.up();
+    REQUIRE( 5 == c.child_count() );
+    REQUIRE( c.down( 3 ) );
+    REQUIRE( "baby" == *c );
+    c.erase();
+    REQUIRE( "mother" == *c );
+    REQUIRE( 4 == c.child_count() );
+
+    c.down( 0 );
+    auto old = c.replace( new forest<string>( "myself" ) );
+    REQUIRE( "me" == old->_data );
+    c.up();
+    c.append_child( "youngest" );
+    REQUIRE( 5 == c.child_count() );
+    c.down( 4 );
+    REQUIRE( "youngest" == *c );
+
+    std::vector<string> names;
+    for( auto it = node.nth_child( 0 )->begin_child(); it != node.nth_child( 0 )->end_child(); it++ )
+      names.push_back( *it );
+    REQUIRE( ( std::vector<string> { "myself", "twin", "sister", "brother", "youngest" } ) == names );
+  }
+}},
+{"兄弟の並びのsplice", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto original = dump_tree( node );
+  auto allocated = g_node_alloc_count;
+
+  auto mother = node.nth_child( 0 );
+  auto aunt = node.nth_child( 1 );
+  auto uncle = node.nth_child( 2 );
+  auto names_of = []( forest<string>* parent ) {
+    std::vector<string> names;
+    for( auto it = parent->begin_child(); it != parent->end_child(); it++ )
+      names.push_back( *it );
+    return names;
+  };
+
+  if (SECTION("unchain_siblingsとchain_siblings")) {SG g;
+    auto iter = mother->nth_child( 0 )->begin();
+    auto list = iter.unchain_siblings( mother->nth_child( 1 ) );
+    REQUIRE( "brother" == iter.get_node()->_data );
+    REQUIRE( ( std::vector<string> { "brother" } ) == names_of( mother ) );
+
+    auto first = uncle->begin().to_trailing().chain_siblings( list );
+    REQUIRE( "me" == first.get_node()->_data );
+    REQUIRE( ( std::vector<string> { "me", "sister" } ) == names_of( uncle ) );
+    REQUIRE( uncle == node.nth_child( 2 )->nth_child( 1 )->parent() );
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("move_siblings")) {SG g;
+    move_siblings( mother->nth_child( 1 ), mother->nth_child( 2 ), aunt->nth_child( 0 )->begin() );
+    REQUIRE( ( std::vector<string> { "sister", "brother", "cousin" } ) == names_of( aunt ) );
+    REQUIRE( ( std::vector<string> { "me" } ) == names_of( mother ) );
+
+    move_siblings( aunt, uncle, mother->begin() );
+    REQUIRE( ( std::vector<string> { "aunt", "uncle", "mother" } ) == names_of( &node ) );
+  }
+
+  if (SECTION("delete_siblings")) {SG g;
+    delete_siblings( mother->nth_child( 0 )->begin().unchain_siblings( mother->nth_child( 2 ) ) );
+    REQUIRE( !mother->has_children() );
+    REQUIRE( allocated - 3 == g_node_alloc_count );
+  }
+
+  if (SECTION("journalでrollbackできる")) {SG g;
+    forest_journal<string> journal( node );
+    journal.begin();
+    move_siblings( mother->nth_child( 0 ), mother->nth_child( 2 ), uncle->begin().to_trailing() );
+    move_siblings( mother, aunt, uncle->nth_child( 1 )->begin() );
+    REQUIRE( original != dump_tree( node ) );
+    journal.rollback();
+    REQUIRE( original == dump_tree( node ) );
+
+    // delete_siblingsで消した兄弟もjournalが預かっているので戻せる。
+    journal.begin();
+    delete_siblings( mother->nth_child( 0 )->begin().unchain_siblings( mother->nth_child( 2 ) ) );
+    REQUIRE( !mother->has_children() );
+    journal.rollback();
+    REQUIRE( original == dump_tree( node ) );
+
+    // 他のツリーの変更は記録しない。
+    forest<string> other( "other" );
+    journal.begin();
+    other.begin().to_trailing().insert( "child" );
+    REQUIRE( journal.records().empty() );
+    journal.commit();
+  }
+}},
+{"サブツリーをまとめて消す", []{
+  auto allocated = g_node_alloc_count;
+
+  if (SECTION("深いツリーと広いツリーを消す")) {SG g;
+    auto root = new forest<string>( "root" );
+    auto deep = root->begin().to_trailing();
+    for( auto i : irange( 1000 ) )
+      deep = deep.insert( std::to_string( i ) ).to_trailing();
+    auto wide = root->begin().to_trailing().insert( "wide" ).to_trailing();
+    for( auto i : irange( 1000 ) )
+      wide.insert( std::to_string( i ) );
+    REQUIRE( allocated + 2002 == g_node_alloc_count );
+
+    delete root;
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("erase_subtree")) {SG g;
+    forest<string> node( "grandmother" );
+    auto i = node.begin().to_trailing();
+    {
+      auto p = i.insert( "mother" ).to_trailing();
+      p.insert( "me" ).to_trailing().insert( "child" );
+      p.insert( "sister" );
+    }
+    i.insert( "uncle" );
+
+    auto next = node.nth_child( 0 )->begin().erase_subtree();
+    REQUIRE( "uncle" == next.get_node()->_data );
+    REQUIRE( node.nth_child( 0 ) == next.get_node() );
+    REQUIRE( allocated + 2 == g_node_alloc_count );
+
+    // journalがある時は葉ごとに記録するので、rollbackで戻せる。
+    forest_journal<string> journal( node );
+    journal.begin();
+    node.nth_child( 0 )->begin().erase_subtree();
+    REQUIRE( !node.has_children() );
+    journal.rollback();
+    REQUIRE( "uncle" == node.nth_child( 0 )->_data );
+  }
+
+  if (SECTION("compactしたツリーもerase_subtreeとdeleteで消せる")) {SG g;
+    auto root = new forest<string>( "root" );
+    auto deep = root->begin().to_trailing().insert( "deep" ).to_trailing();
+    for( auto i : irange( 100 ) )
+      deep = deep.insert( std::to_string( i ) ).to_trailing();
+    auto wide = root->begin().to_trailing().insert( "wide" ).to_trailing();
+    for( auto i : irange( 100 ) )
+      wide.insert( std::to_string( i ) );
+
+    auto res = compact( root );
+    root = res._root;
+    res._root = nullptr;
+    REQUIRE( allocated + 203 == g_node_alloc_count );
+
+    root->nth_child( 0 )->begin().erase_subtree();
+    REQUIRE( allocated + 102 == g_node_alloc_count );
+
+    delete root;
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("arenaの最後のツリーを消すとarenaごと解放する")) {SG g;
+    arena_forest<string> arena;
+    auto a = arena.create( "A" );
+    arena.begin( a ).to_trailing().insert( "B" );
+    auto c = arena.create( "C" );
+    arena.begin( c ).to_trailing().insert( "D" );
+
+    arena.destroy( a );
+    REQUIRE( 2 == arena.size() );
+    REQUIRE( 0 < arena._nodes.capacity() );
+
+    arena.destroy( c );
+    REQUIRE( 0 == arena.size() );
+    REQUIRE( 0 == arena._nodes.capacity() );
+  }
+}},
+{"map_treeのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+  }
+  i.insert( "uncle" );
+  auto allocated = g_node_alloc_count;
+  auto length = []( const string& s ) { return s.size(); };
+
+  auto same_shape = [&node]( forest<size_t>& mapped ) {
+    auto src = node.begin();
+    for( auto iter = mapped.begin(); iter != mapped.end(); iter++, src++ )
+    {
+      if ( src == node.end() || iter.is_leading() != src.is_leading() || iter.get_node()->_data != src.get_node()->_data.size() )
+        return false;
+    }
+    return src == node.end();
+  };
+
+  if (SECTION("値を変換して同じ形のツリーを作る")) {SG g;
+    auto mapped = map_tree<size_t>( node, length );
+    REQUIRE( same_shape( *mapped ) );
+    REQUIRE( mapped->is_root() );
+    REQUIRE( 6 == mapped->nth_child( 0 )->nth_child( 1 )->_data );
+    REQUIRE( mapped->nth_child( 0 ) == mapped->nth_child( 0 )->nth_child( 1 )->parent() );
+    REQUIRE( allocated + 5 == g_node_alloc_count );
+
+    // 普通のforestとして変更できる。
+    mapped->nth_child( 1 )->begin().to_trailing().insert( 0 );
+    delete mapped;
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("ブロックにまとめて作る")) {SG g;
+    {
+      auto tree = map_tree_in_block<size_t>( node, length );
+      auto mapped = tree._root;
+      REQUIRE( same_shape( *mapped ) );
+      REQUIRE( mapped + 1 == mapped->nth_child( 0 ) );
+      REQUIRE( mapped + 4 == mapped->nth_child( 1 ) );
+
+      // 後から足したヒープのノードも、ブロックと一緒に消える。
+      mapped->nth_child( 1 )->begin().to_trailing().insert( 0 );
+      REQUIRE( allocated + 6 == g_node_alloc_count );
+    }
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+}},
+{"forest_viewのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto original = dump_tree( node );
+  auto allocated = g_node_alloc_count;
+
+  if (SECTION("条件に合わないサブツリーを見せない")) {SG g;
+    auto view = prune_view( node, []( forest<string>& n, size_t ) { return n._data != "mother" && n._data != "cousin"; } );
+    auto expect = R"(<grandmother>
+<aunt>
+</aunt>
+<uncle>
+</uncle>
+</grandmother>
+)";
+    REQUIRE( expect == dump_tree( view ) );
+    REQUIRE( original == dump_tree( node ) );
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("深さで切る")) {SG g;
+    auto view = depth_view( node, 1 );
+    auto expect = R"(<grandmother>
+<mother>
+</mother>
+<aunt>
+</aunt>
+<uncle>
+</uncle>
+</grandmother>
+)";
+    REQUIRE( expect == dump_tree( view ) );
+
+    auto whole = depth_view( node, 2 );
+    REQUIRE( original == dump_tree( whole ) );
+  }
+
+  if (SECTION("兄弟を並べ替える")) {SG g;
+    auto view = sorted_view( node, []( const string& s ) { return s.size(); } );
+    auto expect = R"(<grandmother>
+<aunt>
+<cousin>
+</cousin>
+</aunt>
+<uncle>
+</uncle>
+<mother>
+<me>
+</me>
+<sister>
+</sister>
+<brother>
+</brother>
+</mother>
+</grandmother>
+)";
+    REQUIRE( expect == dump_tree( view ) );
+  }
+
+  if (SECTION("子供を回る")) {SG g;
+    auto view = sorted_view( node, []( const string& s ) { return s; } );
+    std::vector<string> names;
+    for( auto it = view.begin_child(); it != view.end_child(); it++ )
+      names.push_back( *it );
+    REQUIRE( ( std::vector<string> { "aunt", "mother", "uncle" } ) == names );
+
+    names.clear();
+    auto mother = view.begin();
+    for( ; mother != view.end() && mother.get_node()->_data != "mother"; mother++ )
+      ;
+    for( auto it = view.begin_child( mother ); it != view.end_child(); it++ )
+      names.push_back( *it );
+    REQUIRE( ( std::vector<string> { "brother", "me", "sister" } ) == names );
+  }
+}},
+{"途中で止める走査のテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+  auto original = dump_tree( node );
+  auto allocated = g_node_alloc_count;
+  struct cloner { static string clone( const string& src ) { return src; } };
+
+  if (SECTION("budgetの分だけ進んで続きから再開する")) {SG g;
+    forest_walk<string> walk( node );
+    std::vector<string> leadings;
+    auto fn = [&leadings]( const forest_iterator<string>& iter ) {
+      if ( iter.is_leading() )
+        leadings.push_back( iter.get_node()->_data );
+    };
+
+    auto budget = work_budget::steps( 5 );
+    REQUIRE( !walk.resume( budget, fn ) );
+    REQUIRE( ( std::vector<string> { "grandmother", "mother", "me", "sister" } ) == leadings );
+    REQUIRE( 0 == budget._steps );
+
+    // トークンはコピーして続けても良い。
+    auto token = walk;
+    auto rest = work_budget::unlimited();
+    REQUIRE( token.resume( rest, fn ) );
+    REQUIRE( 8 == leadings.size() );
+    REQUIRE( "uncle" == leadings.back() );
+  }
+
+  if (SECTION("締め切りを過ぎたら止まる")) {SG g;
+    forest_walk<string> walk( node );
+    auto budget = work_budget::until( work_budget::clock::now() - std::chrono::seconds( 1 ) );
+    size_t count = 0;
+    REQUIRE( !walk.resume( budget, [&count]( const forest_iterator<string>& ) { count++; } ) );
+    REQUIRE( 0 == count );
+  }
+
+  if (SECTION("clone_walk")) {SG g;
+    clone_walk<string, cloner> cloning( node );
+    int rounds = 0;
+    for( auto budget = work_budget::steps( 4 ); !cloning.resume( budget ); budget = work_budget::steps( 4 ) )
+      rounds++;
+    REQUIRE( 3 == rounds );
+
+    std::unique_ptr<forest<string>> cloned( cloning.release() );
+    REQUIRE( original == dump_tree( *cloned ) );
+  }
+
+  if (SECTION("作りかけのcloneは消える")) {SG g;
+    {
+      clone_walk<string, cloner> cloning( node );
+      auto budget = work_budget::steps( 4 );
+      cloning.resume( budget );
+    }
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("erase_walk")) {SG g;
+    erase_walk<string> erasing( node.nth_child( 0 )->begin().unchain() );
+    // meのleadingとtrailingで2。
+    auto budget = work_budget::steps( 2 );
+    REQUIRE( !erasing.resume( budget ) );
+    REQUIRE( allocated - 1 == g_node_alloc_count );
+
+    budget = work_budget::steps( 4 );
+    REQUIRE( erasing.resume( budget ) );
+    REQUIRE( allocated - 4 == g_node_alloc_count );
+    REQUIRE( "aunt" == node.nth_child( 0 )->_data );
+  }
+
+  if (SECTION("深いツリーでもbudgetで止まる")) {SG g;
+    auto root = new forest<string>( "root" );
+    auto deep = root->begin().to_trailing();
+    for( auto k : irange( 10000 ) )
+      deep = deep.insert( std::to_string( k ) ).to_trailing();
+
+    erase_walk<string> erasing( root );
+    auto budget = work_budget::steps( 100 );
+    REQUIRE( !erasing.resume( budget ) );
+    REQUIRE( allocated + 10001 == g_node_alloc_count );
+
+    auto rest = work_budget::unlimited();
+    REQUIRE( erasing.resume( rest ) );
+    REQUIRE( allocated == g_node_alloc_count );
+  }
+
+  if (SECTION("途中のerase_walkは残りを消す")) {SG g;
+    {
+      erase_walk<string> erasing( node.nth_child( 0 )->begin().unchain() );
+      auto budget = work_budget::steps( 1 );
+      erasing.resume( budget );
+    }
+    REQUIRE( allocated - 4 == g_node_alloc_count );
+  }
+}},
+#ifdef SYMTREE_HAS_COROUTINE
+{"edgesのgeneratorのテスト", []{
+  forest<string> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+  }
+  i.insert( "uncle" );
+
+  stringstream actual;
+  for( auto& e : edges( node ) )
+  {
+    if ( e.is_leading() )
+      actual << "<" << *e << ">" << endl;
+    else
+      actual << "</" << *e << ">" << endl;
+  }
+  REQUIRE( dump_tree( node ) == actual.str() );
+
+  // 途中でやめても良い。
+  size_t count = 0;
+  for( auto& e : edges( node ) )
+  {
+    if ( e.is_trailing() )
+      break;
+    count++;
+  }
+  REQUIRE( 3 == count );
+}},
+#endif
+#ifdef SYMTREE_HAS_SHARED_MEMORY
+{"shared_forestのテスト", []{
+  forest<int> node( 1 );
+  {
+    auto i = node.begin().to_trailing();
+    auto p = i.insert( 2 ).to_trailing();
+    p.insert( 3 );
+    p.insert( 4 );
+    i.insert( 5 );
+  }
+
+  const char* name = "/symtree_shared_forest_test";
+  auto bytes = shared_forest<int>::required_bytes( 16, 4, 64 );
+
+  // 同じ共有メモリを二回マップして、違うアドレスから読む。
+  shared_memory writerMem( name, bytes );
+  shared_memory readerMem( name );
+  shared_memory::unlink( name );
+  REQUIRE( writerMem.data() != readerMem.data() );
+
+  auto writer = shared_forest<int>::create_in( writerMem.data(), writerMem.size(), 16, 4, 64 );
+  writer.begin_update();
+  writer.set_root( writer.copy_from( node ) );
+  writer.end_update();
+
+  auto reader = shared_forest<int>::attach( readerMem.data(), readerMem.size() );
+  REQUIRE( 1 == reader.epoch() );
+  string dumped;
+  reader.read( [&] { auto view = reader.tree( reader.root() ); dumped = dump_tree( view ); } );
+  REQUIRE( dump_tree( node ) == dumped );
+
+  if (SECTION("変更は記録とepochで届く")) {SG g;
+    auto lastEpoch = reader.epoch();
+
+    writer.begin_update();
+    auto two = writer.begin( writer.root() ).next_of();
+    two.to_trailing().insert( 6 );
+    auto three = writer.begin( writer.root() ).next_of().next_of();
+    REQUIRE( 3 == three.content() );
+    three.erase();
+    writer.end_update();
+
+    REQUIRE( lastEpoch + 1 == reader.epoch() );
+    std::vector<shared_record::kind> kinds;
+    REQUIRE( reader.changes_since( lastEpoch, [&]( const shared_record& r ) { kinds.push_back( r._kind ); } ) );
+    REQUIRE( 2 == kinds.size() );
+    REQUIRE( shared_record::chain == kinds[0] );
+    REQUIRE( shared_record::erase == kinds[1] );
+
+    node.nth_child( 0 )->append_child( new forest<int>( 6 ) );
+    node.nth_child( 0 )->nth_child( 0 )->begin().erase();
+    reader.read( [&] { auto view = reader.tree( reader.root() ); dumped = dump_tree( view ); } );
+    REQUIRE( dump_tree( node ) == dumped );
+    REQUIRE( 5 == reader.size() );
+  }
+
+  if (SECTION("記録の輪が一周したら読み直し")) {SG g;
+    writer.begin_update();
+    for( auto i : irange( 5 ) )
+      writer.begin( writer.root() ).to_trailing().insert( 10 + i );
+    writer.end_update();
+
+    REQUIRE( !reader.changes_since( 0, []( const shared_record& ) {} ) );
+    REQUIRE( reader.changes_since( 1, []( const shared_record& ) {} ) == false );
+    int count = 0;
+    REQUIRE( reader.changes_since( 2, [&]( const shared_record& ) { count++; } ) );
+    REQUIRE( 0 == count );
+  }
+
+  if (SECTION("ノードが足りない")) {SG g;
+    writer.begin_update();
+    bool thrown = false;
+    try
+    {
+      for( auto i : irange( 20 ) )
+        writer.begin( writer.root() ).to_trailing().insert( i );
+    }
+    catch( std::length_error& )
+    {
+      thrown = true;
+    }
+    writer.end_update();
+    REQUIRE( thrown );
+    REQUIRE( 16 == reader.size() );
+  }
+
+  if (SECTION("ヘッダより小さい領域にはつながない")) {SG g;
+    bool thrown = false;
+    try
+    {
+      shared_forest<int>::attach( readerMem.data(), bytes - 1 );
+    }
+    catch( std::length_error& )
+    {
+      thrown = true;
+    }
+    REQUIRE( thrown );
+
+    thrown = false;
+    try
+    {
+      shared_forest<int>::attach( readerMem.data(), 8 );
+    }
+    catch( std::runtime_error& )
+    {
+      thrown = true;
+    }
+    REQUIRE( thrown );
+  }
+
+  if (SECTION("書く側が書き込みの途中で落ちても、ロックを取り戻せる")) {SG g;
+    auto lastEpoch = reader.epoch();
+    auto pid = fork();
+    if ( pid == 0 )
+    {
+      auto child = shared_forest<int>::attach( readerMem.data(), readerMem.size() );
+      child.begin_update();
+      child.begin( child.root() ).to_trailing().insert( 7 );
+      _exit( 0 );
+    }
+    int status;
+    waitpid( pid, &status, 0 );
+    REQUIRE( reader.updating() );
+
+    // 待ち続けずに読める。落ちた書き込みの変更は途中まで残っている。
+    reader.read( [&] { auto view = reader.tree( reader.root() ); dumped = dump_tree( view ); } );
+    REQUIRE( !reader.updating() );
+    REQUIRE( lastEpoch + 1 == reader.epoch() );
+    REQUIRE( !reader.changes_since( lastEpoch, []( const shared_record& ) {} ) );
+    REQUIRE( reader.changes_since( lastEpoch + 1, []( const shared_record& ) {} ) );
+
+    // 次の書き込みは途中で落ちた事を受け取る。
+    REQUIRE( !writer.begin_update() );
+    writer.end_update();
+    REQUIRE( writer.begin_update() );
+    writer.end_update();
+  }
+
+  if (SECTION("読む側が読んでいる途中で落ちても書ける")) {SG g;
+    auto pid = fork();
+    if ( pid == 0 )
+    {
+      auto child = shared_forest<int>::attach( readerMem.data(), readerMem.size() );
+      child.read( [] { _exit( 0 ); } );
+    }
+    int status;
+    waitpid( pid, &status, 0 );
+
+    REQUIRE( writer.begin_update() );
+    writer.set_root( writer.root() );
+    writer.end_update();
+    reader.read( [&] { auto view = reader.tree( reader.root() ); dumped = dump_tree( view ); } );
+    REQUIRE( dump_tree( node ) == dumped );
+  }
+
+  if (SECTION("読む枠のpidが使い回されていても、起動時刻が違えば片付ける")) {SG g;
+    // 落ちた読む側のpidを、今は自分が使っている事にする。
+    auto header = static_cast<shared_forest_header*>( writerMem.data() );
+    header->_readers[0].store( (uint64_t)0xffffffff << 32 | (uint32_t)getpid() );
+
+    REQUIRE( writer.begin_update() );
+    writer.end_update();
+    REQUIRE( 0 == header->_readers[0].load() );
+  }
+}},
+#endif
+};
+
+std::vector<TestPair> test_cases_size = {
+{"サブツリーのサイズの注釈のテスト", []{
+  forest<sized_label> node( "grandmother" );
+  auto i = node.begin().to_trailing();
+  {
+    auto p = i.insert( "mother" ).to_trailing();
+    p.insert( "me" );
+    p.insert( "sister" );
+    p.insert( "brother" );
+  }
+  {
+    auto p = i.insert( "aunt" ).to_trailing();
+    p.insert( "cousin" );
+  }
+  i.insert( "uncle" );
+
+  auto mother = node.nth_child( 0 );
+  auto aunt = node.nth_child( 1 );
+
+  if (SECTION("insertでサイズと高さが更新される")) {SG g;
+    REQUIRE( subtree_size( node ) == 8 );
+    REQUIRE( subtree_height( node ) == 2 );
+    REQUIRE( subtree_size( *mother ) == 4 );
+    REQUIRE( subtree_height( *mother ) == 1 );
+    REQUIRE( depth_of( *mother->nth_child( 2 ) ) == 2 );
+  }
+
+  if (SECTION("unchainとchain")) {SG g;
+    auto iter = aunt->begin();
+    auto auntTree = iter.unchain();
+    REQUIRE( subtree_size( node ) == 6 );
+    REQUIRE( subtree_size( *auntTree ) == 2 );
+
+    // uncleの子供としてつなぐ。
+    iter.to_trailing();
+    iter.chain( auntTree );
+    REQUIRE( subtree_size( node ) == 8 );
+    REQUIRE( subtree_height( node ) == 3 );
+    REQUIRE( subtree_size( *node.nth_child( 1 ) ) == 3 );
+  }
+
+  if (SECTION("兄弟の並びを移す")) {SG g;
+    move_siblings( mother->nth_child( 0 ), mother->nth_child( 1 ), aunt->begin().to_trailing() );
+    REQUIRE( subtree_size( node ) == 8 );
+    REQUIRE( subtree_size( *mother ) == 2 );
+    REQUIRE( subtree_size( *aunt ) == 4 );
+
+    delete_siblings( aunt->nth_child( 0 )->begin().unchain_siblings( aunt->nth_child( 2 ) ) );
+    REQUIRE( subtree_size( node ) == 5 );
+    REQUIRE( subtree_height( *aunt ) == 0 );
+  }
+
+  if (SECTION("erase_subtree")) {SG g;
+    mother->begin().erase_subtree();
+    REQUIRE( subtree_size( node ) == 4 );
+    REQUIRE( subtree_height( node ) == 2 );
+  }
+
+  if (SECTION("eraseで高さが下がる")) {SG g;
+    auto iter = aunt->begin();
+    iter++; // cousin
+    iter.erase();
+    REQUIRE( subtree_size( node ) == 7 );
+    REQUIRE( subtree_height( *aunt ) == 0 );
+
+    auto miter = mother->begin();
+    auto last = miter.trailing_of();
+    miter++;
+    miter.erase( last );
+    REQUIRE( subtree_size( node ) == 4 );
+    REQUIRE( subtree_size( *mother ) == 1 );
+    REQUIRE( subtree_height( node ) == 1 );
+  }
+
+  if (SECTION("replace")) {SG g;
+    auto subtree = new forest<sized_label>( "A" );
+    auto si = subtree->begin().to_trailing();
+    si.insert( "B" ).to_trailing().insert( "C" );
+
+    auto iter = aunt->begin();
+    auto ret = iter.replace( subtree );
+    REQUIRE( subtree_size( *ret ) == 2 );
+    REQUIRE( subtree_size( node ) == 9 );
+    REQUIRE( subtree_height( node ) == 3 );
+  }
+
+  if (SECTION("親を覚えていて、移しても正しい")) {SG g;
+    auto cousin = aunt->nth_child( 0 );
+    REQUIRE( cousin->_parent == aunt );
+
+    auto auntTree = aunt->begin().unchain();
+    REQUIRE( auntTree->_parent == nullptr );
+    auto sister = mother->nth_child( 1 );
+    sister->begin().to_trailing().chain( auntTree );
+    REQUIRE( auntTree->_parent == sister );
+    REQUIRE( depth_of( *cousin ) == 4 );
+    REQUIRE( subtree_size( *mother ) == 6 );
+
+    // 注釈をコピーしたノードは親を引き継がず、たどった時に覚える。
+    auto copied = map_tree_in_block<sized_label>( node, []( const sized_label& s ) { return s; } );
+    auto copiedSister = copied._root->nth_child( 0 )->nth_child( 1 );
+    REQUIRE( copiedSister->_parent == nullptr );
+    REQUIRE( depth_of( *copiedSister ) == 2 );
+    REQUIRE( copiedSister->_parent == copied._root->nth_child( 0 ) );
+  }
+
+  if (SECTION("preorderでk番目のノード")) {SG g;
+    const char* expect[] = { "grandmother", "mother", "me", "sister", "brother", "aunt", "cousin", "uncle" };
+    for( auto k : irange( 8 ) )
+    {
+      auto iter = nth_preorder( node, k );
+      REQUIRE( iter.is_leading() );
+      REQUIRE( iter.content()._label == expect[k] );
+    }
+    REQUIRE( nth_preorder( node, 8 ) == node.end() );
+  }
+
+  if (SECTION("split_pointsで分割")) {SG g;
+    auto points = split_points( node, 3 );
+    REQUIRE( points.size() == 4 );
+    REQUIRE( points[0] == node.begin() );
+    REQUIRE( points[1].content()._label == "me" );
+    REQUIRE( points[2].content()._label == "aunt" );
+    REQUIRE( points[3] == node.end() );
+  }
+
+  if (SECTION("map_treeは注釈を作り直す")) {SG g;
+    forest<string> plain( "A" );
+    auto pi = plain.begin().to_trailing();
+    pi.insert( "B" ).to_trailing().insert( "C" );
+    pi.insert( "D" );
+
+    auto mapped = map_tree<sized_label>( plain, []( const string& s ) { return s.c_str(); } );
+    REQUIRE( subtree_size( *mapped ) == 4 );
+    REQUIRE( subtree_height( *mapped ) == 2 );
+    REQUIRE( subtree_size( *mapped->nth_child( 0 ) ) == 2 );
+    delete mapped;
+
+    auto copied = map_tree_in_block<sized_label>( node, []( const sized_label& s ) { return s; } );
+    REQUIRE( subtree_size( *copied._root ) == 8 );
+    REQUIRE( subtree_size( *copied._root->nth_child( 0 ) ) == 4 );
+  }
+
+  if (SECTION("cloneは注釈もコピーする")) {SG g;
+    struct cloner { static sized_label clone( const sized_label& src ) { return src; } };
+    auto cloned = node.clone<cloner>();
+    REQUIRE( subtree_size( *cloned ) == 8 );
+    REQUIRE( subtree_size( *cloned->nth_child( 0 ) ) == 4 );
+    delete cloned;
+  }
 }}
 };
 
@@ -724,6 +2097,7 @@ int main()
 {
     std::vector<TestPair> test_cases;
     test_cases.insert(test_cases.end(), test_cases1.begin(), test_cases1.end());
+    test_cases.insert(test_cases.end(), test_cases_size.begin(), test_cases_size.end());
     register_symtree_test(test_cases);
     RunTests(test_cases);
     return 0;